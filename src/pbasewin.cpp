@@ -7,6 +7,7 @@
 #include "playout.h"  
 #include "psublim.h"
 #include "putil.h"
+#include "pwork.h"
 
 /* A lot of people object to macros that are used heavily to save key-strokes
    as they can be hard to interpret for external programmers. In this case, I
@@ -21,10 +22,6 @@
  
 #define LOOP_CHILDREN(a) for (base_window* a = child; a; a = a->next)
 
-/* The mechanism to give each window a unique number needs a static member to
-   know which id to give next. */
-int base_window::new_id = 0; 
-
 /* Low-level debugging flags are set here. */
 int base_window::debug = 0;
                                                                         
@@ -32,28 +29,34 @@ int base_window::debug = 0;
    window is deleted to catch memory-leaks.*/
 int base_window::count = 0;
 
+/* How many windows currently have their display suppressed. */
+int base_window::suppressing = 0;
+
 base_window::base_window() // Blank constructor.
-: next(0), prev(0), parent(0), child(0), next_sub(0), master(0), manager(0),
-  layout(0), layinfo(0), vis_list(0) // NULL all variables
+: next(0), prev(0), parent(0), child(0), vis_list(0), display_count(0), suppressed(0),
+  next_sub(0), master(0), manager(0), extras(0) // NULL all variables
 {
   ax = ay = bx = by = cx = cy = dx = dy = c_cx = c_cy = c_dx = c_dy = 0;
-  click_x = click_y = mouse_x = mouse_y = -1; 
-  button_state = 0;
   
   set_flag(vis_visible);
   set_flag(grx_sensitive);
   set_flag(sys_first_load);
   
-  win_id = base_window::new_id++; // Assign window a unique ID
+  win_id = window_registry::global().add(this); // Assign window a unique ID
   count++; // Increment the window count. Will be decremented on destruction
 }
 
 base_window::~base_window() // Destructor
 {
   // Destroy any associated layout and layout_info objects, these are heap-based
-  delete layinfo; 
-  delete layout; 
+  if (extras)
+  {
+    delete extras->layinfo; 
+    delete extras->layout; 
+    delete extras;
+  }
   
+  window_registry::global().release(win_id); // Any handles to us are now stale
   count--; // Decrement the window count
 }
 
@@ -102,23 +105,20 @@ base_window* base_window::most_next()
   return cur;
 }
 
-// Recursively look for a window with a particular ID
-base_window* base_window::find(int id)
+// Look for a window with a particular ID in our family. The registry finds it
+// straight away, leaving only its ancestry to check.
+base_window* base_window::find(window_id id)
 {
-  if (win_id == id) return this; // If we're the window, return ourselves
-
-  base_window* temp; // Otherwise, pass the buck to our child/next window
-  if (child && (temp = child->find(id))) return temp; // and return their results
-  if (next && (temp = next->find(id))) return temp;
-  return 0;
+  base_window* win = from_id(id);
+  return (win && ancestor_of(win)) ? win : 0;
 }
 
 /* Used to find occluding windows. Returns the next window, if none, then our
  * parent's next. */
 base_window* base_window::next_or_uncle()
 {
-  if (next)   return next;
-  if (parent) return parent->next_or_uncle();
+  for (base_window* loop = this; loop; loop = loop->parent)
+    if (loop->next) return loop->next;
   
   return 0;
 }
@@ -149,11 +149,9 @@ bool base_window::disabled()
 // Returns true if the given window exists within our descendants
 bool base_window::ancestor_of(base_window* orphan) const
 {
-  if (this == orphan) return true;
-  if (!child || !orphan) return false;
-
-  // If we're not the orphan and we have children, ask them
-  LOOP_CHILDREN(loop) if (loop->ancestor_of(orphan)) return true;
+  // Go up from the orphan, looking for ourselves
+  for (const base_window* loop = orphan; loop; loop = loop->parent)
+    if (loop == this) return true;
 
   return false; 
 }
@@ -274,7 +272,7 @@ void base_window::z_shift(int z)
   delegate_displays();
   
   // Pack our parent, as a lot of layout algorithms depend on z-order
-  parent->pack(); 
+  if (get_layinfo()) get_layinfo()->pack(); 
    
   // These are the 'clean-up' operations, only necessarry if we're visible
   if (visible()) 
@@ -298,9 +296,9 @@ void base_window::z_shift(int z)
 
       if (last) // Update the gap
       {
-        set_flag_cascade(grx_sensitive, false); // Make sure we don't get displayed
+        suppress_display(); // Make sure we don't get displayed
         last->draw_arb_zones(this_win, DAZ_R_CHILDREN+DAZ_R_PREVIOUS+DAZ_F_SPYSUB);
-        set_flag_cascade(grx_sensitive, true);
+        restore_display();
       }        
     }
   }
@@ -340,6 +338,9 @@ void base_window::remove()
   extract(); // Remove our family from the window tree
   if (manager) manager->purge(this);  
   
+  // Our old parent's layout no longer has us to measure
+  if (get_layinfo() && old_parent->get_layout()) old_parent->get_layout()->invalidate();
+  
   if (flag(sys_active))
   {
     unload(); // Unload our entire family 
@@ -384,13 +385,13 @@ void base_window::hide_helper()
 {
   // Here, we save the state if our children only if we are visible. If we are invisible, then
   // the state of our children has already been saved, and should not be over-written
-  if (flag(vis_visible))   
+  for (pre_order_iterator i(this); *i; ++i)
   {
-    LOOP_CHILDREN(loop) // Save the state of our children
-    {
+    if (!i->flag(vis_visible)) { i.skip_children(); continue; }
+
+    // Save the state of its children
+    for (base_window* loop = i->child; loop; loop = loop->next)
       loop->set_flag(vis_should_be_visible, loop->flag(vis_visible)); 
-      loop->hide_helper();
-    }
   }
 }  
 
@@ -419,20 +420,24 @@ void base_window::show()
 // Used by 'show' to restore the state of the revealed windows.
 void base_window::show_helper()
 {  
-  set_flag(vis_visible, flag(vis_should_be_visible)); // Restore our original visibility
-  
-  if (window_sub* qualified = dynamic_cast<window_sub*>(this))
+  for (pre_order_iterator i(this); *i; ++i)
   {
-    qualified->update_sub(); // If we're sub, time to recalculate our sub_buffer
-  }
+    base_window* win = *i;
+    win->set_flag(vis_visible, win->flag(vis_should_be_visible)); // Restore its original visibility
   
-  // If we are technically visible, go on restoring our childrens visibility...
-  if (flag(vis_visible)) 
-  {
-    LOOP_CHILDREN(loop) loop->show_helper(); 
-    
-  // If we are technically invisible, make all our children physically invisible        
-  } else set_flag_cascade(vis_visible, false); 
+    if (window_sub* qualified = dynamic_cast<window_sub*>(win))
+    {
+      qualified->update_sub(); // If it's a sub, time to recalculate its sub_buffer
+    }
+  
+    // If it is technically visible, go on restoring its childrens visibility,
+    // otherwise make all its children physically invisible        
+    if (!win->flag(vis_visible))
+    {
+      win->set_flag_cascade(vis_visible, false); 
+      i.skip_children();
+    }
+  }
 }  
 
 /* This work-horse function adjusts the logical co-ordinates of this window to
@@ -496,14 +501,14 @@ void base_window::move_resize(coord_int _ax, coord_int _ay, coord_int _bx, coord
     // If we were resized...
     if (was_resized)
     {
-      set_flag_cascade(grx_sensitive, false); // Make children don't get drawn
-      pack(); // Ask our layout-manager, if any, to reposition our children
+      suppress_display(); // Make children don't get drawn
+      pack_now(); // Ask our layout-manager, if any, to reposition our children
       position_children(); // Allow any client code to reposition children manually
-      set_flag_cascade(grx_sensitive, true); 
+      restore_display(); 
     } 
    
     // If we have a gap to fill, fill it, and redisplay ourselves
-    if (flag(grx_sensitive) && flag(vis_visible) && (was_moved || was_resized || 
+    if (sensitive() && flag(vis_visible) && (was_moved || was_resized || 
         flag(sys_always_resize)))
     {
       if (gap_list) get_parent()->display_gap(gap_list, this);
@@ -545,11 +550,11 @@ void base_window::update_estate()
   update_coords();
   update_family_vislist();
 
-  if (layout)
+  if (layout_manager* layout = get_layout())
   {
-    set_flag_cascade(grx_sensitive, false);
+    suppress_display();
     layout->pack_layout(); 
-    set_flag_cascade(grx_sensitive, true);
+    restore_display();
   } 
   
   display_all();
@@ -559,18 +564,77 @@ void base_window::update_estate()
 void base_window::update_family_vislist()
 {
   update_vislist(); 
-  LOOP_CHILDREN(loop) loop->update_family_vislist();
+
+  /* The families of top-level windows are big, and once the windows above them
+     are known they are independent of each other, so they're worth handing to
+     the work pool. Further down it isn't worth the bother, so the rest of the
+     family is walked in pre-order, on this thread, with no recursion. */
+  if (!parent && child && child->next)
+  {
+    std::vector<base_window*> families;
+    LOOP_CHILDREN(loop) families.push_back(loop);
+    update_family_vislists(families);
+  } else 
+  {
+    pre_order_iterator i(this);
+    for (++i; *i; ++i) i->update_vislist();
+  }
 }
 
 // Applies 'update_vislist' to this family and inferior windows (including parent)
 void base_window::update_vislist_behind()
 {
-  for (base_window* loop = this; loop; loop = loop->prev)
-    loop->update_family_vislist();
+  if (parent && !parent->parent && prev) // Top-level windows, see above
+  {
+    std::vector<base_window*> families;
+    for (base_window* loop = this; loop; loop = loop->prev) families.push_back(loop);
+    update_family_vislists(families);
+  } else 
+  {
+    for (base_window* loop = this; loop; loop = loop->prev)
+      loop->update_family_vislist();
+  }
     
   if (parent) parent->update_vislist();
 }
 
+// Work item that updates the vis-lists of a single family on the work pool.
+struct vislist_job : public work_item
+{
+  base_window* family;
+  void run() { family->update_family_vislist(); }
+};
+
+/* Calculating a vis-list only reads the positions and flags of the windows
+ * above it, and writes nothing but the window's own vis_list, so any number of
+ * families can be done at once. Since each job owns its windows' vis-lists
+ * outright, the result is exactly what doing them one after another would give.
+ * Zones are allocated from per-thread arenas, so the jobs don't fight over
+ * the heap either.
+ */
+void base_window::update_family_vislists(const std::vector<base_window*>& families)
+{
+  work_pool& pool = penguin_pool();
+  
+  if (!pool.workers()) // Nothing to be gained, so don't bother with the jobs
+  {
+    for (std::vector<base_window*>::size_type i = 0; i < families.size(); i++)
+      families[i]->update_family_vislist();
+    return;
+  }
+
+  std::vector<vislist_job> jobs(families.size());
+  work_batch batch;
+
+  for (std::vector<vislist_job>::size_type i = 0; i < jobs.size(); i++)
+  {
+    jobs[i].family = families[i];
+    pool.submit(batch, &jobs[i]);
+  }
+  
+  pool.wait(batch);
+}
+
 /* Recalculates the vis-list of a given window. Uses 'create_occludes_drawlist'
  * for this purpose, but also y-sorts the vis-zones to reduce flicker 
  */
@@ -626,7 +690,7 @@ void base_window::draw_arb_zones(zone*& arb_list, unsigned char arb_flags)
   bool matched = (arb_flags & DAZ_O_RECURSE) ? false : true; // Set to true if the arb-list touches us at all
 
   // If we are visible, loop through the vis-lists and check for overlaps
-  if (vis_list && visible() && flag(grx_sensitive) && master)
+  if (vis_list && visible() && sensitive() && master)
   {
     // The context we will be using to draw to the master
     graphics_context grx(master->get_buffer(), get_cx(), get_cy(), master->get_theme());   
@@ -684,7 +748,7 @@ void base_window::draw_arb_zones(zone*& arb_list, unsigned char arb_flags)
     }
   
     // Try to inform any sub-windows, if we touched the arb-list...
-    if (arb_flags & DAZ_F_SPYSUB && matched && flag(grx_sensitive))
+    if (arb_flags & DAZ_F_SPYSUB && matched && sensitive())
     {
       inform_sub(arb_list);
     }
@@ -766,11 +830,20 @@ void base_window::_display()
     }
   }
  
+  post_display();
+}
+
+/* Everything that has to happen after a window has been drawn, whichever way it
+ * was drawn: diagnostic information is drawn over it, and a display event is
+ * transmitted.
+ */
+void base_window::post_display()
+{
   display_count++;
  
   text_mode(-1);  
   if (debug & W_DEBUG_STEP_DISPLAY) readkey();
-  if (debug & W_DEBUG_DRAW_WIN_ID) textprintf(master->get_buffer(), font, cx+1,cy+1, makecol(255,255,0), "%d", int(win_id));
+  if (debug & W_DEBUG_DRAW_WIN_ID) textprintf(master->get_buffer(), font, cx+1,cy+1, makecol(255,255,0), "%u", win_id);
   if (debug & W_DEBUG_DRAW_Z_COUNT) textprintf_right(master->get_buffer(), font, dx-1, cy+1, makecol(255,255,255), "%d", get_z_count());
   if (debug & W_DEBUG_DRAW_D_COUNT) textprintf_right(master->get_buffer(), font, dx-1, cy+1, 0, "%d", display_count % 100);
  
@@ -784,7 +857,7 @@ void base_window::_display()
  */
 void base_window::display()
 {
-  if (visible() && flag(sys_active) && flag(grx_sensitive) && master)
+  if (visible() && flag(sys_active) && sensitive() && master)
   {
     inform_sub(&clipped()); // Draw to any subliminal windows we are under
 
@@ -795,18 +868,45 @@ void base_window::display()
   }
 }
 
-// Function that simply displays a family of trees by recursion.
+/* Displays a family of trees, each window after its children. This is a post-
+ * order walk, except that a master that can spread the drawing of its family
+ * over several threads does all of it at once, so isn't gone into. */
 void base_window::display_all()
 {  
-  LOOP_CHILDREN(loop) loop->display_all(); // Recurse to all our children  
-  display(); // And then display ourselves 
+  base_window* loop = this;
+
+  for (;;)
+  {
+    // Go down to the first window whose children (if any) are taken care of
+    for (;;)
+    {
+      if (loop->flag(grx_master))
+      {
+        window_master* qualified = dynamic_cast<window_master*>(loop);
+        if (qualified && qualified->display_tiled()) break;
+      }
+
+      if (!loop->child) { loop->display(); break; }
+      loop = loop->child;
+    }
+
+    // Then go across to the next sibling, displaying each parent on the way up
+    for (;;)
+    {
+      if (loop == this) return;
+      if (loop->next) { loop = loop->next; break; }
+
+      loop = loop->parent;
+      loop->display();
+    }
+  }
 }
 
-// Calls 'inform_sub' for every member of this family, through recursion
+// Calls 'inform_sub' for every member of this family
 void base_window::inform_sub_family(const zone* list)
 {
-  inform_sub(list); // Inform any superior sub-windows of changes       
-  LOOP_CHILDREN(loop) loop->inform_sub_family(list); // Recurse to our children
+  for (pre_order_iterator i(this); *i; ++i) 
+    i->inform_sub(list); // Inform any superior sub-windows of changes       
 }  
 
 /* Attempts to display this window to the sub-buffers of any hungry superior
@@ -842,19 +942,17 @@ void base_window::draw_to_sub(window_sub* sub, const zone* list, bool update)
   
   coord_int sub_cx = sub->get_cx(); // Store the sub-window's physical co-ords
   coord_int sub_cy = sub->get_cy(); // to reduce memory accesses
-  zone our_win = clipped(); // Zones representing our clipped co-ordinates,
-  zone sub_win = sub->clipped(); // and the sub_window's clipped co-ordinates
+  zone reach = clipped(); // The part of our clipped area that is over the sub
+  zone sub_win = sub->clipped(); 
+  if (reach.clip(&sub_win) == -1) return;
   
   zone* draw_list = 0; // Will store the list of zones to draw to the sub
   
   for (const zone* loop = list; loop; loop = loop->next) // Loop through the list
   { 
-    zone list_zone(*loop); // Make copy of the current zone in the list     
-    zone temp1(our_win); // Make a copy of the our clipped area    
-    
-    if (temp1.clip(&list_zone) != -1) // If our area overlaps the list's zone...
-      // If THAT overlap also intersects the subliminal window, add it to the drawlist
-      if (zone* temp2 = temp1.intersect(&sub_win)) push_front(draw_list, temp2);
+    // If the list's zone overlaps our reach, add the overlap to the draw-list
+    zone_intersection shared = reach.intersection(*loop);
+    if (shared.overlaps()) push_front(draw_list, new zone(shared.area));
   }
 
   // If we have a draw_list, occlude it up to the point of the subliminal window
@@ -894,66 +992,83 @@ void base_window::load()
   post_load_all();   // 'post' phase traversal of tree
 }
                                               
-// Helper function that executes the 1st unloading stage, calls hooks, recurses
+// Helper function that executes the 1st unloading stage and calls hooks, for
+// each window in the family, parents first
 void base_window::pre_unload_all()
 {
-  set_flag(sys_first_load, false); // Indicate the first 'life' is over
-  set_flag(sys_loaded, false); // Indicate we are no longer loaded
-  set_flag(sys_active, false); // Indicate we are no longer active 
-  pre_unload();            // Call the hook  
-  transmit(unload_ei());   // Broadcast an 'unload' event_info object
+  for (pre_order_iterator i(this); *i; ++i)
+  {
+    base_window* win = *i;
+
+    win->set_flag(sys_first_load, false); // Indicate the first 'life' is over
+    win->set_flag(sys_loaded, false); // Indicate it is no longer loaded
+    win->set_flag(sys_active, false); // Indicate it is no longer active 
+    win->pre_unload();            // Call the hook  
+    win->transmit(unload_ei());   // Broadcast an 'unload' event_info object
     
-  clear_receive_list();       // Untie any event_knots from/to us
-  delete_zonelist(vis_list); // Clear our vis-list (we won't need it anymore)
-  vis_list = 0;
-               
-  LOOP_CHILDREN(loop) loop->pre_unload_all(); // Recurse to our children
+    win->clear_receive_list();       // Untie any event_knots from/to it
+    delete_zonelist(win->vis_list); // Clear its vis-list (it won't be needed anymore)
+    win->vis_list = 0;
+  }
 }
 
 // Helper function that calls the 2nd hook
 void base_window::post_unload_all()
 {
-  post_unload(); // Call the hook
-  
-  LOOP_CHILDREN(loop) loop->post_unload_all(); // Recurse to our children
+  for (pre_order_iterator i(this); *i; ++i) i->post_unload(); // Call the hook
 }
 
-// Helper function that executes the 1st loading stage, calls hooks, recurses
+// Helper function that executes the 1st loading stage and calls hooks, for
+// each window in the family, parents first
 void base_window::pre_load_all()
 {
-  set_flag(sys_loading); // Set this now, and unset after we are fully loaded
+  for (pre_order_iterator i(this); *i; ++i)
+  {
+    base_window* win = *i;
+
+    win->set_flag(sys_loading); // Set this now, and unset after it is fully loaded
 
-  if (!w()) set_w(normal_size);
-  if (!h()) set_h(normal_size);
+    if (!win->w()) win->set_w(normal_size);
+    if (!win->h()) win->set_h(normal_size);
   
-  pre_load();            // Call the hook
+    win->pre_load();            // Call the hook
   
-  set_flag(sys_loaded);  // This flag indicates that we have been pre_loaded
-  update_coords();         
-  pack();                // Pack our children using our layout_manager, if any
-  position_children();   // Virtual func for derived windows to setup their children, if any
-  transmit(load_ei());   // Broadcast a 'load' event_info object
-
-  LOOP_CHILDREN(loop) loop->pre_load_all(); // Recurse to our children
+    win->set_flag(sys_loaded);  // This flag indicates that it has been pre_loaded
+    win->update_coords();         
+    win->pack_now();            // Pack its children using its layout_manager, if any
+    win->position_children();   // Virtual func for derived windows to setup their children, if any
+    win->transmit(load_ei());   // Broadcast a 'load' event_info object
+  }
 }
 
 // Helper function to perform the 2nd loading stage, basically just calls the hook
 void base_window::post_load_all()
 {
-  // Recurse to all our children first, to ensure that 'post_load()' can assume
-  // that all its children are active
-  LOOP_CHILDREN(loop) loop->post_load_all();
-  
-  set_flag(sys_active);         // Indicate we are fully loaded
+  // Children come first, to ensure that 'post_load()' can assume that all its
+  // children are active
+  for (post_order_iterator i(this); *i; ++i)
+  {
+    base_window* win = *i;
+
+    win->set_flag(sys_active);         // Indicate it is fully loaded
   
-  post_load();                  // Call the hook
+    win->post_load();                  // Call the hook
   
-  set_flag(sys_loading, false); // Indicate we are no longer loading 
-  update_vislist(); 
+    win->set_flag(sys_loading, false); // Indicate it is no longer loading 
+    win->update_vislist(); 
+  }
 }
 
-// Function to calculate the physical and clipped co-ordinates from the logicals
+// Function to calculate the physical and clipped co-ordinates from the logicals,
+// for us and ALL our children
 void base_window::update_coords()
+{
+  for (pre_order_iterator i(this); *i; ++i) i->calc_coords();
+}
+
+// Does the work of 'update_coords' for this window, whose parent's co-ordinates
+// must already be up to date
+void base_window::calc_coords()
 {
   cx = ax;
   cy = ay;
@@ -967,9 +1082,6 @@ void base_window::update_coords()
   dy = cy + h();
 
   clip_coords();
-
-  // Update co-ordinates of ALL our children
-  LOOP_CHILDREN(loop) loop->update_coords();
 }
 
 // Helper function to calculate the clipped co-ordaintes
@@ -1081,7 +1193,7 @@ void base_window::relative_move(coord_int x, coord_int y)
 void base_window::resize(coord_int width, coord_int height)
 {
   if (is_laid_out()) 
-    layinfo->resize((width==normal_size) ? normal_w() : width, (height==normal_size) ? normal_h() : height);
+    get_layinfo()->resize((width==normal_size) ? normal_w() : width, (height==normal_size) ? normal_h() : height);
   else 
     move_resize(ax, ay, ax + ((width==normal_size) ? normal_w() : width), ay + ((height==normal_size) ? normal_h() : height));
 }
@@ -1091,7 +1203,7 @@ void base_window::resize(coord_int width, coord_int height)
 void base_window::resize(coord_int x, coord_int y, coord_int width, coord_int height)
 {
   if (is_laid_out()) 
-    layinfo->resize((width==normal_size) ? normal_w() : width, (height==normal_size) ? normal_h() : height);
+    get_layinfo()->resize((width==normal_size) ? normal_w() : width, (height==normal_size) ? normal_h() : height);
   else 
     move_resize(x, y, x + ((width==normal_size) ? normal_w() : width), y + ((height==normal_size) ? normal_h() : height));
 }
@@ -1100,7 +1212,7 @@ void base_window::resize(coord_int x, coord_int y, coord_int width, coord_int he
 void base_window::set_w(coord_int width)
 {
   if (is_laid_out()) 
-    layinfo->resize((width==normal_size) ? normal_w() : width, layinfo->get_ideal_h());
+    get_layinfo()->resize((width==normal_size) ? normal_w() : width, get_layinfo()->get_ideal_h());
   else 
     move_resize(ax, ay, ax + ((width==normal_size) ? normal_w() : width), by);
 }
@@ -1109,7 +1221,7 @@ void base_window::set_w(coord_int width)
 void base_window::set_h(coord_int height)
 {
   if (is_laid_out()) 
-    layinfo->resize(layinfo->get_ideal_w(), (height==normal_size) ? normal_h() : height);    
+    get_layinfo()->resize(get_layinfo()->get_ideal_w(), (height==normal_size) ? normal_h() : height);    
   else 
     move_resize(ax, ay, bx, ay + ((height==normal_size) ? normal_h() : height));
 }
@@ -1129,7 +1241,7 @@ void base_window::place(coord_int _ax, coord_int _ay, coord_int _bx, coord_int _
  * doesn't use the special behaviour for 'normal_size' */                                                              
 void base_window::move(coord_int _ax, coord_int _ay, coord_int _bx, coord_int _by)
 {
-  if (is_laid_out()) layinfo->resize(_bx - _ax, _by - _ay);
+  if (is_laid_out()) get_layinfo()->resize(_bx - _ax, _by - _ay);
   else move_resize(_ax, _ay, _bx, _by);
 }
 
@@ -1253,7 +1365,7 @@ void base_window::add_child(base_window* new_child, layout_info* lm, bool front)
 
 bool base_window::is_laid_out()
 {
-  if (parent && parent->layout && layinfo) return true; else return false;
+  if (parent && parent->get_layout() && get_layinfo()) return true; else return false;
 }
 
 /* This function sets a new layout manager for the this window, deleting any 
@@ -1262,12 +1374,13 @@ bool base_window::is_laid_out()
  */ 
 void base_window::set_layout(layout_manager* l)
 {
-  delete layout; 
+  delete get_layout(); 
+  if (!l && !extras) return; // Nothing to clear, so don't allocate extras for it
   
-  if ((layout = l)) 
+  if ((extra().layout = l)) 
   {
-    layout->set_container(this);
-    if (flag(sys_loaded)) layout->pack_layout();
+    l->set_container(this);
+    if (flag(sys_loaded)) l->pack_layout();
   }
 }
 
@@ -1276,12 +1389,13 @@ void base_window::set_layout(layout_manager* l)
  */ 
 void base_window::set_layinfo(layout_info* l)
 {
-  delete layinfo;
+  delete get_layinfo();
+  if (!l && !extras) return;
 
-  if ((layinfo = l))
+  if ((extra().layinfo = l))
   {
     l->set_master(this);
-    parent->pack();
+    l->pack();
   }
 }
 
@@ -1291,20 +1405,17 @@ void base_window::set_layinfo(layout_info* l)
  */
 void base_window::set_flag_cascade(private_flags f, bool b)
 {
-  set_flag(f, b);
-  LOOP_CHILDREN(loop) loop->set_flag_cascade(f, b);
+  for (pre_order_iterator i(this); *i; ++i) i->flags.set(f, b);
 }
 
 void base_window::set_flag_cascade(protected_flags f, bool b)
 {
-  set_flag(f, b);
-  LOOP_CHILDREN(loop) loop->set_flag_cascade(f, b);
+  for (pre_order_iterator i(this); *i; ++i) i->flags.set(f, b);
 }
 
 void base_window::set_flag_cascade(public_flags f, bool b)
 {
-  set_flag(f, b);
-  LOOP_CHILDREN(loop) loop->set_flag_cascade(f, b);
+  for (pre_order_iterator i(this); *i; ++i) i->flags.set(f, b);
 }
 
 /* Helper function to set a particular window and its tree to use the supplied
@@ -1312,17 +1423,19 @@ void base_window::set_flag_cascade(public_flags f, bool b)
  */
 void base_window::set_master(window_master* n)
 {
-  master = n;
+  for (pre_order_iterator i(this); *i; ++i)
+  {
+    i->master = n;
   
-  // If WE are a master, our children should use us and not 'n'
-  if (!flag(grx_master)) LOOP_CHILDREN(loop) loop->set_master(n);
+    // A master's children should use it and not 'n'
+    if (i->flag(grx_master)) i.skip_children();
+  }
 }
 
 // Helper function to set the manager for all windows in this family
 void base_window::set_manager(window_manager* m)
 {
-  manager = m;
-  LOOP_CHILDREN(loop) loop->set_manager(m);
+  for (pre_order_iterator i(this); *i; ++i) i->manager = m;
 }
 
 // This function returns the first superior subliminal window from this window
@@ -1401,6 +1514,20 @@ const char* base_window::type_name() const
   if (*type) return type; else return 0;
 }
 
+/* The object itself is counted at the size of its class, as given by
+ * DEFINE_WINDOW_SIZE; derived classes that keep data out of line override this
+ * to add it on. */
+unsigned int base_window::footprint() const
+{
+  if (typeid(*this) != sized_type()) throw type_mismatch_exception(); // Missing its DEFINE_WINDOW_SIZE
+
+  unsigned int bytes = object_size() + knot_footprint();
+  if (extras) bytes += sizeof(window_extras);
+  for (zone* z = vis_list; z; z = z->next) bytes += sizeof(zone);
+
+  return bytes;
+}
+
 /* This function 'prints' the family of this window to the given std::ostream, which 
  * should usually be a std::string-stream handled by the console. It makes use of 
  * some custom symbols in order to make the ASCII tree more readable. It is 
@@ -1451,15 +1578,7 @@ void base_window::print(std::ostream& str)
  */
 int base_window::for_all(int(func)(base_window*))
 {
-  if (int temp = func(this)) return temp;
-  else
-  {
-    LOOP_CHILDREN(loop)
-    {
-      if (int temp = loop->for_all(func)) return temp;
-    }
-  }
-  return 0;
+  return visit(func);
 }
 
 // This function returns the number of windows 'high' we are in the sibling list.
@@ -1485,36 +1604,59 @@ bool window_intersect(base_window* a, base_window* b)
 }
 
 /* This function returns a pointer to the window which resides under the given
- * point. It checks all its children to determine if it should recurse to
- * to any of them. If not, it returns the result of 'pos_visible', which should
- * return true or false if that part of the window is 'solid'.
+ * point. It goes down into the front-most child the point lies within, and so
+ * on. Once it reaches a window none of whose children have the point, it 
+ * checks 'pos_visible', which should return true or false if that part of the
+ * window is 'solid'. If it isn't, the search carries on with the children
+ * behind the one it came from, and then the parent.
  */
 base_window* base_window::find_window_under(coord_int x, coord_int y)
 {
-  if (!visible()) return false;
+  if (!visible()) return 0;
 
-  // Loop backwards through all our children (if any)
-  for (base_window* loop = oldest_child(); loop; loop = loop->prev)
+  base_window* win = this;
+  base_window* loop = oldest_child();
+
+  for (;;)
   {
-    // If the point lies within that particular child...
-    if (x>loop->c_cx && x<loop->c_dx && y>loop->c_cy && y<loop->c_dy)
+    // Loop backwards through the children, looking for one with the point in it
+    while (loop && !(loop->visible() && x>loop->c_cx && x<loop->c_dx && y>loop->c_cy && y<loop->c_dy))
+      loop = loop->prev;
+
+    if (loop) // Go down into it
     {
-      // Recurse to it to find that point
-      if (base_window* result = loop->find_window_under(x, y)) return result;
+      win = loop;
+      loop = win->oldest_child();
+      continue;
     }
-  }
 
-  // If it did not touch any of our children, check if it touches us. 
-  return pos_visible(x, y) ? this : 0;
+    // If it did not touch any of its children, check if it touches the window
+    if (win->pos_visible(x, y)) return win;
+    if (win == this) return 0;
+
+    loop = win->prev;
+    win = win->parent;
+  }
 }
 
 
 /* This public function attempts to repack this window's children, if there is
- * a layout manager and the window is active
+ * a layout manager and the window is active. While the GUI is running, the pack
+ * is left to the window manager, which does it once at the end of the frame, so
+ * that changing several layout properties in a row only packs us once.
  */
 void base_window::pack()
 {
-  if (layout && flag(sys_loaded)) layout->pack_layout();
+  if (!get_layout() || !flag(sys_loaded)) return;
+  
+  if (manager && flag(sys_active)) manager->queue_pack(this);
+  else get_layout()->pack_layout();
+}
+
+// As 'pack', but the children are repacked before this returns
+void base_window::pack_now()
+{
+  if (get_layout() && flag(sys_loaded)) get_layout()->pack_layout();
 }
 
 // Ostream inserter. Simply lists this window's type followed by it's ID.
@@ -3,9 +3,11 @@
 
 #include <bitset>     // For flags
 #include <iostream>
+#include <vector>
 
 #include "pdefs.h"    // General definitions
 #include "pevent.h"   // Base_window inherits from event_participant
+#include "pregistry.h" // Window ids
 #include "puser.h"    // Kb_event class and key constants
 
 #define DAZ_R_CHILDREN 1                              
@@ -44,6 +46,9 @@ class debug_info;
 class layout_manager;
 class layout_info;
 class graphics_context;
+class pre_order_iterator;
+class post_order_iterator;
+class reverse_order_iterator;
 
 /* This is class upon which all more specialised windows are to be built, ie, buttons,
    frames, boxes, images, check-boxes, lists, text-boxes, subliminal windows, etc.
@@ -55,17 +60,36 @@ class graphics_context;
    functions that would be tedious and dangerous to rewrite in each derived class.
 */
 
+/* The parts of a window that are seldom looked at: its layout objects, and the
+   mouse state kept for its event handlers. Most windows never have a layout and
+   are never under the mouse, so a window only allocates these the first time it
+   needs one of them, and until then reads them as 0 (or -1, for positions). */
+
+struct window_extras
+{
+  layout_manager* layout;
+  layout_info* layinfo;
+
+  // Variables to-do with user-event handling
+  coord_int click_x;
+  coord_int click_y;
+  coord_int mouse_x;
+  coord_int mouse_y;
+  bt_int button_state;
+
+  window_extras()
+  : layout(0), layinfo(0), click_x(-1), click_y(-1), mouse_x(-1), mouse_y(-1), button_state(0)
+  { }
+};
+
+/* Goes at the top of the body of every window class, naming the class, so that
+ * footprint reports count each window at the size of its own class. A class
+ * without one would be counted at the size of the nearest base class that has
+ * one, so 'footprint' throws a type_mismatch_exception instead. */
+#define DEFINE_WINDOW_SIZE(our) unsigned int object_size() const { return sizeof(our); } const std::type_info& sized_type() const { return typeid(our); }
+
 class base_window : public event_participant
 {
-  private:
- 
-    // Variables to-do with user-event handling
-    coord_int click_x;
-    coord_int click_y;
-    coord_int mouse_x;
-    coord_int mouse_y;         
-    bt_int button_state;
-         
   protected: 
   
     // Virtual callbacks for user-event handling
@@ -86,11 +110,11 @@ class base_window : public event_participant
   public: 
 
     // Public access functions for user-event handling.
-    coord_int get_mouse_x() const { return mouse_x; }
-    coord_int get_mouse_y() const { return mouse_y; }
-    coord_int get_click_x() const { return click_x; }
-    coord_int get_click_y() const { return click_y; }
-    bt_int get_button_state() const { return button_state; }
+    coord_int get_mouse_x() const { return extras ? extras->mouse_x : -1; }
+    coord_int get_mouse_y() const { return extras ? extras->mouse_y : -1; }
+    coord_int get_click_x() const { return extras ? extras->click_x : -1; }
+    coord_int get_click_y() const { return extras ? extras->click_y : -1; }
+    bt_int get_button_state() const { return extras ? extras->button_state : 0; }
 
     void set_cursor(cursor_name cur);
     void set_keyfocus();
@@ -124,6 +148,7 @@ class base_window : public event_participant
       grx_object_display,
       grx_master,
       grx_subliminal,
+      grx_thread_safe, // 'draw' depends only on our state, and may be run on any thread
       evt_snoop_keys,
       evt_snoop_clicks,
       _last_protected_flag // Remember index of last flag in protected_flags
@@ -147,24 +172,20 @@ class base_window : public event_participant
 
   private:
 
+    /* The members are in the order the tree walks read them: update_coords(),
+       find_window_under() and the occlusion code only need the tree links, the
+       co-ordinates and the flags, which come first and share the object's first
+       cache lines. The rest of what a window used to carry - layout objects,
+       mouse state and the event lists - is kept out of line until it is needed,
+       see 'window_extras' and 'knot_lists'. The 'size' console command reports
+       what all this comes to for the windows that exist. */
+
     base_window* next;        // Point to our immediately superior sibling
     base_window* prev;        // Point to our immediately inferior sibling
     base_window* parent;      // Point to our containing parent
     base_window* child;       // Point to our first contained window
-    window_sub* next_sub;     // Points to the next subliminal window in our sub_chain.
-    window_master* master;    // Points to the buffered window that contains us (if any)
-    window_manager* manager;
-    layout_manager* layout;
-    layout_info* layinfo;
     zone* vis_list; // LL of zones rep. screen portions to be drawn to on a full display.
-    
-    // Size: 40 bytes
  
-    coord_int ax; // Logical co-ordinates: relative to parent, don't need to be updated
-    coord_int ay; // during a move...
-    coord_int bx;
-    coord_int by;
-  
     coord_int cx; // Physical co-ordinates: relative to screen, are updated by
     coord_int cy; // update_coords() on movement and resizing.
     coord_int dx;
@@ -174,13 +195,39 @@ class base_window : public event_participant
     coord_int c_cy; // not extend beyond the limits of our parent. If we are completely
     coord_int c_dx; // off-bounds, these will all be set to -1.
     coord_int c_dy;
+
+    coord_int ax; // Logical co-ordinates: relative to parent, don't need to be updated
+    coord_int ay; // during a move...
+    coord_int bx;
+    coord_int by;
     
     std::bitset<_last_public_flag> flags; // The actual bitset, using _last_public_flag to find total no of flags
+
+    window_id win_id;             // Our handle in the window registry. These three fit
+    unsigned short display_count; // in the padding after 'flags'
+    unsigned short suppressed;    // Calls to 'suppress_display' not yet restored
+    static int suppressing;       // The number of windows with 'suppressed' set
+
+    // Colder pointers, needed when drawing or when something changes
+    window_sub* next_sub;     // Points to the next subliminal window in our sub_chain.
+    window_master* master;    // Points to the buffered window that contains us (if any)
+    window_manager* manager;
+    window_extras* extras;    // Layout and mouse state, or 0 if we have never needed any
+
+    window_extras& extra() { if (!extras) extras = new window_extras; return *extras; }
     
     // Only private members can set protected flags
     void set_flag(private_flags f, bool b=true) { flags.set(f, b); }	 
     void set_flag_cascade(private_flags f, bool b =true);
 
+    /* Stops this family from being displayed until the matching 'restore_display',
+       as when its children are being re-arranged and would otherwise be drawn
+       once in passing. Rather than clearing 'grx_sensitive' down the family, it
+       just counts the call against us, and 'sensitive' looks up the ancestry for
+       a count. These nest, and are O(1). */
+    void suppress_display() { if (!suppressed++) suppressing++; }
+    void restore_display() { if (!--suppressed) suppressing--; }
+
     void set_master(window_master* n);
     void set_manager(window_manager* m);
     void set_next_sub_behind(window_sub* _sub);
@@ -189,12 +236,13 @@ class base_window : public event_participant
     void hide_helper(); // Helpers used by hide() and show() - they save and
     void show_helper(); // restore the visibility flags
 
-    unsigned short win_id; // Used for debugging purposes
-    static int new_id;     // Used to generate a new id for each window
-      
     // Updates vis_zones of all windows behind this window in the sibling list.
     void update_vislist_behind(); 
     void update_family_vislist();
+    
+    // Updates the vis-lists of each of the given families. A family's vis-lists
+    // don't depend on any other's, so this spreads them over the work pool.
+    static void update_family_vislists(const std::vector<base_window*>& families);
                           
     void extract(); // Lowlevel function to remove the window from the tree
               
@@ -203,6 +251,7 @@ class base_window : public event_participant
     
     // Displays all zones in the vis_list to surface. Does not handle sub-spying.
     void _display();
+    void post_display(); // Book-keeping that follows a display: debugging info, event
  
     void load(); // Loading-related functinos:
     void unload();
@@ -247,6 +296,7 @@ class base_window : public event_participant
     // Make sure all co-ordinates are valid (only really useful for derived classes)
     void clip_coords();
     void update_coords();
+    void calc_coords(); // As 'update_coords', but for this window alone
   
     // Hooks, helpers, and such
     virtual void pre_load() { }
@@ -317,7 +367,10 @@ class base_window : public event_participant
     bool disabled(); // Returns TRUE if this window is forbidden to receive user events
  
     int get_z_count() const; // Returns position of this window in the sibling list
-    int get_win_id() const { return win_id; } 
+    window_id get_win_id() const { return win_id; } 
+
+    // Returns the window with the given id, or 0 if it no longer exists
+    static base_window* from_id(window_id id) { return window_registry::global().lookup(id); }
 
     // Tree traversal functions. Should give these a good grilling, to make sure
     // they deal with masters sensibly
@@ -344,12 +397,13 @@ class base_window : public event_participant
     base_window();
       
     void set_layout(layout_manager* l); // Delete old, bind new layout manager to us
-    layout_manager* get_layout() const { return layout; } // Return pointer to our layout manager 
-    layout_info* get_layinfo() const { return layinfo; } // Returns pointer to our layout-info object
-    layout_info& lay_info() const { return *layinfo; }
-    layout_manager& lay_man() const { return *layout; }
+    layout_manager* get_layout() const { return extras ? extras->layout : 0; } // Return pointer to our layout manager 
+    layout_info* get_layinfo() const { return extras ? extras->layinfo : 0; } // Returns pointer to our layout-info object
+    layout_info& lay_info() const { return *get_layinfo(); }
+    layout_manager& lay_man() const { return *get_layout(); }
     void set_layinfo(layout_info* li); // Deletes the old and attaches a new layout-info object to us
-    void pack(); // Attempts to repack our parents, if all is good and well, and necessary
+    void pack(); // Queues our children to be repacked at the end of the frame, if necessary
+    void pack_now(); // Repacks our children at once, rather than waiting for the frame to end
     bool is_laid_out(); // Returns true if our siblings are being layout-managed, and we have a layinfo object
   
     /* These marvelous functions provide a way for a class to specify exactly where its
@@ -399,7 +453,7 @@ class base_window : public event_participant
        their own internal screen co-ordinates and width and height values, as well as
        redisplaying themselves, and "filling the gap" made by any movement taking place.
     */
-    static const coord_int normal_size = -32768;
+    static const coord_int normal_size = coord_int_min;
     
     void move(coord_int _ax, coord_int _ay);
     void relative_move(coord_int x, coord_int y);
@@ -420,9 +474,17 @@ class base_window : public event_participant
     void print(std::ostream& str = std::cerr);
   
     // Special callback that is applied to every window in this tree. If the callback
-    // at any point returns a non-zero integer, the recursion will stop and the value
+    // at any point returns a non-zero integer, the walk will stop and the value
     // will be returned by this function.
     int for_all(int(func)(base_window*));
+
+    // As 'for_all', but for any function or function object taking a window,
+    // which the compiler can then inline. 'visit' calls it for each window before
+    // its children, 'visit_post' after them, and 'visit_reverse' goes from the
+    // front of the family to the back. See the iterators below.
+    template <class F> int visit(F& f);
+    template <class F> int visit_post(F& f);
+    template <class F> int visit_reverse(F& f);
    
     // Returns the various tree-pointers of this window. 
     window_master* get_master() { return master; }
@@ -434,13 +496,25 @@ class base_window : public event_participant
     window_sub* get_next_external_sub();
     window_manager* get_manager() { return manager; } 
         
-    base_window* find(int _id);
+    base_window* find(window_id _id); // Returns the window with this id, if it's in our family
   
     // Returns true if the given window lies in our family.
     bool ancestor_of(base_window* orphan) const;
     
     // Returns true if we might be visible.
     bool visible() { return !flag(vis_complete_clip) && flag(vis_visible); }
+
+    // Returns true if we may be drawn, which we may not while any window in our
+    // ancestry has its display suppressed. Usually none have, so that is cheap.
+    bool sensitive() const
+    {
+      if (!flag(grx_sensitive)) return false;
+      if (!suppressing) return true;
+
+      for (const base_window* loop = this; loop; loop = loop->parent)
+        if (loop->suppressed) return false;
+      return true;
+    }
           
     void delegate_displays();   // Begins display delegation, if appropriate
     void undelegate_displays(); // Ends display delegation
@@ -452,8 +526,12 @@ class base_window : public event_participant
     // Returns the type-name of this window. Uses RTTI, but fixes some dodgy numbers
     // that seem to happen in the DJGPP version of RTTI.
     const char* type_name() const;                                                        
-  
-    unsigned short display_count;
+
+    // Returns the bytes this window takes up: the object itself and everything
+    // it keeps out of line. Widgets with data of their own should add it on.
+    virtual unsigned int footprint() const;
+    virtual unsigned int object_size() const { return sizeof(base_window); } // See DEFINE_WINDOW_SIZE
+    virtual const std::type_info& sized_type() const { return typeid(base_window); }
   
     // Overrides event_participant stub
     base_window& window() { return *this; }
@@ -466,8 +544,134 @@ class base_window : public event_participant
     friend class layout_info;
     friend class window_sub;
     friend class drag_helper;    
+    friend struct vislist_job;
+    friend struct window_tile_job;
+    friend class pre_order_iterator;
+    friend class post_order_iterator;
+    friend class reverse_order_iterator;
+};
+
+/* Iterators over a window and its family, that follow the tree links instead
+   of recursing, so deep trees don't use up the stack. Each stops at the window
+   it was started from, rather than going on to its siblings, and yields 0 once
+   it is done:
+
+     for (pre_order_iterator i(win); *i; ++i) i->...
+
+   'pre_order_iterator' visits each window before its children, back to front,
+   which is the order the family is drawn and loaded in. 'post_order_iterator'
+   visits each window after its children. 'reverse_order_iterator' is pre-order
+   from front to back, the order in which windows are hit by the mouse.
+
+   The pre-order iterators can be told not to go into the children of the
+   current window, with 'skip_children'. The window an iterator is on may
+   have children added while it is there, but nothing around it should change
+   until it has moved on. */
+
+class pre_order_iterator
+{
+  private:
+
+    base_window* root;
+    base_window* cur;
+    bool skip;
+
+  public:
+
+    pre_order_iterator(base_window* r) : root(r), cur(r), skip(false) { }
+
+    base_window* operator*() const { return cur; }
+    base_window* operator->() const { return cur; }
+
+    void skip_children() { skip = true; }
+
+    pre_order_iterator& operator++()
+    {
+      if (cur->child && !skip) { cur = cur->child; return *this; }
+      skip = false;
+
+      for (; cur != root; cur = cur->parent)
+        if (cur->next) { cur = cur->next; return *this; }
+
+      cur = 0;
+      return *this;
+    }
+};
+
+class post_order_iterator
+{
+  private:
+
+    base_window* root;
+    base_window* cur;
+
+    void descend() { while (cur->child) cur = cur->child; }
+
+  public:
+
+    post_order_iterator(base_window* r) : root(r), cur(r) { descend(); }
+
+    base_window* operator*() const { return cur; }
+    base_window* operator->() const { return cur; }
+
+    post_order_iterator& operator++()
+    {
+      if (cur == root) cur = 0;
+      else if (cur->next) { cur = cur->next; descend(); }
+      else cur = cur->parent;
+
+      return *this;
+    }
 };
 
+class reverse_order_iterator
+{
+  private:
+
+    base_window* root;
+    base_window* cur;
+    bool skip;
+
+  public:
+
+    reverse_order_iterator(base_window* r) : root(r), cur(r), skip(false) { }
+
+    base_window* operator*() const { return cur; }
+    base_window* operator->() const { return cur; }
+
+    void skip_children() { skip = true; }
+
+    reverse_order_iterator& operator++()
+    {
+      if (cur->child && !skip) { cur = cur->oldest_child(); return *this; }
+      skip = false;
+
+      for (; cur != root; cur = cur->parent)
+        if (cur->prev) { cur = cur->prev; return *this; }
+
+      cur = 0;
+      return *this;
+    }
+};
+
+template <class F> int base_window::visit(F& f)
+{
+  for (pre_order_iterator i(this); *i; ++i) if (int r = f(*i)) return r;
+  return 0;
+}
+
+template <class F> int base_window::visit_post(F& f)
+{
+  for (post_order_iterator i(this); *i; ++i) if (int r = f(*i)) return r;
+  return 0;
+}
+
+template <class F> int base_window::visit_reverse(F& f)
+{
+  for (reverse_order_iterator i(this); *i; ++i) if (int r = f(*i)) return r;
+  return 0;
+}
+
 // Event-info type definitions:
 
 struct system_ei : public event_info
@@ -0,0 +1,188 @@
+#include "pcells.h"
+#include "pgrx.h"
+#include "allegro.h"
+
+/* Only the cells that reach into the clipping rectangle are drawn, which when
+ * a single cell is being redisplayed means just that one. */
+void window_cells::draw(const graphics_context& grx)
+{
+  grx.rectfill(0,0,w(),h(),theme().frame);
+
+  BITMAP* bmp = grx;
+  coord_int cl = bmp->cl - grx.get_ox(), ct = bmp->ct - grx.get_oy();
+  coord_int cr = bmp->cr - grx.get_ox(), cb = bmp->cb - grx.get_oy();
+
+  for (std::vector<cell_rect>::size_type i = 0; i < rects.size(); i++)
+  {
+    const cell_rect& r = rects[i];
+    if (r.bx < cl || r.ax >= cr || r.by < ct || r.ay >= cb) continue; // Cells are inclusive, but cr and cb are not
+
+    bool in = states[i] & (cell_pressed | cell_checked);
+
+    if (states[i] & cell_disabled) grx.set_mode_dither();
+    grx.draw_frame(r.ax, r.ay, r.bx, r.by, in ? ft_button_in : ft_button_out);
+    grx.render_line(c_centre, labels[i].c_str(), zone(r.ax+2, r.ay+2, r.bx-2, r.by-2),
+                    theme().text, in ? theme().frame_high : theme().frame, -1, in ? 1 : 0, in ? 1 : 0);
+    if (states[i] & cell_disabled) grx.set_mode_normal();
+  }
+}
+
+int window_cells::add_cell(const zone& area, const std::string& label, unsigned char state)
+{
+  cell_rect r = { area.ax, area.ay, area.bx, area.by };
+
+  rects.push_back(r);
+  states.push_back(state);
+  labels.push_back(label);
+
+  display_cell(rects.size() - 1);
+  return rects.size() - 1;
+}
+
+int window_cells::add_grid(int cols, int rows, coord_int cell_w, coord_int cell_h, coord_int gap)
+{
+  int first = rects.size();
+
+  rects.reserve(first + cols * rows);
+  states.resize(first + cols * rows, cell_normal);
+  labels.resize(first + cols * rows);
+
+  for (int y = 0; y < rows; y++)
+  {
+    for (int x = 0; x < cols; x++)
+    {
+      cell_rect r;
+      r.ax = gap + x * (cell_w + gap);
+      r.ay = gap + y * (cell_h + gap);
+      r.bx = r.ax + cell_w;
+      r.by = r.ay + cell_h;
+      rects.push_back(r);
+    }
+  }
+
+  display();
+  return first;
+}
+
+void window_cells::clear_cells()
+{
+  rects.clear();
+  states.clear();
+  labels.clear();
+  pressed_cell = hot_cell = -1;
+
+  display();
+}
+
+// Later cells are drawn over earlier ones, so the search goes backwards
+int window_cells::cell_at(coord_int x, coord_int y) const
+{
+  for (int i = rects.size() - 1; i >= 0; i--)
+  {
+    const cell_rect& r = rects[i];
+    if (x >= r.ax && x <= r.bx && y >= r.ay && y <= r.by) return i;
+  }
+
+  return -1;
+}
+
+void window_cells::set_area(int i, const zone& area)
+{
+  cell_rect old = rects[i];
+
+  rects[i].ax = area.ax;
+  rects[i].ay = area.ay;
+  rects[i].bx = area.bx;
+  rects[i].by = area.by;
+
+  display_area(old); // Fill in where it was
+  display_cell(i);
+}
+
+void window_cells::set_label(int i, const std::string& s)
+{
+  labels[i] = s;
+  display_cell(i);
+}
+
+void window_cells::change_state(int i, unsigned char set, unsigned char clear)
+{
+  unsigned char s = (states[i] & ~clear) | set;
+  if (s == states[i]) return;
+
+  bool redraw = (s ^ states[i]) & ~cell_hot; // Being hot doesn't change how we look
+  states[i] = s;
+  if (redraw) display_cell(i);
+}
+
+unsigned int window_cells::footprint() const
+{
+  unsigned int bytes = base_widget::footprint();
+
+  bytes += rects.capacity() * sizeof(cell_rect) + states.capacity();
+  for (std::vector<std::string>::size_type i = 0; i < labels.size(); i++)
+    bytes += labels[i].capacity();
+
+  return bytes + labels.capacity() * sizeof(std::string);
+}
+
+void window_cells::display_cell(int i)
+{
+  display_area(rects[i]);
+}
+
+/* Draws that area of us through 'draw_arb_zones', so that only the vis-zones
+ * it touches are drawn, and any subliminal windows above us are told of the
+ * change. */
+void window_cells::display_area(const cell_rect& r)
+{
+  if (!visible() || !flag(sys_active)) return;
+
+  zone* area = new zone(get_cx() + r.ax, get_cy() + r.ay, get_cx() + r.bx, get_cy() + r.by);
+
+  draw_arb_zones(area, DAZ_F_SPYSUB);
+  delete_zonelist(area);
+}
+
+void window_cells::event_mouse_down(bt_int button)
+{
+  set_keyfocus();
+
+  int i = cell_at(get_mouse_x(), get_mouse_y());
+  if (!(button & bt_left) || i == -1 || (states[i] & cell_disabled)) return;
+
+  pressed_cell = i;
+  change_state(i, cell_pressed, 0);
+}
+
+void window_cells::event_mouse_up(bt_int button)
+{
+  if (!(button & bt_left) || pressed_cell == -1) return;
+
+  int i = pressed_cell;
+  pressed_cell = -1;
+  change_state(i, 0, cell_pressed);
+
+  if (cell_at(get_mouse_x(), get_mouse_y()) == i) transmit(cell_activate_ei(i));
+}
+
+void window_cells::event_mouse_move(coord_int x, coord_int y)
+{
+  int i = cell_at(get_mouse_x(), get_mouse_y());
+  if (i == hot_cell) return;
+
+  if (hot_cell != -1) change_state(hot_cell, 0, cell_hot);
+  if (i != -1) change_state(i, cell_hot, 0);
+  hot_cell = i;
+
+  transmit(cell_hover_ei(i));
+}
+
+void window_cells::event_mouse_off()
+{
+  if (pressed_cell != -1) change_state(pressed_cell, 0, cell_pressed);
+  if (hot_cell != -1) change_state(hot_cell, 0, cell_hot);
+
+  if (hot_cell != -1) transmit(cell_hover_ei(-1));
+  pressed_cell = hot_cell = -1;
+}
@@ -0,0 +1,112 @@
+#ifndef PCELLS_H
+#define PCELLS_H
+
+#include "pwidgets.h"
+#include <vector>
+#include <string>
+
+/* Every widget is a full window, with its tree pointers, vis-list, flags and
+ * event lists, which is a lot to pay for each square of a large board of
+ * buttons. A window_cells is a single window that hosts any number of 'cells'
+ * instead: button-like items that are nothing more than a rectangle, a state
+ * and a label, kept in arrays. The host does their hit-testing and drawing
+ * itself, and tells its listeners about them with the events below, which
+ * carry the index of the cell concerned.
+ *
+ * To the rest of Penguin, and in particular to the vis-list calculations, the
+ * whole board is then just the one window.
+ */
+enum cell_state // Can be or-ed together
+{
+  cell_normal = 0,
+  cell_pressed = 1,  // Drawn pushed in, set while the mouse holds it down
+  cell_checked = 2,  // Drawn pushed in, for the host's users to set as they like
+  cell_disabled = 4, // Ignores the mouse, and is drawn dithered
+  cell_hot = 8       // The mouse is over it
+};
+
+class window_cells : public base_widget
+{
+  DEFINE_WINDOW_SIZE(window_cells)
+  private:
+
+    void draw(const graphics_context& grx);
+
+  protected:
+
+    struct cell_rect
+    {
+      coord_int ax, ay, bx, by;
+    };
+
+    std::vector<cell_rect> rects;       // Where each cell lies on our surface
+    std::vector<unsigned char> states;  // Each cell's cell_state bits
+    std::vector<std::string> labels;    // The text drawn on each cell
+
+    int pressed_cell; // The cell the mouse went down on, or -1
+    int hot_cell;     // The cell under the mouse, or -1
+
+    void event_mouse_down(bt_int button);
+    void event_mouse_up(bt_int button);
+    void event_mouse_move(coord_int x, coord_int y);
+    void event_mouse_off();
+
+    void change_state(int i, unsigned char set, unsigned char clear);
+    void display_area(const cell_rect& r);
+
+  public:
+
+    // Adds a cell, returning its index
+    int add_cell(const zone& area, const std::string& label ="", unsigned char state =cell_normal);
+
+    // Adds a block of (cols) by (rows) cells of the given size, separated by
+    // (gap), in rows from the top left; returns the index of the first
+    int add_grid(int cols, int rows, coord_int cell_w, coord_int cell_h, coord_int gap =0);
+
+    void clear_cells();
+    int size() const { return rects.size(); }
+
+    // Returns the index of the cell at the given point on our surface, or -1
+    int cell_at(coord_int x, coord_int y) const;
+
+    zone get_area(int i) const { return zone(rects[i].ax, rects[i].ay, rects[i].bx, rects[i].by); }
+    const std::string& get_label(int i) const { return labels[i]; }
+    unsigned char get_state(int i) const { return states[i]; }
+
+    void set_area(int i, const zone& area);
+    void set_label(int i, const std::string& s);
+    void set_state(int i, unsigned char s) { change_state(i, s, 0xFF); }
+
+    void display_cell(int i); // Redraws just the one cell
+
+    unsigned int footprint() const;
+
+    window_cells()
+    : base_widget(true), pressed_cell(-1), hot_cell(-1)
+    { }
+};
+
+struct cell_ei : public input_ei
+{ DEFINE_EI(cell_ei, input_ei)
+
+  const int index; // The cell concerned, or -1 for none
+
+  cell_ei(int i) : index(i)
+  { }
+};
+
+struct cell_activate_ei : public cell_ei // A cell was clicked
+{ DEFINE_EI(cell_activate_ei, cell_ei)
+
+  cell_activate_ei(int i) : cell_ei(i)
+  { }
+};
+
+struct cell_hover_ei : public cell_ei // The mouse has moved onto another cell
+{ DEFINE_EI(cell_hover_ei, cell_ei)
+
+  cell_hover_ei(int i) : cell_ei(i)
+  { }
+};
+
+#endif
@@ -7,6 +7,7 @@
 #include "pbasewin.h"
 #include "psublim.h"
 #include "pwidgets.h"
+#include "pzarray.h"
 
 #include <typeinfo>
 #include <iostream.h>
@@ -15,6 +16,8 @@
 #include <string.h>
 #include <strstream>
 #include <math.h>
+#include <map>
+#include <string>
 
 #define com_is(s) (!strcmp(console_line, s))
 #define com_arg(s) temp = strlen(s), (!strncmp(console_line, s, temp) && console_line[temp])
@@ -56,6 +59,7 @@ bool console_command();
 
 int draw_to_next_sub(base_window* win);
 int recalc_viszones(base_window* win);
+zone random_zone(int limit);
 
 void console_init()
 {
@@ -349,8 +353,36 @@ bool console_command()
 
   } else if (com_is("count"))
   {
-    con_out("Zone count      - %d", zone::count);
+    zone_stats stats = zone_stats::total();
+    con_out("Zone count      - %d", stats.count);
+    con_out("Intersections   - %d (%d overlapped)", stats.intersects, stats.overlaps);
     con_out("Win count       - %d", base_window::count);
+    con_out("Win ids         - %d in use, %d slots", window_registry::global().size(), window_registry::global().capacity());
+
+  } else if (com_is("size"))
+  {
+    // Footprint of every window in the tree, gathered by type
+    std::map<std::string, std::pair<int, unsigned int> > types;
+    unsigned int total = 0;
+    int windows = 0;
+
+    for (base_window* loop = console_man; loop; loop = loop->superior())
+    {
+      std::pair<int, unsigned int>& t = types[loop->type_name()];
+      unsigned int bytes = loop->footprint();
+
+      t.first++;
+      t.second += bytes;
+      total += bytes;
+      windows++;
+    }
+
+    con_out("base_window %d bytes, extras %d, knot lists %d", int(sizeof(base_window)),
+            int(sizeof(window_extras)), int(sizeof(knot_lists)));
+    for (std::map<std::string, std::pair<int, unsigned int> >::iterator i = types.begin(); i != types.end(); i++)
+      con_out("%-20s x%-4d %7d bytes (%d each)", i->first.c_str(), i->second.first,
+              int(i->second.second), int(i->second.second / i->second.first));
+    con_out("Total - %d bytes in %d windows", int(total), windows);
   } else if (com_arg("display "))
   {
     int num;
@@ -453,11 +485,11 @@ bool console_command()
       {
         if (base_widget* widget = dynamic_cast<base_widget*>(loop))
         {
-          con_out("%s(%d) [%d, %d][%d, %d]: \"%s\", %d", loop->type_name(), loop->win_id, 
+          con_out("%s(%u) [%d, %d][%d, %d]: \"%s\", %d", loop->type_name(), loop->win_id, 
           loop->get_cx(), loop->get_cy(), loop->w(), loop->h(), widget->get_text().c_str(), widget->get_value());
         } else 
         {
-          con_out("%s(%d) [%d, %d][%d, %d]", loop->type_name(), loop->win_id, 
+          con_out("%s(%u) [%d, %d][%d, %d]", loop->type_name(), loop->win_id, 
           loop->get_cx(), loop->get_cy(), loop->w(), loop->h());
         }
       }
@@ -726,13 +758,13 @@ bool console_command()
       if (win->flag(base_window::vis_complete_clip)) con_out("<complete_clip>");
       if (!win->flag(base_window::vis_visible)) con_out("<invisible>");
 
-      if (win->get_parent())     con_out("parent   - %d", win->get_parent()->get_win_id());
-      if (win->get_child())      con_out("child    - %d", win->get_child()->get_win_id());
-      if (win->get_next())       con_out("next     - %d", win->get_next()->get_win_id());
-      if (win->get_prev())       con_out("prev     - %d", win->get_prev()->get_win_id());
-      if (win->get_next_sub())   con_out("sub      - %d", win->get_next_sub()->get_win_id());
-      if (win->get_manager())    con_out("manager  - %d", win->get_manager()->get_win_id());
-      if (win->get_master())     con_out("master   - %d", win->get_master()->get_win_id());
+      if (win->get_parent())     con_out("parent   - %u", win->get_parent()->get_win_id());
+      if (win->get_child())      con_out("child    - %u", win->get_child()->get_win_id());
+      if (win->get_next())       con_out("next     - %u", win->get_next()->get_win_id());
+      if (win->get_prev())       con_out("prev     - %u", win->get_prev()->get_win_id());
+      if (win->get_next_sub())   con_out("sub      - %u", win->get_next_sub()->get_win_id());
+      if (win->get_manager())    con_out("manager  - %u", win->get_manager()->get_win_id());
+      if (win->get_master())     con_out("master   - %u", win->get_master()->get_win_id());
       if (win->get_master()->get_buffer())        con_out("surface  - %p", win->get_master()->get_buffer());
       next_console_line();
       
@@ -802,6 +834,75 @@ bool console_command()
         remove_int(five_sec_handler);
 
         con_out("Zones occluded per second: %d", count);
+        
+      } else if (is_arg("-batch"))
+      {
+        // Compares the zone_array kernels with the linked-list functions, on
+        // the same random set of zones and masks
+        const int zones = 64, masks = 16;
+        
+        zone* list = 0;
+        zone* mask_list = 0;
+        for (int i = 0; i < zones; i++) push_front(list, new zone(random_zone(1023)));
+        for (int i = 0; i < masks; i++) push_front(mask_list, new zone(random_zone(1023)));
+        
+        zone_array array(list);
+        unsigned char hits[zones] = { 0 };
+        
+        con_out("Using %s kernels and %d-bit co-ordinates, %d zones against %d masks",
+                zone_kernel_name(), int(sizeof(coord_int) * 8), zones, masks);
+
+        int count = 0;
+        five_sec_tick = 0;
+        install_int(five_sec_handler, 1000);
+        while (!five_sec_tick)
+        {
+          for (const zone* m = mask_list; m; m = m->next)
+            for (const zone* z = list; z; z = z->next) 
+              if (m->check_intersect(z) != -1) hits[0]++;
+          count++;
+        }
+        remove_int(five_sec_handler);
+        con_out("List overlap tests per second: %d", count * zones * masks);
+        
+        count = 0;
+        five_sec_tick = 0;
+        install_int(five_sec_handler, 1000);
+        while (!five_sec_tick)
+        {
+          for (const zone* m = mask_list; m; m = m->next) array.overlapping(*m, hits);
+          count++;
+        }
+        remove_int(five_sec_handler);
+        con_out("Array overlap tests per second: %d", count * zones * masks);
+        
+        count = 0;
+        five_sec_tick = 0;
+        install_int(five_sec_handler, 1000);
+        while (!five_sec_tick)
+        {
+          zone* copy = list->duplicate();
+          occlude(copy, mask_list);
+          delete_zonelist(copy);
+          count++;
+        }
+        remove_int(five_sec_handler);
+        con_out("List occlusions per second: %d", count);
+        
+        count = 0;
+        five_sec_tick = 0;
+        install_int(five_sec_handler, 1000);
+        while (!five_sec_tick)
+        {
+          zone_array copy(array);
+          copy.occlude(mask_list);
+          count++;
+        }
+        remove_int(five_sec_handler);
+        con_out("Array occlusions per second: %d", count);
+        
+        delete_zonelist(list);
+        delete_zonelist(mask_list);
       }
       
     } else if (win)
@@ -934,7 +1035,7 @@ bool console_command()
 
         while (!five_sec_tick)
         {
-          win->pack();
+          win->pack_now();
           count++;
         }
         remove_int(five_sec_handler);
@@ -987,7 +1088,7 @@ base_window* console_get_win(char* s, int& num)
     return console_man->get_keyfocus();
 
   } else {
-    num = atoi(s);
+    num = strtoul(s, 0, 10);
     return console_gui->find(num);
   }
   return 0;
@@ -1020,10 +1121,19 @@ int draw_to_next_sub(base_window* win)
   return 0;
 }
 
+// Returns a random, properly ordered zone lying within (0,0)-(limit,limit)
+zone random_zone(int limit)
+{
+  int x1 = rand() % limit, x2 = rand() % limit;
+  int y1 = rand() % limit, y2 = rand() % limit;
+  
+  return zone(PMAX(x1, x2), PMAX(y1, y2), PMIN(x1, x2), PMIN(y1, y2));
+}
+
 int recalc_viszones(base_window* win)
 {
  // win->calculate_viszones();
-  con_out("Recalculating viszones of window #%d", win->get_win_id());
+  con_out("Recalculating viszones of window #%u", win->get_win_id());
   
   return 0;
 }
@@ -3,10 +3,28 @@
 
 #include <iostream>
 
+/* Define PENGUIN_THREADS to build Penguin with a pthreads work pool (see pwork.h)
+   so that some of the heavier work on the window tree can be spread over several
+   processors. Without it, everything runs on the calling thread as it always has. */
+// #define PENGUIN_THREADS
+
+/* Define PENGUIN_COORD32 to use 32-bit co-ordinates throughout, for desktops and
+   scrolled canvases larger than 32767 pixels. Zones and windows grow accordingly,
+   and the zone_array kernels do half as many zones per instruction, so leave it
+   off unless it is needed. */
+// #define PENGUIN_COORD32
+
+#ifdef PENGUIN_COORD32
+typedef int coord_int; // Type that all co-ordinate variables should use
+const coord_int coord_int_max = 2147483647; // Maximum value 'coord_int' can hold
+#else
 typedef short int coord_int; // Type that all co-ordinate variables should use
+const coord_int coord_int_max = 32767; // Maximum value 'coord_int' can hold
+#endif
+const coord_int coord_int_min = -coord_int_max - 1; // Minimum value 'coord_int' can hold
+
 typedef unsigned short int flag_int; // Type that all low-level flags should use
 typedef unsigned char bt_int; // Type for representing button-clicks
-const coord_int coord_int_max = 32767; // Maximum value 'coord_int' can hold
 
 enum cursor_name
 {
@@ -36,6 +36,7 @@ struct dialogue_cancel_ei : public dialogue_ei
  */
 class file_chooser_class : public window_main
 {
+  DEFINE_WINDOW_SIZE(file_chooser_class)
   private: 
   
     base_window& creator;        // Window which created us. To simulate 'modality', we disable it until we are finished
@@ -109,6 +110,7 @@ class file_chooser_class : public window_main
 /* Class that represents the painter window. */
 class paint_class : public window_main
 {
+  DEFINE_WINDOW_SIZE(paint_class)
   private:   
    
     window_lframe controls; // 'Control' frame within all editting controls within it 
@@ -370,6 +372,7 @@ class paint_class : public window_main
 
 class note_class : public window_main
 {
+  DEFINE_WINDOW_SIZE(note_class)
   private:
   
     enum { save, load } get_mode;
@@ -451,6 +454,7 @@ class note_class : public window_main
 
 class widget_class : public window_main
 {
+  DEFINE_WINDOW_SIZE(widget_class)
   private:
   
     std::string instruction_text;
@@ -599,6 +603,7 @@ class widget_class : public window_main
 
 class desktop_class : public window_block
 {
+  DEFINE_WINDOW_SIZE(desktop_class)
   private:
     
     window_image wallpaper;
@@ -619,7 +624,8 @@ class desktop_class : public window_block
       window_button exit_button;     
       
     struct about_class : public window_frame
-    {      
+    {
+      DEFINE_WINDOW_SIZE(about_class)
       window_button exit_button;
       window_label info;
       
@@ -751,6 +757,7 @@ class desktop_class : public window_block
 /*
 class desktop_class : public window_block // Inherit from a blank window with a 'block' of colour
 {
+  DEFINE_WINDOW_SIZE(desktop_class)
   private:
 
     window_frame frame1;
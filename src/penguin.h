@@ -12,5 +12,7 @@
 
 #include "psublim.h"
 #include "pwidgets.h"
+#include "pvirtual.h"
+#include "pcells.h"
 
 #endif
@@ -16,7 +16,8 @@ void event_participant::listen(event_participant& sender, void_part_method func,
 
 void event_participant::forget(event_participant& sender, part_method func, const std::type_info& model)
 {
-  for (knot_list::iterator r = knot_receive_list.begin(); r != knot_receive_list.end(); r++)
+  if (!knots) return;
+  for (knot_list::iterator r = knots->receive.begin(); r != knots->receive.end(); r++)
   {
     if ((*r)->is(sender, *this, func, model)) 
     {
@@ -28,7 +29,8 @@ void event_participant::forget(event_participant& sender, part_method func, cons
 
 void event_participant::forget(event_participant& sender, void_part_method func, const std::type_info& model)
 {
-  for (knot_list::iterator r = knot_receive_list.begin(); r != knot_receive_list.end(); r++)
+  if (!knots) return;
+  for (knot_list::iterator r = knots->receive.begin(); r != knots->receive.end(); r++)
   {
     if ((*r)->is(sender, *this, func, model)) 
     {
@@ -40,8 +42,10 @@ void event_participant::forget(event_participant& sender, void_part_method func,
 
 void event_participant::transmit(const event_info& ei, base_window* win)
 {
+  if (!knots) return;
+  invalidate = false;
   ei.origin = win;
-  for (knot_iterator i = knot_send_list.begin(); i != knot_send_list.end(); i)
+  for (knot_iterator i = knots->send.begin(); i != knots->send.end() && !invalidate; i++)
     (*i)->issue(ei); // Issue the event to each knot in the send list.
 }
 
@@ -50,6 +54,18 @@ event_participant::~event_participant()
 {
   clear_send_list();    // Delete all the event_knots in our send-list
   clear_receive_list(); // Delete all the event_knots in our receive-list
+  delete knots;
+}
+
+// Each list node holds a knot pointer and two links; the knots themselves are
+// counted against the receiver, as it is the one that asked for them.
+unsigned int event_participant::knot_footprint() const
+{
+  if (!knots) return 0;
+
+  unsigned int node = sizeof(event_knot*) + 2 * sizeof(void*);
+  return sizeof(knot_lists) + (knots->send.size() + knots->receive.size()) * node
+       + knots->receive.size() * sizeof(event_knot);
 }
 
 base_window& event_info::source() const
@@ -61,27 +77,27 @@ void event_participant::clear_send_list()
 {
   invalidate = true;
   // While our send-list is not empty, delete the first knot in the list.
-  while (!knot_send_list.empty()) delete knot_send_list.front();
+  if (knots) while (!knots->send.empty()) delete knots->send.front();
 }
 
 void event_participant::clear_receive_list()
 {
   invalidate = true;
   // While our receive-list is not empty, delete the first knot in the list.
-  while (!knot_receive_list.empty()) delete knot_receive_list.front();
+  if (knots) while (!knots->receive.empty()) delete knots->receive.front();
 }
 
 // This function attempts to remove the given knot pointer from the knot_send_list
 void event_participant::untie_knot_to(event_knot* knot)
 {
   invalidate = true;
-  Assert(!knot_send_list.empty(), "Untie_knot_to: Send list exhausted on window" << this);
+  Assert(knots && !knots->send.empty(), "Untie_knot_to: Send list exhausted on window" << this);
 
-  for (knot_list::iterator r = knot_send_list.begin(); r != knot_send_list.end(); r++)
+  for (knot_list::iterator r = knots->send.begin(); r != knots->send.end(); r++)
   {
     if (*r == knot) 
     {
-      knot_send_list.erase(r);
+      knots->send.erase(r);
       break;
     }
   }
@@ -91,13 +107,13 @@ void event_participant::untie_knot_to(event_knot* knot)
 void event_participant::untie_knot_from(event_knot* knot)
 {
   invalidate = true;
-  Assert(!knot_receive_list.empty(), "Untie_knot_from: Receive list exhausted on window" << this);
+  Assert(knots && !knots->receive.empty(), "Untie_knot_from: Receive list exhausted on window" << this);
 
-  for (knot_list::iterator r = knot_receive_list.begin(); r != knot_receive_list.end(); r++)
+  for (knot_list::iterator r = knots->receive.begin(); r != knots->receive.end(); r++)
   {
     if (*r == knot) 
     {
-      knot_receive_list.erase(r);
+      knots->receive.erase(r);
       break;
     }
   }
@@ -106,13 +122,13 @@ void event_participant::untie_knot_from(event_knot* knot)
 // This function adds the given knot pointer to the knot_send_list at the end
 void event_participant::tie_knot_to(event_knot* knot)
 {
-  knot_send_list.push_back(knot);
+  lists().send.push_back(knot);
 }
 
 // This function adds the given knot pointer to the knot_receive_list at the end
 void event_participant::tie_knot_from(event_knot* knot)
 {
-  knot_receive_list.push_back(knot);
+  lists().receive.push_back(knot);
 }
 
 // Event knot constructor:
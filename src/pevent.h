@@ -117,6 +117,14 @@ struct event_info
 typedef std::list<event_knot*> knot_list; // List of knot-pointers is a knot_list
 typedef std::list<event_knot*>::iterator knot_iterator; // Iterator of a knot_list
 
+// The two knot lists of a participant. Most windows never listen or get listened
+// to, so these are only allocated once the first knot is tied.
+struct knot_lists
+{
+  knot_list send;    // A list of knots who we might transmit to
+  knot_list receive; // A list of knots who might send events to us
+};
+
 /* This class represents an interface that should exist for any type that wishes
    to send and/or receive objects. It can listen to custom events, and can also 
    be listened to. When an event occurs to it that it would like to warn other 
@@ -126,13 +134,14 @@ class event_participant
 {
   private:
 
-    knot_list knot_send_list;    // A list of knots who we might transmit to
-    knot_list knot_receive_list; // A list of knots who might send events to us
+    knot_lists* knots; // Our send and receive lists, or 0 if we have never had any
     bool invalidate;
 
+    knot_lists& lists() { if (!knots) knots = new knot_lists; return *knots; }
+
   public:
 
-    event_participant() : invalidate(false) { }
+    event_participant() : knots(0), invalidate(false) { }
     virtual ~event_participant(); // This destroys any knots linked to us
         
     void clear_send_list();    // This clears off any ties to listening knots
@@ -161,12 +170,19 @@ class event_participant
     // Infrom interested parties that 'ei' occured.
     void transmit(const event_info& ei)
     {
+      if (!knots) return; // Nobody has ever listened to us
       invalidate = false;
       ei.origin = this; // Set the event to point to us as its origin
-      for (knot_iterator i = knot_send_list.begin(); i != knot_send_list.end() && !invalidate; i++)
+      for (knot_iterator i = knots->send.begin(); i != knots->send.end() && !invalidate; i++)
         (*i)->issue(ei); // Issue the event to each knot in the send list.
     }
     void transmit(const event_info& ei, base_window* win);
+
+    // Whether anyone would hear a transmit, for events that are costly to build
+    bool listened_to() const { return knots && !knots->send.empty(); }
+
+    // Returns the bytes of knot-list kept out of line for us, for footprint reports
+    unsigned int knot_footprint() const;
 };
 
 #endif
@@ -0,0 +1,227 @@
+#include "pfont.h"
+#include "allegro.h"
+
+#ifdef PENGUIN_THREADS
+static pthread_mutex_t fonts_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+// Every font we have metrics for, made on first use like the window registry
+static std::map<FONT*, font_metrics*>& known_fonts()
+{
+  static std::map<FONT*, font_metrics*> fonts;
+  return fonts;
+}
+
+font_metrics::font_metrics(FONT* f)
+: font(f), height(text_height(f))
+{
+  for (int c = 0; c < 256; c++) latin[c] = f->vtable->char_length(f, c);
+
+#ifdef PENGUIN_THREADS
+  pthread_mutex_init(&lock, 0);
+#endif
+}
+
+font_metrics::~font_metrics()
+{
+#ifdef PENGUIN_THREADS
+  pthread_mutex_destroy(&lock);
+#endif
+}
+
+int font_metrics::other(int c) const
+{
+#ifdef PENGUIN_THREADS
+  pthread_mutex_lock(&lock);
+#endif
+
+  std::map<int, int>::iterator i = others.find(c);
+  int w = (i != others.end()) ? i->second : (others[c] = font->vtable->char_length(font, c));
+
+#ifdef PENGUIN_THREADS
+  pthread_mutex_unlock(&lock);
+#endif
+
+  return w;
+}
+
+int font_metrics::width(const char* s) const
+{
+  int w = 0;
+  for (int c; (c = ugetxc(&s));) w += advance(c);
+
+  return w;
+}
+
+const font_metrics& font_metrics::of(FONT* f)
+{
+#ifdef PENGUIN_THREADS
+  pthread_mutex_lock(&fonts_lock);
+#endif
+
+  font_metrics*& m = known_fonts()[f];
+  if (!m) m = new font_metrics(f);
+
+#ifdef PENGUIN_THREADS
+  pthread_mutex_unlock(&fonts_lock);
+#endif
+
+  return *m;
+}
+
+bool text_run_cache::key::operator<(const key& k) const
+{
+  if (font != k.font) return font < k.font;
+  if (fc != k.fc) return fc < k.fc;
+  if (bc != k.bc) return bc < k.bc;
+  if (depth != k.depth) return depth < k.depth;
+  return text < k.text;
+}
+
+text_run_cache& text_run_cache::global()
+{
+  static text_run_cache cache;
+  return cache;
+}
+
+text_run_cache::text_run_cache()
+: bytes(0), budget(1 << 20), hits(0), misses(0)
+{
+#ifdef PENGUIN_THREADS
+  pthread_mutex_init(&lock, 0);
+#endif
+}
+
+/* A run that isn't cached yet is rendered into a new bitmap of the destination's
+ * depth, then blitted like any other. The lock is only held while the cache is
+ * looked in or added to, and while text is rendered, as that goes through
+ * Allegro's global text mode; the blit is done with the run pinned instead, so
+ * that other threads can draw text meanwhile, but can't free it under us. */
+void text_run_cache::draw(BITMAP* dest, FONT* f, const char* s, int x, int y, int fc, int bc)
+{
+  key k;
+  k.font = f;
+  k.text = s;
+  k.fc = fc;
+  k.bc = bc;
+  k.depth = bitmap_color_depth(dest);
+
+#ifdef PENGUIN_THREADS
+  pthread_mutex_lock(&lock);
+#endif
+
+  std::map<key, run_list::iterator>::iterator i = index.find(k);
+
+  run* r;
+
+  if (i != index.end())
+  {
+    runs.splice(runs.begin(), runs, i->second);
+    r = *i->second;
+    hits++;
+  } else
+  {
+    const font_metrics& m = font_metrics::of(f);
+    int w = m.width(s), h = m.get_height();
+    BITMAP* bmp = (w > 0 && h > 0) ? create_bitmap_ex(k.depth, w, h) : 0;
+
+    if (!bmp) // Nothing to cache, or no memory to cache it in
+    {
+      text_mode(bc);
+      textout(dest, f, s, x, y, fc);
+#ifdef PENGUIN_THREADS
+      pthread_mutex_unlock(&lock);
+#endif
+      return;
+    }
+
+    text_mode(bc);
+    textout(bmp, f, s, 0, 0, fc);
+
+    r = new run;
+    r->k = k;
+    r->bmp = bmp;
+    r->bytes = w * h * ((k.depth + 7) / 8);
+    r->pins = 0;
+    r->cached = true;
+
+    runs.push_front(r);
+    index[k] = runs.begin();
+
+    bytes += r->bytes;
+    misses++;
+    trim();
+  }
+
+  r->pins++;
+
+#ifdef PENGUIN_THREADS
+  pthread_mutex_unlock(&lock);
+#endif
+
+  blit(r->bmp, dest, 0, 0, x, y, r->bmp->w, r->bmp->h);
+
+#ifdef PENGUIN_THREADS
+  pthread_mutex_lock(&lock);
+#endif
+
+  if (!--r->pins && !r->cached) let_go(r);
+
+#ifdef PENGUIN_THREADS
+  pthread_mutex_unlock(&lock);
+#endif
+}
+
+void text_run_cache::let_go(run* r)
+{
+  r->cached = false;
+  if (r->pins) return;
+
+  destroy_bitmap(r->bmp);
+  delete r;
+}
+
+// The run drawn last is always kept, even if it is bigger than the budget
+void text_run_cache::trim()
+{
+  while (bytes > budget && runs.size() > 1)
+  {
+    run* r = runs.back();
+
+    bytes -= r->bytes;
+    index.erase(r->k);
+    runs.pop_back();
+    let_go(r);
+  }
+}
+
+void text_run_cache::flush()
+{
+#ifdef PENGUIN_THREADS
+  pthread_mutex_lock(&lock);
+#endif
+
+  for (run_list::iterator i = runs.begin(); i != runs.end(); i++) let_go(*i);
+
+  runs.clear();
+  index.clear();
+  bytes = 0;
+
+#ifdef PENGUIN_THREADS
+  pthread_mutex_unlock(&lock);
+#endif
+}
+
+void text_run_cache::set_budget(unsigned int b)
+{
+#ifdef PENGUIN_THREADS
+  pthread_mutex_lock(&lock);
+#endif
+
+  budget = b;
+  trim();
+
+#ifdef PENGUIN_THREADS
+  pthread_mutex_unlock(&lock);
+#endif
+}
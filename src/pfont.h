@@ -0,0 +1,119 @@
+#ifndef PFONT_H
+#define PFONT_H
+
+#include "pdefs.h"
+#include <string>
+#include <list>
+#include <map>
+
+#ifdef PENGUIN_THREADS
+#include <pthread.h>
+#endif
+
+struct FONT;
+struct BITMAP;
+
+/* The width of a piece of text is the sum of the advances of its characters,
+ * which Allegro finds by calling through the font's vtable for each character,
+ * every time it is asked. A font_metrics asks only once per character: the
+ * first 256, which is all most text ever uses, are put in a flat table when the
+ * font is first seen, and any others are kept in a map as they turn up.
+ *
+ * There is one font_metrics per font, made on first use and kept from then on,
+ * since text layouts hold on to the metrics of the font they were made with.
+ * Fonts are taken to last as long as the program, as the theme's do.
+ */
+class font_metrics
+{
+  private:
+
+    FONT* font;
+    int height;
+    int latin[256]; // Advances of the first 256 characters
+
+    mutable std::map<int, int> others; // Advances of the rest, as they are asked for
+#ifdef PENGUIN_THREADS
+    mutable pthread_mutex_t lock;
+#endif
+
+    int other(int c) const;
+
+    font_metrics(FONT* f);
+    ~font_metrics();
+
+  public:
+
+    int advance(int c) const { return (c >= 0 && c < 256) ? latin[c] : other(c); }
+    int width(const char* s) const; // As text_length, in the current text encoding
+    int get_height() const { return height; }
+
+    static const font_metrics& of(FONT* f);
+};
+
+/* Labels and button captions are drawn over and over with the same text in the
+ * same colours. The run cache keeps each such run of text already rendered in a
+ * bitmap of its own, so that drawing it again is a single blit. Runs are kept
+ * in order of use, and once their bitmaps add up to more than the budget, the
+ * runs that have gone longest without being drawn are let go.
+ *
+ * Runs are keyed by font, text, colours and colour depth. Only text with a
+ * solid background, drawn in the normal drawing mode, can be cached; anything
+ * else should be drawn directly. The cache is flushed when the theme unloads.
+ */
+class text_run_cache
+{
+  private:
+
+    struct key
+    {
+      FONT* font;
+      std::string text;
+      int fc, bc; // Text and background colours
+      int depth;
+
+      bool operator<(const key& k) const;
+    };
+
+    struct run
+    {
+      key k;
+      BITMAP* bmp;
+      unsigned int bytes;
+      int pins;    // Threads blitting it right now, outside the lock
+      bool cached; // Cleared when we let it go while it is pinned
+    };
+
+    typedef std::list<run*> run_list;
+
+    run_list runs; // Most recently drawn first
+    std::map<key, run_list::iterator> index;
+
+    unsigned int bytes;  // Taken up by all the runs' bitmaps
+    unsigned int budget;
+    int hits, misses;
+#ifdef PENGUIN_THREADS
+    pthread_mutex_t lock;
+#endif
+
+    void trim(); // Lets runs go until we are within budget
+    void let_go(run* r); // Frees the run, or leaves that to whoever unpins it last
+
+  public:
+
+    // Draws the text with its top-left at (x, y) on 'dest', in colour 'fc' on 'bc'
+    void draw(BITMAP* dest, FONT* f, const char* s, int x, int y, int fc, int bc);
+
+    void flush(); // Lets every run go
+    void set_budget(unsigned int b);
+
+    unsigned int size() const { return bytes; }
+    int count() const { return index.size(); }
+    int get_hits() const { return hits; }
+    int get_misses() const { return misses; }
+
+    static text_run_cache& global();
+
+    text_run_cache();
+};
+
+#endif
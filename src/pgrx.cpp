@@ -1,10 +1,11 @@
 #include "pgrx.h"
+#include "pfont.h"
 #include <math.h>
 #include "allegro.h"
 #include "allegro/internal/aintern.h"
 
 graphics_context::graphics_context(BITMAP* s, int x, int y, const ptheme& tt) 
-: bmp(s), t(tt), ox(x), oy(y), ct(s->ct), cr(s->cr), cb(s->cb), cl(s->cl)
+: bmp(s), t(tt), ox(x), oy(y), ct(s->ct), cr(s->cr), cb(s->cb), cl(s->cl), dithered(false)
 { }  
 
 graphics_context::~graphics_context()
@@ -101,463 +102,133 @@ void graphics_context::render_backdrop(coord_int& x, coord_int& y, const zone& z
   }
 }
 
+/* These answer their questions from a text_layout. Widgets that ask several of
+ * them about the same text should keep a text_layout of their own instead, and
+ * so only lay the text out when it changes. */
 int lines_in_multiline(FONT* font, const std::string& str, const zone& z, bool wrap)
 {   
-  int str_h = text_height(font);
-  int spc_w = text_length(font, " ");
-  int x_margin = z.ax + 4;
-  int cur_x = x_margin;
-  int cur_y = z.ay + 3;
-  int lines = 1; 
-   
-  for (std::string::size_type cur = 0, last_word = 0; cur <= str.length(); cur++)
-  {
-    char c = str[cur];
-    
-    if ((c <= 32) || (cur == str.length()))
-    {
-      const char* sub = std::string(str, last_word, cur-last_word).c_str();
-      
-      int str_w = text_length(font, sub);
-
-      if (wrap)
-      if ((cur_x + str_w > z.bx && x_margin + str_w < z.bx)
-      || (x_margin + str_w >= z.bx && cur_x != x_margin))
-      {
-        lines++;
-        cur_x = x_margin;
-        cur_y += str_h;
-      }
-
-      cur_x += str_w;
-      cur_x += spc_w;
-      last_word = cur + 1;
-    }
-
-    if (c == '\n')
-    {
-      lines++;
-      cur_x = x_margin;
-      cur_y += str_h;
-    }
-  } 
- 
-  return lines;
+  return text_layout(font, str, multiline_width(z), wrap).lines();
 }
 
 int char_to_line(FONT* font, const std::string& str, const zone& z, int cpos, bool wrap)
 {
-  int str_h = text_height(font);
-  int spc_w = text_length(font, " ");
-  int x_margin = z.ax + 4;
-  int cur_x = x_margin;
-  int cur_y = z.ay + 3;
-  int cur_line = 1;
-     
-  for (std::string::size_type cur = 0, last_word = 0; cur <= str.length(); cur++)
-  {
-    char c = str[cur];
-    
-    if ((c <= 32) || (cur == str.length()))
-    {
-      const char* sub = std::string(str, last_word, cur-last_word).c_str();
-      
-      int str_w = text_length(font, sub);
-
-      if (wrap)
-      if ((cur_x + str_w > z.bx && x_margin + str_w < z.bx)
-      || (x_margin + str_w >= z.bx && cur_x != x_margin))
-      {
-        cur_x = x_margin;
-        cur_y += str_h;
-        cur_line++;
-      }
-
-      if (cur >= cpos)
-      {
-        return cur_line;
-      }
-                                       
-      cur_x += str_w;
-      cur_x += spc_w;
-      last_word = cur + 1;
-    }
-
-    if (c == '\n')
-    {    
-      cur_x = x_margin;
-      cur_y += str_h;
-      cur_line++;
-    }
-  } 
-  
-  return cur_line;
+  return text_layout(font, str, multiline_width(z), wrap).line_of(cpos) + 1;
 }
 
 int first_char_in_line(FONT* font, const std::string& str, const zone& z, int cpos, bool wrap)
 {
-  int str_h = text_height(font);
-  int spc_w = text_length(font, " ");
-  int x_margin = z.ax + 4;
-  int cur_x = x_margin;
-  int cur_y = z.ay + 3;
-  int cur_line = 1, last_line = 0;
-     
-  for (std::string::size_type cur = 0, last_word = 0; cur <= str.length(); cur++)
-  {
-    char c = str[cur];
-    
-    if ((c <= 32) || (cur == str.length()))
-    {
-      const char* sub = std::string(str, last_word, cur-last_word).c_str();
-      
-      int str_w = text_length(font, sub);
-
-      if (wrap)
-      if ((cur_x + str_w > z.bx && x_margin + str_w < z.bx)
-      || (x_margin + str_w >= z.bx && cur_x != x_margin))
-      {
-        cur_x = x_margin;
-        cur_y += str_h;
-        cur_line++;
-        last_line = last_word;
-      }
-
-      if (cur >= cpos) return last_line;
-                                             
-      cur_x += str_w;
-      cur_x += spc_w;
-      last_word = cur + 1;
-    }
-
-    if (c == '\n')
-    {    
-      last_line = cur+1;
-      cur_x = x_margin;
-      cur_y += str_h;
-      cur_line++;
-    }
-  } 
-  
-  return last_line;
+  text_layout lay(font, str, multiline_width(z), wrap);
+  return lay.line_start(lay.line_of(cpos));
 }
 
 int line_to_char(FONT* font, const std::string& str, const zone& z, int line, bool wrap)
 {
-  int str_h = text_height(font);
-  int spc_w = text_length(font, " ");
-  int x_margin = z.ax + 4;
-  int cur_x = x_margin;
-  int cur_y = z.ay + 3;
-  int cur_line = 1;
-     
-  for (std::string::size_type cur = 0, last_word = 0; cur <= str.length(); cur++)
-  {
-    char c = str[cur];
-    
-    if ((c <= 32) || (cur == str.length()))
-    {
-      const char* sub = std::string(str, last_word, cur-last_word).c_str();
-      
-      int str_w = text_length(font, sub);
-
-      if (wrap)
-      if ((cur_x + str_w > z.bx && x_margin + str_w < z.bx)
-      || (x_margin + str_w >= z.bx && cur_x != x_margin))
-      {
-        cur_x = x_margin;
-        cur_y += str_h;
-        cur_line++;
-      }
+  text_layout lay(font, str, multiline_width(z), wrap);
 
-      if (cur_line >= line)
-      {
-        return last_word;
-      }
-                                       
-      cur_x += str_w;
-      cur_x += spc_w;
-      last_word = cur + 1;
-    }
-
-    if (c == '\n')
-    {    
-      cur_x = x_margin;
-      cur_y += str_h;
-      cur_line++;
-    }
-  } 
-  
-  return str.length();
+  if (line <= 1) return 0;
+  if (line > lay.lines()) return str.length();
+  return lay.line_start(line - 1);
 }
 
+// Returns the number of characters on the line, not counting the break at its end
 int chars_in_line(FONT* font, const std::string& str, const zone& z, int line, bool wrap)
 {
-  int str_h = text_height(font);
-  int spc_w = text_length(font, " ");
-  int x_margin = z.ax + 4;
-  int cur_x = x_margin;
-  int cur_y = z.ay + 3;
-  int cur_line = 1;
-  int chars = 0;
-     
-  for (std::string::size_type cur = 0, last_word = 0; cur <= str.length(); cur++)
-  {
-    char c = str[cur];  
-    
-    if (line == cur_line && c > 32) chars++;
-    
-    if ((c <= 32) || (cur == str.length()))
-    {
-      std::string string_sub(str, last_word, cur-last_word);
-      const char* sub = string_sub.c_str();
-      
-      int str_w = text_length(font, sub);
-
-      if (wrap)
-      if ((cur_x + str_w > z.bx && x_margin + str_w < z.bx)
-      || (x_margin + str_w >= z.bx && cur_x != x_margin))
-      {
-        cur_x = x_margin;
-        cur_y += str_h;
-        cur_line++;
-        if (line == cur_line) chars = string_sub.length();
-      }
-
-      if (cur_line > line) return chars;
-                                       
-      cur_x += str_w;
-      cur_x += spc_w;
-      last_word = cur + 1;
-    }
+  text_layout lay(font, str, multiline_width(z), wrap);
 
-    if (c == '\n')
-    {    
-      cur_x = x_margin;
-      cur_y += str_h;
-      cur_line++;
-    }
-  } 
-  
-  return chars;
+  if (line < 1 || line > lay.lines()) return 0;
+  return lay.line_end(line - 1) - lay.line_start(line - 1);
 }
 
-
 void graphics_context::render_multiline(const std::string& str, const zone& z, int bc, int cpos, int line, bool wrap) const
+{
+  render_multiline(text_layout(t.font, str, multiline_width(z), wrap), z, bc, cpos, line);
+}
+
+/* Draws the lines of the layout that fit in the zone, starting at 'line', with
+ * the caret before character 'cpos' (if it is on one of them). The gaps between
+ * and after words are filled in with the background colour as it goes, so that
+ * nothing underneath needs to have been cleared first.
+ *
+ * Only the lines that reach into the clipping rectangle are visited, being
+ * found straight from their height, and along them only the words that do, so
+ * drawing a vis-zone costs what is in it, however long the text. */
+void graphics_context::render_multiline(const text_layout& lay, const zone& z, int bc, int cpos, int line) const
 {
   if (!intersect(bmp, real(z))) return;
   clipper clip(*this, z.ax, z.ay, z.bx, z.by);
     
   text_mode(bc);
 
-  int str_h = text_height(t.font);
-  int spc_w = text_length(t.font, " ");
+  const text_buffer& str = lay.get_text();
+  int str_h = lay.get_line_h();
+  int spc_w = lay.get_space_w();
   int x_margin = z.ax + 4;
-  int cur_x = x_margin;
-  int cur_y = z.ay + 3;
-  int cur_line = 0;
+  int top = z.ay + 3;
   
   rectfill(z.ax, z.ay, x_margin-1, z.by, bc);
   rectfill(z.ax, z.ay, z.bx, z.ay+2, bc);
-   
-  for (std::string::size_type cur = 0, last_word = 0; cur <= str.length(); cur++)
+
+  coord_int cl = bmp->cl - ox, ct = bmp->ct - oy;
+  coord_int cr = bmp->cr - ox, cb = bmp->cb - oy;
+
+  if (line < 0) line = 0;
+  int first = line + ((ct > top) ? (ct - top) / str_h : 0);
+  int last = line + ((cb > top) ? (cb - top + str_h - 1) / str_h : 0);
+  if (last > lay.lines()) last = lay.lines();
+
+  int cur_y = top + (first - line) * str_h;
+
+  for (int l = first; l < last; l++, cur_y += str_h)
   {
-    char c = str[cur];
-    
-    if ((c <= 32) || (cur == str.length()))
+    coord_int cur_x = x_margin;
+
+    for (int i = lay.first_word(l); i <= lay.last_word(l); i++)
     {
-      const char* sub = std::string(str, last_word, cur-last_word).c_str();
-      
-      int str_w = text_length(t.font, sub);
+      text_layout::word wd = lay.get_word(i);
+      cur_x = x_margin + wd.x;
+      if (cur_x > cr) break;
 
-      if (wrap)
-      if ((cur_x + str_w > z.bx && x_margin + str_w < z.bx)
-      || (x_margin + str_w >= z.bx && cur_x != x_margin))
+      if (cur_x + wd.w + spc_w > cl)
       {
-        if (cur_line >= line)
-        {
-          rectfill(cur_x, cur_y, z.bx, cur_y+str_h-1, bc);
-          cur_y += str_h;
-        } else cur_line++;
-        
-        cur_x = x_margin;
+        if (wd.end > wd.start) textout(str.substr(wd.start, wd.end - wd.start).c_str(), cur_x, cur_y);
+        rectfill(cur_x+wd.w, cur_y, cur_x+wd.w+spc_w-1, cur_y+str_h-1, bc);
       }
-      if (cur_line >= line) rectfill(cur_x+str_w, cur_y, cur_x+str_w+spc_w-1, cur_y+str_h-1, bc);
 
-      if (cur_y >= z.by) break;
-      
-      if (cur_line >= line) 
-      {
-        textout(sub, cur_x, cur_y);
-        
-        if (cur >= cpos && cpos >= last_word) 
-        {
-          int cx = cur_x;
-          for (std::string::size_type n = last_word; n < cpos; n++) 
-            cx += t.font->vtable->char_length(t.font, str[n]);
-     
-          vline(cx-1, cur_y, cur_y+str_h-1, t.text);
-        }  
-      }   
-              
-      cur_x += str_w;
-      cur_x += spc_w;
-      last_word = cur + 1;
-    }
+      if (cpos >= wd.start && cpos <= wd.end) 
+        vline(x_margin + lay.char_x(cpos) - 1, cur_y, cur_y+str_h-1, t.text);
 
-    if (c == '\n')// && ++line > sline)
-    {
-      if (cur_line >= line)
-      {
-        rectfill(cur_x, cur_y, z.bx, cur_y+str_h-1, bc);
-        cur_y += str_h;
-      } else cur_line++;
-       
-      cur_x = x_margin;
+      cur_x += wd.w + spc_w;
     }
+
+    rectfill(cur_x, cur_y, z.bx, cur_y+str_h-1, bc);
   } 
   
-  if (cur_y < z.by)
-  {
-    rectfill(cur_x, cur_y, z.bx, cur_y+str_h-1, bc);
-    rectfill(z.ax, cur_y+str_h, z.bx, z.by, bc);
-  }
+  if (cur_y < z.by) rectfill(z.ax, cur_y, z.bx, z.by, bc);
 } 
 
 void find_multiline_coords(FONT* font, const std::string& str, const zone& z, int cpos, coord_int& cx, coord_int& cy, int line, bool wrap)
 {
-  int str_h = text_height(font);
-  int spc_w = text_length(font, " ");
-  int x_margin = z.ax + 4;
-  int cur_x = x_margin;
-  int cur_y = z.ay + 3;
-  int cur_line = 0;
-   
-  for (std::string::size_type cur = 0, last_word = 0; cur <= str.length(); cur++)
-  {
-    char c = str[cur];
-    
-    if ((c <= 32) || (cur == str.length()))
-    {
-      const char* sub = std::string(str, last_word, cur-last_word).c_str();
-      
-      int str_w = text_length(font, sub);
-
-      if (wrap)
-      if ((cur_x + str_w > z.bx && x_margin + str_w < z.bx)
-      || (x_margin + str_w >= z.bx && cur_x != x_margin))
-      {
-        if (cur_line >= line)
-        {
-          cur_y += str_h;
-        } else cur_line++;
-        
-        cur_x = x_margin;
-      }
-
-      if (cur_y >= z.by) break;
-      
-      
-      if (cur >= cpos && cpos >= last_word) 
-      {
-        cx = cur_x, cy = cur_y;
-        for (std::string::size_type n = last_word; n < cpos; n++) 
-          cx += font->vtable->char_length(font, str[n]);
-     
-        return;
-      }   
-              
-      cur_x += str_w;
-      cur_x += spc_w;
-      last_word = cur + 1;
-    }
-
-    if (c == '\n')
-    {
-      if (cur_line >= line)
-      {
-        cur_y += str_h;
-      } else cur_line++;
-       
-      cur_x = x_margin;
-    }
-  } 
-  cx = cur_x;
-  cy = cur_y;  
+  text_layout(font, str, multiline_width(z), wrap).find_coords(cpos, cx, cy, line);
+  cx += z.ax + 4;
+  cy += z.ay + 3;
 }
 
 std::string::size_type find_multiline_index(FONT* font, const std::string& str, const zone& z, coord_int cx, coord_int cy, int line, bool wrap)
 {
-  int str_h = text_height(font);
-  int spc_w = text_length(font, " ");
-  int x_margin = z.ax + 4;
-  int cur_x = x_margin;
-  int cur_y = z.ay + 3;
-  int cur_line = 0;
-   
-  for (std::string::size_type cur = 0, last_word = 0; cur <= str.length(); cur++)
-  {
-    char c = str[cur];
-    
-    if ((c <= 32) || (cur == str.length()))
-    {
-      const char* sub = std::string(str, last_word, cur-last_word).c_str();
-      
-      int str_w = text_length(font, sub);
-
-      if (wrap)
-      if ((cur_x + str_w > z.bx && x_margin + str_w < z.bx)
-      || (x_margin + str_w >= z.bx && cur_x != x_margin))
-      {
-        if (cur_line >= line)
-        {
-          cur_y += str_h;
-        } else cur_line++;
-
-        if (cur_y > cy) return last_word ? last_word-1 : 0;
-   
-        cur_x = x_margin;        
-      }
-      
-      if (cur_line >= line)
-      if ((cur_x + str_w + spc_w > cx) && (cur_y + str_h > cy))
-      {
-        int x = cur_x;
-        for (std::string::size_type n = last_word; n <= cur; n++)
-        {
-          x += font->vtable->char_length(font, str[n]);
-          if (x > cx + font->vtable->char_length(font, str[n])/2) 
-            return n;
-        }
-      }
-
-      cur_x += str_w;
-      cur_x += spc_w;
-      last_word = cur + 1;
-    }
-
-    if (c == '\n')
-    {
-      if (cur_line >= line)
-      {
-        cur_y += str_h;
-      } else cur_line++;
-       
-      cur_x = x_margin;
-    }
-    
-  } 
-  return str.length();
+  return text_layout(font, str, multiline_width(z), wrap).find_index(cx - z.ax - 4, cy - z.ay - 3, line);
 } 
 
+/* Text without a caret, drawn normally, comes from the run cache, so that a
+ * caption that hasn't changed is a single blit. */
 void graphics_context::render_line(compass_orientation align, const char* str, const zone& z, int fc, int bc, int cpos, coord_int off_x, coord_int off_y) const
 {
   //if (!intersect(bmp, real(z))) return;
 
   clipper clip(*this, z.ax, z.ay, z.bx, z.by);
   
-  int text_w = text_length(t.font, str);
-  int text_h = text_height(t.font);
+  const font_metrics& m = font_metrics::of(t.font);
+  int text_w = m.width(str);
+  int text_h = m.get_height();
   coord_int mx = 4;
   coord_int my = 4;
 
@@ -598,12 +269,17 @@ void graphics_context::render_line(compass_orientation align, const char* str, c
     margins = next;
   }
 
-  text_mode(bc);
-  textout(str, (int)start_x, (int)start_y, fc);
+  if (cpos == -1 && bc >= 0 && _drawing_mode == DRAW_MODE_SOLID)
+    text_run_cache::global().draw(bmp, t.font, str, (int)start_x + ox, (int)start_y + oy, fc, bc);
+  else
+  {
+    text_mode(bc);
+    textout(str, (int)start_x, (int)start_y, fc);
+  }
  
   if (cpos > -1)
   {
-    for (int ch = 0, n = 0; (ch = ugetxc(&str)) && n < cpos; n++) start_x += t.font->vtable->char_length(t.font, ch);
+    for (int ch = 0, n = 0; (ch = ugetxc(&str)) && n < cpos; n++) start_x += m.advance(ch);
    
     vline((int)start_x - 1, int(start_y), int(end_y), fc);
   }
@@ -611,8 +287,9 @@ void graphics_context::render_line(compass_orientation align, const char* str, c
 
 std::string::size_type find_line_index(FONT* font, compass_orientation align, const char* str, const zone& z, coord_int cx, coord_int ox, coord_int oy)
 {
-  int text_w = text_length(font, str);
-  int text_h = text_height(font);
+  const font_metrics& m = font_metrics::of(font);
+  int text_w = m.width(str);
+  int text_h = m.get_height();
   
   coord_int mx = 4;
   coord_int my = 4;
@@ -643,7 +320,7 @@ std::string::size_type find_line_index(FONT* font, compass_orientation align, co
   
   const char* old_str = str;
   coord_int old_x = int(start_x);
-  for (int ch = 0, n = 0; (ch = ugetxc(&str)); start_x += font->vtable->char_length(font, ch), n++)
+  for (int ch = 0, n = 0; (ch = ugetxc(&str)); start_x += m.advance(ch), n++)
   {     
     if (start_x >= cx) 
     {
@@ -654,15 +331,9 @@ std::string::size_type find_line_index(FONT* font, compass_orientation align, co
   return strlen(old_str);
 }
 
-void graphics_context::draw_frame(coord_int ax, coord_int ay, coord_int bx, coord_int by, frame_type ft) const
+// The colours of the lines 'frame_lines' draws for a frame of that type
+static void frame_colours(const ptheme& t, frame_type ft, int& a, int& b, int& c, int& d)
 {
-  ax += ox;
-  ay += oy;
-  bx += ox;
-  by += oy;
-  
-  int a, b, c, d;
-  
   /*  A A A A A A A A C
       A B B B B B B D C
       A B           D C
@@ -724,7 +395,10 @@ void graphics_context::draw_frame(coord_int ax, coord_int ay, coord_int bx, coor
       a = b = c = d = t.frame;
       break;
   }
+}
 
+static void frame_lines(BITMAP* bmp, coord_int ax, coord_int ay, coord_int bx, coord_int by, int a, int b, int c, int d)
+{
   ::hline(bmp, ax, ay, bx-1, a);
   ::vline(bmp, ax, ay, by-1, a);
   ::hline(bmp, ax+1, ay+1, bx-2, b);
@@ -736,6 +410,68 @@ void graphics_context::draw_frame(coord_int ax, coord_int ay, coord_int bx, coor
   ::vline(bmp, bx-1, ay+1, by-1, d);
 }
 
+/* Covers the piece of frame at (dx, dy) with the piece of skin at (sx, sy),
+ * repeated along it. Allegro's stretch_blit keeps its state in statics, and so
+ * can't be used by frames drawn on other threads. An edge only a pixel long is
+ * drawn as a line for each pixel across it instead, in that pixel's colour. */
+static void skin_edge(BITMAP* src, BITMAP* dest, int sx, int sy, int sw, int sh, int dx, int dy, int dw, int dh)
+{
+  if (dw <= 0 || dh <= 0 || sw <= 0 || sh <= 0) return;
+  
+  if (sw == 1 && dw > 1)
+  {
+    for (int j = 0; j < dh; j++) ::hline(dest, dx, dy + j, dx + dw - 1, getpixel(src, sx, sy + j));
+  } else if (sh == 1 && dh > 1)
+  {
+    for (int i = 0; i < dw; i++) ::vline(dest, dx + i, dy, dy + dh - 1, getpixel(src, sx + i, sy));
+  } else
+  {
+    for (int y = 0; y < dh; y += sh)
+      for (int x = 0; x < dw; x += sw)
+        ::blit(src, dest, sx, sy, dx + x, dy + y, PMAX(sw, dw - x), PMAX(sh, dh - y));
+  }
+}
+
+/* Frames with a skin are drawn from it, which is four blits for the corners and
+ * a few lines or blits for each edge; the rest are eight lines, which is less.
+ * Blits take no notice of the drawing mode, though, so frames drawn in any mode
+ * but solid, and frames too small for their skin's corners to fit, are drawn
+ * with lines too. That is ours if it was set through us, and Allegro's for any
+ * widget setting it for itself. */
+void graphics_context::draw_frame(coord_int ax, coord_int ay, coord_int bx, coord_int by, frame_type ft) const
+{
+  ax += ox;
+  ay += oy;
+  bx += ox;
+  by += oy;
+  
+  const frame_skin& s = t.skins[ft];
+  coord_int w = bx - ax + 1, h = by - ay + 1; // A frame covers both its corners
+
+  if (!s.bmp || w < s.l + s.r || h < s.t + s.b || dithered || _drawing_mode != DRAW_MODE_SOLID)
+  {
+    int a, b, c, d;
+    frame_colours(t, ft, a, b, c, d);
+    frame_lines(bmp, ax, ay, bx, by, a, b, c, d);
+    return;
+  }
+
+  BITMAP* src = s.bmp;
+  coord_int sw = src->w - s.l - s.r, sh = src->h - s.t - s.b; // The middle of the skin,
+  coord_int mw = w - s.l - s.r, mh = h - s.t - s.b;           // and of the frame
+  coord_int rx = bx - s.r + 1, by2 = by - s.b + 1;            // Where the right and bottom edges start
+
+  ::blit(src, bmp, 0, 0, ax, ay, s.l, s.t);
+  ::blit(src, bmp, src->w - s.r, 0, rx, ay, s.r, s.t);
+  ::blit(src, bmp, 0, src->h - s.b, ax, by2, s.l, s.b);
+  ::blit(src, bmp, src->w - s.r, src->h - s.b, rx, by2, s.r, s.b);
+
+  skin_edge(src, bmp, s.l, 0, sw, s.t, ax + s.l, ay, mw, s.t);
+  skin_edge(src, bmp, s.l, src->h - s.b, sw, s.b, ax + s.l, by2, mw, s.b);
+  skin_edge(src, bmp, 0, s.t, s.l, sh, ax, ay + s.t, s.l, mh);
+  skin_edge(src, bmp, src->w - s.r, s.t, s.r, sh, rx, ay + s.t, s.r, mh);
+}
+
 frame_type invert_frame(frame_type ft)
 {
   switch (ft)
@@ -748,14 +484,195 @@ frame_type invert_frame(frame_type ft)
   }
 }
 
-void ptheme::load()  // Take into account colour-depth in constructor!
+struct glyph_rect
+{
+  coord_int x, y, w, h;
+};
+
+// Where each theme_glyph lies in the theme's 'glyphs' bitmap
+static const glyph_rect glyph_rects[tg_count] =
+{
+  { 0, 0, 13, 13 }, { 13, 0, 13, 13 }, // Check boxes
+  { 26, 0, 12, 12 }, { 38, 0, 12, 12 }, // Radio buttons
+  { 50, 0, 7, 4 }, { 57, 0, 7, 4 }, { 64, 0, 4, 7 }, { 68, 0, 4, 7 } // Arrows
+};
+
+void graphics_context::draw_glyph(theme_glyph g, coord_int x, coord_int y) const
+{
+  const glyph_rect& r = glyph_rects[g];
+  ::blit(t.glyphs, bmp, r.x, r.y, x+ox, y+oy, r.w, r.h);
+}
+
+// The check box, its bevel and its tick, with its top-left at (rx, ry)
+static void draw_check_glyph(const graphics_context& grx, coord_int rx, coord_int ry, bool state)
+{
+  grx.draw_frame(rx, ry, rx+12, ry+12, ft_bevel_in);
+  grx.rectfill(rx+2, ry+2, rx+10, ry+10, grx.theme().white);
+  
+  if (state)
+  {
+    int col = grx.theme().black;
+    
+    grx.hline(rx+9,ry+3,rx+9,col);
+    grx.hline(rx+8,ry+4,rx+9,col);
+    grx.hline(rx+7,ry+5,rx+9,col); grx.hline(rx+3,ry+5,rx+3,col);
+    grx.hline(rx+6,ry+6,rx+8,col); grx.hline(rx+3,ry+6,rx+4,col);
+    grx.hline(rx+3,ry+7,rx+7,col);
+    grx.hline(rx+4,ry+8,rx+6,col);
+    grx.hline(rx+5,ry+9,rx+5,col);
+  }
+}
+
+// The radio button, with its dot if 'state' is set
+static void draw_radio_glyph(const graphics_context& grx, coord_int rx, coord_int ry, bool state)
+{
+  /* white:
+     2: 4-7, 10
+     3: 3-8, 10
+     4: 2-9, 11
+     5: 2-9, 11
+     6: 2-9, 11
+     7: 2-9, 11
+     8: 3-8, 10
+     9: 4-7, 10
+     10: 2-3, 8-9
+     11: 4-7 
+     
+     dark:
+     0: 4-7
+     1: 2-3, 8-9
+     2: 1
+     3: 1
+     4: 0
+     5: 0
+     6: 0
+     7: 0
+     8: 1
+     9: 1
+     
+     black:
+     1: 4-7
+     2: 2-3, 8-9
+     3: 2
+     4: 1
+     5: 1
+     6: 1
+     7: 1 
+     8: 2
+  
+     grey:
+     0: 0-3,8-11
+     1: 0-1,10-11
+     2: 0,11
+     3: 0,9,11
+     4: 10
+     5: 10
+     6: 10
+     7 :10
+     8: 0,9,11
+     9: 0,3-4,8-9,11
+     10:0-1,4-7,10-11
+     11:0-3,8-11
+   */
+
+  int col = grx.theme().frame;
+  grx.hline(rx+0,ry+0,rx+3,col); grx.hline(rx+8,ry+0,rx+11,col);
+  grx.hline(rx+0,ry+1,rx+1,col); grx.hline(rx+10,ry+1,rx+11,col);
+  grx.putpixel(rx+0,ry+2,col); grx.putpixel(rx+11,ry+2,col);
+  grx.putpixel(rx+0,ry+3,col); grx.putpixel(rx+9,ry+3,col); grx.putpixel(rx+11,ry+3,col); 
+  grx.putpixel(rx+10,ry+4,col);
+  grx.putpixel(rx+10,ry+5,col);
+  grx.putpixel(rx+10,ry+6,col);
+  grx.putpixel(rx+10,ry+7,col);
+  grx.putpixel(rx+0,ry+8,col); grx.putpixel(rx+9,ry+8,col); grx.putpixel(rx+11,ry+8,col);
+  grx.putpixel(rx+0,ry+9,col); grx.putpixel(rx+11,ry+9,col); 
+  grx.hline(rx+2,ry+9,rx+3,col); grx.hline(rx+8,ry+9,rx+9,col); 
+  grx.hline(rx+0,ry+10,rx+1,col); grx.hline(rx+4,ry+10,rx+7,col);grx.hline(rx+10,ry+10,rx+11,col);
+  grx.hline(rx+0,ry+11,rx+3,col); grx.hline(rx+8,ry+11,rx+11,col);  
+  
+  col = grx.theme().frame_white;
+  grx.hline(rx+4,ry+2,rx+7,col); grx.putpixel(rx+10,ry+2,col);
+  grx.hline(rx+3,ry+3,rx+8,col); grx.putpixel(rx+10,ry+3,col);
+  grx.hline(rx+2,ry+4,rx+9,col); grx.putpixel(rx+11,ry+4,col);
+  grx.hline(rx+2,ry+5,rx+9,col); grx.putpixel(rx+11,ry+5,col);
+  grx.hline(rx+2,ry+6,rx+9,col); grx.putpixel(rx+11,ry+6,col);
+  grx.hline(rx+2,ry+7,rx+9,col); grx.putpixel(rx+11,ry+7,col);
+  grx.hline(rx+3,ry+8,rx+8,col); grx.putpixel(rx+10,ry+8,col);
+  grx.hline(rx+4,ry+9,rx+7,col); grx.putpixel(rx+10,ry+9,col);
+  grx.hline(rx+2,ry+10,rx+3,col); grx.hline(rx+8,ry+10,rx+9,col);
+  grx.hline(rx+4,ry+11,rx+7,col); 
+  
+  col = grx.theme().frame_low;
+  grx.hline(rx+4,ry+0,rx+7,col);
+  grx.hline(rx+2,ry+1,rx+3,col); grx.hline(rx+8,ry+1,rx+9,col);
+  grx.putpixel(rx+1,ry+2,col);
+  grx.putpixel(rx+1,ry+3,col);
+  grx.putpixel(rx+0,ry+4,col);
+  grx.putpixel(rx+0,ry+5,col);
+  grx.putpixel(rx+0,ry+6,col);
+  grx.putpixel(rx+0,ry+7,col);
+  grx.putpixel(rx+1,ry+8,col);
+  grx.putpixel(rx+1,ry+9,col);
+  
+  col = grx.theme().frame_black;
+  grx.hline(rx+4,ry+1,rx+7,col);
+  grx.hline(rx+2,ry+2,rx+3,col); grx.hline(rx+8,ry+2,rx+9,col);
+  grx.putpixel(rx+2,ry+3,col);
+  grx.putpixel(rx+1,ry+4,col);
+  grx.putpixel(rx+1,ry+5,col);
+  grx.putpixel(rx+1,ry+6,col);
+  grx.putpixel(rx+1,ry+7,col);
+  grx.putpixel(rx+2,ry+8,col);
+   
+/*   DOT:
+    
+     5: 5-6
+     6: 4-7
+     7: 4-7
+     8: 5-6
+*/  
+  
+  if (state)
+  {
+    grx.hline(rx+5,ry+4,rx+6,col);
+    grx.hline(rx+4,ry+5,rx+7,col);
+    grx.hline(rx+4,ry+6,rx+7,col);
+    grx.hline(rx+5,ry+7,rx+6,col);
+  }
+}
+
+static BITMAP* glyph_bitmap(BITMAP* glyphs, theme_glyph g)
+{
+  const glyph_rect& r = glyph_rects[g];
+  return create_sub_bitmap(glyphs, r.x, r.y, r.w, r.h);
+}
+
+ptheme::ptheme()
+{
+  for (int ft = 0; ft <= ft_none; ft++)
+  {
+    frame_skin none = { 0, 0, 0, 0, 0 };
+    skins[ft] = none;
+  }
+}
+
+void ptheme::set_skin(frame_type ft, BITMAP* bmp, coord_int l, coord_int t, coord_int r, coord_int b)
+{
+  frame_skin s = { bmp, l, t, r, b };
+  skins[ft] = s;
+}
+
+/* Bitmaps are made at the colour depth of the time, so a theme must be loaded
+ * again, as it is with its master, after the screen's depth changes. */
+void ptheme::load()
 {
   dither_pattern = create_bitmap(2,2);
+  glyphs = create_bitmap(72, 13);
   
-  up_arrow = create_bitmap(7, 4);
-  down_arrow = create_bitmap(7, 4);
-  left_arrow = create_bitmap(4, 7);
-  right_arrow = create_bitmap(4, 7);
+  up_arrow = glyph_bitmap(glyphs, tg_up_arrow);
+  down_arrow = glyph_bitmap(glyphs, tg_down_arrow);
+  left_arrow = glyph_bitmap(glyphs, tg_left_arrow);
+  right_arrow = glyph_bitmap(glyphs, tg_right_arrow);
   
   font = ::font;
 
@@ -781,6 +698,17 @@ void ptheme::load()  // Take into account colour-depth in constructor!
   putpixel(dither_pattern, 1, 0, frame);
   putpixel(dither_pattern, 1, 1, white);  
   
+  clear_to_color(glyphs, frame);
+  
+  {
+    graphics_context grx(glyphs, 0, 0, *this);
+    
+    draw_check_glyph(grx, glyph_rects[tg_check_off].x, 0, false);
+    draw_check_glyph(grx, glyph_rects[tg_check_on].x, 0, true);
+    draw_radio_glyph(grx, glyph_rects[tg_radio_off].x, 0, false);
+    draw_radio_glyph(grx, glyph_rects[tg_radio_on].x, 0, true);
+  }
+  
   hline(up_arrow, 0, 0, 2, frame); putpixel(up_arrow, 3, 0, frame_black); hline(up_arrow, 4, 0, 6, frame);
   hline(up_arrow, 0, 1, 1, frame); hline(up_arrow, 2, 1, 4, frame_black); hline(up_arrow, 5, 1, 6, frame);
   putpixel(up_arrow, 0, 2, frame); hline(up_arrow, 1, 2, 5, frame_black); putpixel(up_arrow, 6, 2, frame);
@@ -810,13 +738,16 @@ void ptheme::load()  // Take into account colour-depth in constructor!
 
 void ptheme::unload()
 {
+  text_run_cache::global().flush(); // Its runs were drawn in our colours
+  
   destroy_bitmap(dither_pattern);
   destroy_bitmap(left_arrow);
   destroy_bitmap(right_arrow);
   destroy_bitmap(up_arrow);
   destroy_bitmap(down_arrow);
+  destroy_bitmap(glyphs); // After the arrows, which are parts of it
   
-  left_arrow = right_arrow = up_arrow = down_arrow = 0;
+  left_arrow = right_arrow = up_arrow = down_arrow = glyphs = 0;
   dither_pattern = 0;
   font = 0;
   
@@ -826,11 +757,13 @@ void ptheme::unload()
 void graphics_context::set_mode_normal() const 
 { 
   drawing_mode(DRAW_MODE_SOLID, 0, 0, 0); 
+  dithered = false;
 }
 
 void graphics_context::set_mode_dither() const 
 { 
   drawing_mode(DRAW_MODE_COPY_PATTERN, t.dither_pattern, ox, oy); 
+  dithered = true;
 }
 
 void graphics_context::putpixel(int x, int y, int col) const 
@@ -915,12 +848,12 @@ void graphics_context::stretch_blit(BITMAP* src, int sx, int sy, int sw, int sh,
 
 int graphics_context::font_width(const std::string& s) const
 {
-  return text_length(t.font, s.c_str());
+  return font_metrics::of(t.font).width(s.c_str());
 }
 
 int graphics_context::font_height() const
 {
-  return text_height(t.font);
+  return font_metrics::of(t.font).get_height();
 }
 
 clipper::clipper(const graphics_context& c, coord_int _ax, coord_int _ay, coord_int _bx, coord_int _by)
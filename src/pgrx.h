@@ -2,17 +2,44 @@
 #define PGRX_H
 
 #include "pdefs.h"
+#include "ptext.h"
 #include <string>
 
 struct BITMAP;
 struct FONT;
 
+// Enum representing a type of frame to be drawn by 'draw_frame'
+enum frame_type
+{
+  ft_bevel_in,
+  ft_bevel_out,
+  ft_shallow_in,
+  ft_shallow_out,
+  ft_drop_in,
+  ft_drop_out,
+  ft_button_in,
+  ft_button_out,
+  ft_none
+}; 
+frame_type invert_frame(frame_type ft); // Returns the opposite of 'ft' (in/out)
+
+/* A frame drawn from a bitmap of the user's cut into nine: the four corners are
+ * blitted as they are, the four edges between them tiled along the frame, and
+ * the middle left alone, as it is by any frame. The insets give the widths of
+ * the edges. Frames without a skin are drawn with lines, as they always were. */
+struct frame_skin
+{
+  BITMAP* bmp;
+  coord_int l, t, r, b; // Left, top, right and bottom insets
+};
+
 // Used to provide a consistent set of colours, bitmaps, and patterns for widgets to use
 struct ptheme
 {
   FONT* font; // Basic font for text rendering
 
   BITMAP* dither_pattern; // Checker-board pattern for scrollbars
+  BITMAP* glyphs; // Every theme_glyph, drawn once when we load, at the screen's depth
   BITMAP* up_arrow; // Little black arrow pointing UP
   BITMAP* down_arrow; // Little black arrow pointing DOWN
   BITMAP* left_arrow; // Little black arrow pointing LEFT
@@ -32,24 +59,36 @@ struct ptheme
   int bar_inactive;  // Colour of top-level window-bar when deselected
   int bar_text;      // Colour of top-level window-bar's text
   
+  frame_skin skins[ft_none + 1]; // Frame types to be drawn from bitmaps of the user's
+  
+  /* Has frames of that type drawn from the bitmap, with the given insets, or
+     as we draw them ourselves again if it is 0. The bitmap must be of the
+     screen's colour depth, and is not ours to delete; it must outlive its use
+     by us, which lasts through any number of loads and unloads. */
+  void set_skin(frame_type ft, BITMAP* bmp, coord_int l =2, coord_int t =2, coord_int r =2, coord_int b =2);
+  
   void load();    // Allocates all resources
   void unload();  // De-allocates all resources
+  
+  ptheme();
 }; 
 
-// Enum representing a type of frame to be drawn by 'draw_frame'
-enum frame_type
+/* The little pictures widgets are made of, kept side by side in the theme's
+ * 'glyphs' bitmap, so that drawing one is a single blit rather than the dozens
+ * of lines and pixels it was drawn with. The arrows are also to be had as
+ * bitmaps of their own, which are sub-bitmaps of 'glyphs'. */
+enum theme_glyph
 {
-  ft_bevel_in,
-  ft_bevel_out,
-  ft_shallow_in,
-  ft_shallow_out,
-  ft_drop_in,
-  ft_drop_out,
-  ft_button_in,
-  ft_button_out,
-  ft_none
-}; 
-frame_type invert_frame(frame_type ft); // Returns the opposite of 'ft' (in/out)
+  tg_check_off,  // Check box, 13 by 13, with its bevel
+  tg_check_on,
+  tg_radio_off,  // Radio button, 12 by 12
+  tg_radio_on,
+  tg_up_arrow,   // 7 by 4
+  tg_down_arrow,
+  tg_left_arrow, // 4 by 7
+  tg_right_arrow,
+  tg_count
+};
 
 // Complex text functions
 int char_to_line(FONT* font, const std::string& str, const zone& z, int cpos, bool wrap =true);
@@ -76,6 +115,8 @@ class graphics_context
     const int cb;
     const int cl;
     
+    mutable bool dithered; // Set between 'set_mode_dither' and 'set_mode_normal'
+    
     // Returns a zone, changed by the current horizontal and vertical offsets
     zone real(const zone& z) const { return zone(z.ax+ox,z.ay+oy,z.bx+ox,z.by+oy); }
                
@@ -92,8 +133,10 @@ class graphics_context
     void clip(const zone* z) { clip(z->ax, z->ay, z->bx, z->by); }
           
     void draw_frame(coord_int ax, coord_int ay, coord_int bx, coord_int by, frame_type ft) const;
+    void draw_glyph(theme_glyph g, coord_int x, coord_int y) const; // With its top-left at (x, y)
     void render_backdrop(coord_int& x, coord_int& y, const zone& z, coord_int w, coord_int h, int col, compass_orientation a =c_centre, coord_int o =0) const;
     void render_multiline(const std::string& str, const zone& z, int bc, int cpos=-1, int line =0, bool wrap =true) const;
+    void render_multiline(const text_layout& lay, const zone& z, int bc, int cpos=-1, int line =0) const;
     void render_line(compass_orientation align, const char* str, const zone& z, int fc, int bc, int cpos =-1, coord_int ox=0, coord_int oy =0) const;
 
     void putpixel(int x, int y, int col) const;
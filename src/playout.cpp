@@ -13,20 +13,43 @@ layout_info* layout_manager::get_first_layinfo() const
 }
 
 /* This function attempts to pack the layout manager. If a packing session is
- * already underway (and we have been recursed to by 'suggest_size'), then 
- * make sure we pack twice and quite. If not, start packing, and only stop
- * when the 'suggests' have run out */
+ * already underway (and we have been recursed to by a resize), then make sure
+ * we pack twice and quit. If not, the measure pass is run first, so that every
+ * conserving child has its ideal size ready, and then the arrange pass. */
 void layout_manager::pack_layout()
 {
   if (!packing)
   {
     packing = true;
+    
+    measure_children();
+
+    // If we conserve, our own size follows our measurement. If our container is
+    // laid out, its parent's manager must place it again at the new size
+    if (conserve)
+    {
+      if (container->is_laid_out())
+      {
+        if (update_ideal()) container->get_layinfo()->pack();
+      } else
+      {
+        coord_int w, h;
+        get_measure(w, h);
+        if ((w != -1 && w != container->e_w()) || (h != -1 && h != container->e_h())) 
+          suggest_size(w, h);
+      }
+    }
+    
     do
     {
       repack = false;
       pack();
     } while (repack);
     
+    arranged = true;
+    queued = false; // Whatever was queued has now been done
+    arranged_w = container->e_w();
+    arranged_h = container->e_h();
     packing = false;
     
   } else
@@ -59,6 +82,72 @@ void layout_manager::suggest_size(coord_int w, coord_int h)
   }
 }
 
+void layout_manager::get_measure(coord_int& w, coord_int& h)
+{
+  if (!measured || measured_for != container->e_w())
+  {
+    measure_children(); // Our children's sizes must be known before our own
+    measure(measured_w, measured_h);
+    measured = true;
+    measured_for = container->e_w();
+  }
+  
+  w = measured_w;
+  h = measured_h;
+}
+
+/* This is the measure pass. Children whose managers conserve have their ideal
+ * sizes brought up to date, which recurses down through their own children via
+ * 'get_measure'. Managers whose measurements are still valid stop it there. */
+void layout_manager::measure_children()
+{
+  for (layout_info* loop = get_first_layinfo(); loop; loop = loop->get_next())
+  {
+    layout_manager* l = loop->master->get_layout();
+    if (l && l->conserve) l->update_ideal();
+  }
+}
+
+/* Works out the size our container needs to give its children their measured
+ * estate, and makes it the ideal size of its layout_info. This doesn't repack 
+ * anything; returns true if the ideal size has changed. */
+bool layout_manager::update_ideal()
+{
+  layout_info* li = container->get_layinfo();
+  if (!li) return false;
+  
+  coord_int w, h;
+  get_measure(w, h);
+  
+  if (w == -1) w = container->e_w();
+  if (h == -1) h = container->e_h();
+    
+  w += (container->e_ax() + (container->w() - container->e_bx()));
+  h += (container->e_ay() + (container->h() - container->e_by()));
+
+  if (w == li->ideal_w && h == li->ideal_h) return false;
+  
+  li->ideal_w = w;
+  li->ideal_h = h;
+  return true;
+}
+
+layout_manager* layout_manager::invalidate()
+{
+  measured = false;
+  arranged = false;
+  
+  if (conserve && container->is_laid_out()) 
+    return container->get_parent()->get_layout()->invalidate();
+  
+  return this;
+}
+
+bool layout_manager::is_arranged() const
+{
+  return arranged && arranged_w == container->e_w() && arranged_h == container->e_h();
+}
+
 // Find the next layout info object belonging to our master's next windows
 layout_info* layout_info::get_next() const
 { 
@@ -68,9 +157,13 @@ layout_info* layout_info::get_next() const
   return 0;
 }
 
-void layout_info::pack() const // Repack our master's sibling list if necessary
+/* Something about us has changed, so our parent's manager (and any conserving
+ * managers above it) can no longer trust their measurements. Only the outermost
+ * of these is repacked; the others are reached by its arrange pass. */
+void layout_info::pack() const
 { 
-  if (master && master->parent) master->parent->pack(); 
+  if (master && master->parent && master->parent->get_layout()) 
+    master->parent->get_layout()->invalidate()->get_container()->pack(); 
 }  
 
 void layout_manager::set_container(base_window* c)
@@ -147,15 +240,24 @@ void layout_info::consume(const zone& area) const
     case c_south_east: ax = z.bx - w;   ay = z.by;       break;
   }
                                 
-  if (w <= 0 || h <= 0) // If we are too small, hide ourselves by setting extreme co-ordinates
+  hidden = (w <= 0 || h <= 0);
+  
+  if (hidden) // If we are too small, hide ourselves by setting extreme co-ordinates
   {
-    master->move_resize(-32768, -32768, -32768, -32768);
-    hidden = true;
-  } else
+    ax = ay = coord_int_min;
+    w = h = 0;
+  } 
+  
+  // If our master is already in place, it only needs to be touched if its own
+  // children need arranging
+  if (ax == master->ax && ay == master->ay && ax + w == master->bx && ay + h == master->by &&
+      !master->flag(base_window::sys_always_resize))
   {
-    master->move_resize(ax, ay, ax + w, ay + h); // Place our master at this new position
-    hidden = false;
+    if (master->get_layout() && !master->get_layout()->is_arranged()) master->pack();
+    return;
   }
+  
+  master->move_resize(ax, ay, ax + w, ay + h); // Place our master at this new position
 }
 
 /* Left->right packing algorithm. If it is supposed to make sure that all objects
@@ -219,56 +321,157 @@ void flow_layout::pack()
     chunk_stack.top().first->consume(pos);      
     chunk_stack.pop();
   }
-      
-  suggest_size(-1, y + max_y + y_margin);
 }
 
-void grid_layout::pack()
-{                                       
-  int w = grid_w, h = grid_h;
-       
-  if (!grid_w || !grid_h)    
-    for (layout_info* loop = get_first_layinfo(); loop; loop = loop->get_next())
+// Follows the same rows as 'pack' to find the height they take up
+void flow_layout::measure(coord_int& w, coord_int& h)
+{
+  coord_int x = x_margin, y = y_margin, max_y = 0;
+  coord_int c_w = container->e_w();
+  bool skip_row = false;
+  
+  for (layout_info* loop = get_first_layinfo(); loop; loop = loop->get_next())
+  {
+    coord_int pref_w = loop->get_w();
+    coord_int pref_h = loop->get_h();
+  
+    if ((skip_row || (x + pref_w > (c_w - x_margin))) && max_y)
     {
-      if (grid_info* gi = dynamic_cast<grid_info*>(loop))
-      {
-        if (!grid_w && gi->x_index+gi->x_extend > w) w = gi->x_index+gi->x_extend;
-        if (!grid_h && gi->y_index+gi->y_extend > h) h = gi->y_index+gi->y_extend;
-      }
+      x = x_margin;
+      y += max_y + 1 + y_margin;
+      max_y = 0;
     }
     
-  // Amount of space wasted for margins:
-  coord_int x_margin_total = (w + 1) * x_margin; 
-  coord_int y_margin_total = (h + 1) * y_margin;
-        
-  // Width and height of each cell:
-  float cell_w = float(container->e_w() - x_margin_total) / w;
-  float cell_h = float(container->e_h() - y_margin_total) / h;
+    x += pref_w + 1 + x_margin;
+    if (pref_h > max_y) max_y = pref_h;
+    
+    skip_row = loop->get_expand_w();
+  }
+  
+  w = -1; // We fill whatever width we are given
+  h = y + max_y + y_margin;
+}
 
-  // Loop through all layout-info objects
+/* Counts the columns and rows, if we weren't told them, and finds the largest
+ * window that occupies just one cell in each of them. */
+void grid_layout::gather()
+{
+  col_content.assign(PMIN(grid_w, int(columns.size())), 0);
+  row_content.assign(PMIN(grid_h, int(rows.size())), 0);
+  
   for (layout_info* loop = get_first_layinfo(); loop; loop = loop->get_next())
   {
-    if (grid_info* gi = dynamic_cast<grid_info*>(loop)) // If its a grid-info object
+    if (loop->get_type() != lit_grid) continue;
+    grid_info* gi = static_cast<grid_info*>(loop);
+    
+    int x_end = gi->x_index + gi->x_extend, y_end = gi->y_index + gi->y_extend;
+    if (!grid_w && x_end > int(col_content.size())) col_content.resize(x_end, 0);
+    if (!grid_h && y_end > int(row_content.size())) row_content.resize(y_end, 0);
+    
+    if (gi->x_extend == 1 && gi->x_index >= 0 && gi->x_index < int(col_content.size()))
+      col_content[gi->x_index] = PMIN(col_content[gi->x_index], gi->get_w());
+    if (gi->y_extend == 1 && gi->y_index >= 0 && gi->y_index < int(row_content.size()))
+      row_content[gi->y_index] = PMIN(row_content[gi->y_index], gi->get_h());
+  }
+}
+
+void grid_layout::solve(std::vector<coord_int>& offsets, const std::vector<grid_track>& tracks,
+                        const std::vector<coord_int>& content, coord_int space, coord_int margin, 
+                        bool natural) const
+{
+  int n = content.size();
+  offsets.resize(n + 1);
+  
+  // The size of each track goes in the entry after its own, to be turned into
+  // an offset at the end
+  coord_int spare = space - (n + 1) * margin;
+  long weights = 0;
+  for (int i = 0; i < n; i++)
+  {
+    grid_track t = (i < int(tracks.size())) ? tracks[i] : grid_track();
+    coord_int size = 0;
+    
+    if (t.type == track_fixed) size = t.size;
+    else if (t.type == track_auto || natural) size = content[i];
+    else weights += t.size;
+    
+    offsets[i + 1] = size;
+    spare -= size;
+  }
+  
+  // Share out what is left amongst the fractions, the last one getting any 
+  // pixels lost to rounding
+  if (weights && spare > 0)
+  {
+    coord_int given = 0;
+    int last = -1;
+    for (int i = 0; i < n; i++)
     {
-      int x_pos = gi->x_index+1; // Column position
-      int y_pos = gi->y_index+1; // Row position
-      int x_ext = gi->x_extend; // Number of columns
-      int y_ext = gi->y_extend; // Number of rows
+      if (i < int(tracks.size()) && tracks[i].type != track_fraction) continue;
+      coord_int weight = (i < int(tracks.size())) ? tracks[i].size : 1;
+      
+      offsets[i + 1] = coord_int(long(spare) * weight / weights);
+      given += offsets[i + 1];
+      last = i;
+    }
+    if (last >= 0) offsets[last + 1] += spare - given;
+  }
+  
+  offsets[0] = margin;
+  for (int i = 0; i < n; i++) offsets[i + 1] += offsets[i] + margin;
+}
+
+void grid_layout::set_column(int i, const grid_track& t)
+{
+  if (i >= int(columns.size())) columns.resize(i + 1);
+  columns[i] = t;
+  if (container) invalidate()->get_container()->pack();
+}
 
-      // Stop it from going out-of-bounds
-      if (x_pos < 0) x_pos = 0; else if (x_pos + x_ext > w + 1) x_pos = w + 1 - (x_pos + x_ext);
-      if (y_pos < 0) y_pos = 0; else if (y_pos + y_ext > h + 1) y_pos = h + 1 - (y_pos + y_ext);
+void grid_layout::set_row(int i, const grid_track& t)
+{
+  if (i >= int(rows.size())) rows.resize(i + 1);
+  rows[i] = t;
+  if (container) invalidate()->get_container()->pack();
+}
+
+// The grid would like every track at its natural size
+void grid_layout::measure(coord_int& w, coord_int& h)
+{
+  gather();
+  solve(col_offsets, columns, col_content, 0, x_margin, true);
+  solve(row_offsets, rows, row_content, 0, y_margin, true);
   
-      // Calculate the actual x and y   
-      float x = (x_pos * x_margin) + ((x_pos - 1) * cell_w);
-      float y = (y_pos * y_margin) + ((y_pos - 1) * cell_h);
+  w = col_offsets.back();
+  h = row_offsets.back();
+}
+
+void grid_layout::pack()
+{                                       
+  gather();
   
-      // Calculate the width and height in pixels for this window
-      float total_w = (x_ext * cell_w) + ((x_ext - 1) * x_margin);
-      float total_h = (y_ext * cell_h) + ((y_ext - 1) * y_margin);
+  int w = col_content.size(), h = row_content.size();
+  if (!w || !h) return;
   
-      gi->consume(zone(x,y,x+total_w,y+total_h)); // Assign it the space
-    }
+  solve(col_offsets, columns, col_content, container->e_w(), x_margin, false);
+  solve(row_offsets, rows, row_content, container->e_h(), y_margin, false);
+
+  // Loop through all layout-info objects
+  for (layout_info* loop = get_first_layinfo(); loop; loop = loop->get_next())
+  {
+    if (loop->get_type() != lit_grid) continue;
+    grid_info* gi = static_cast<grid_info*>(loop);
+    
+    // Stop it from going out-of-bounds
+    int x_pos = PMIN(0, PMAX(gi->x_index, w - 1)); // First column
+    int y_pos = PMIN(0, PMAX(gi->y_index, h - 1)); // First row
+    int x_end = PMAX(x_pos + PMIN(1, gi->x_extend), w); // One past the last column
+    int y_end = PMAX(y_pos + PMIN(1, gi->y_extend), h); // One past the last row
+    
+    // The window spans from the leading edge of its first track to the trailing
+    // edge of its last, which is one margin short of the next track
+    gi->consume(zone(col_offsets[x_pos], row_offsets[y_pos], 
+                     col_offsets[x_end] - x_margin, row_offsets[y_end] - y_margin));
   }
 }
 
@@ -282,8 +485,9 @@ void compass_layout::pack()
 
   for (layout_info* loop = get_first_layinfo(); loop; loop = loop->get_next())
   {
-    if (compass_info* ci = dynamic_cast<compass_info*>(loop))
+    if (loop->get_type() == lit_compass)
     {
+      compass_info* ci = static_cast<compass_info*>(loop);
       coord_int w = ci->get_w(), h = ci->get_h();     
       switch (ci->pos)
       {
@@ -356,8 +560,9 @@ void gobbler_layout::pack()
   // Loop through all the layout-info objects
   for (layout_info* loop = get_first_layinfo(); loop; loop = loop->get_next())
   {
-    if (gobbler_info* gi = dynamic_cast<gobbler_info*>(loop))
+    if (loop->get_type() == lit_gobbler)
     {
+      gobbler_info* gi = static_cast<gobbler_info*>(loop);
       float bias = gi->get_bias();
       coord_int bw, bh; 
       
@@ -397,3 +602,176 @@ void gobbler_layout::pack()
   }
 }
 
+/* Gathers a flex_item for each window with a flex_info, at its basis size, and
+ * splits them into rows: 'rows' gets the index of the first item in each. */
+void flex_layout::collect(std::vector<flex_item>& items, std::vector<int>& rows, coord_int space) const
+{
+  coord_int used = 0;
+  
+  for (layout_info* loop = get_first_layinfo(); loop; loop = loop->get_next())
+  {
+    if (loop->get_type() == lit_flex)
+    {
+      flex_info* fi = static_cast<flex_info*>(loop);
+      flex_item item;
+      item.info = fi;
+      item.frozen = false;
+      
+      if (fi->basis >= 0) item.main = fi->basis + (vertical ? fi->get_pad_h() : fi->get_pad_w()) * 2;
+      else item.main = vertical ? fi->get_h() : fi->get_w();
+      item.cross = vertical ? fi->get_w() : fi->get_h();
+      
+      item.main = limit(fi, item.main);
+      
+      // Start a new row if this one is full (but never leave a row empty)
+      if (items.empty() || (wrap && used + main_gap() + item.main > space))
+      {
+        rows.push_back(items.size());
+        used = item.main;
+      } else
+      {
+        used += main_gap() + item.main;
+      }
+      
+      items.push_back(item);
+    }
+  }
+}
+
+coord_int flex_layout::limit(const flex_info* fi, coord_int main) const
+{
+  coord_int pad = (vertical ? fi->get_pad_h() : fi->get_pad_w()) * 2;
+  coord_int size = main - pad;
+  
+  if (size < fi->min) size = fi->min;
+  if (size > fi->max) size = fi->max;
+  
+  return size + pad;
+}
+
+/* Shares are rounded down, and whatever that leaves over goes to the last
+ * window taking a share, as with the tracks of a grid_layout, so that the row
+ * is always filled exactly. */
+void flex_layout::solve_row(std::vector<flex_item>& items, int first, int last, coord_int space) const
+{
+  coord_int free = space - main_gap() * (last - first - 1);
+  for (int i = first; i < last; i++) free -= items[i].main;
+  
+  // Each pass after the first shares out whatever newly frozen windows couldn't
+  // take; a pass that freezes nobody leaves nothing over, as the taker gets it all
+  while (free)
+  {
+    float total = 0;
+    int taker = -1; // The last window to take a share
+    for (int i = first; i < last; i++)
+    {
+      if (items[i].frozen) continue;
+      
+      float weight = (free > 0) ? items[i].info->grow : items[i].info->shrink * items[i].main;
+      total += weight;
+      if (weight > 0) taker = i;
+    }
+    
+    if (total <= 0) break;
+    
+    coord_int left = free, handed = 0;
+    for (int i = first; i < last; i++)
+    {
+      flex_item& item = items[i];
+      if (item.frozen) continue;
+      
+      float weight = (free > 0) ? item.info->grow : item.info->shrink * item.main;
+      coord_int share = (i == taker) ? free - handed : coord_int(free * weight / total);
+      handed += share;
+      
+      coord_int want = item.main + share;
+      coord_int got = limit(item.info, want);
+      
+      if (got < 0) got = 0;
+      if (got != want) item.frozen = true;
+      
+      left -= got - item.main;
+      item.main = got;
+    }
+    
+    free = left;
+  }
+}
+
+void flex_layout::pack()
+{
+  coord_int space_main = (vertical ? container->e_h() : container->e_w()) - main_gap() * 2;
+  coord_int space_cross = (vertical ? container->e_w() : container->e_h()) - cross_gap() * 2;
+  
+  std::vector<flex_item> items;
+  std::vector<int> rows;
+  collect(items, rows, space_main);
+  
+  coord_int cross_pos = cross_gap();
+  for (std::vector<int>::size_type r = 0; r < rows.size(); r++)
+  {
+    int first = rows[r];
+    int last = (r + 1 < rows.size()) ? rows[r + 1] : items.size();
+    
+    solve_row(items, first, last, space_main);
+    
+    // A single unwrapped row has the whole container to itself
+    coord_int line = 0;
+    if (!wrap && rows.size() == 1) line = space_cross;
+    else for (int i = first; i < last; i++) if (items[i].cross > line) line = items[i].cross;
+    
+    coord_int main_pos = main_gap();
+    for (int i = first; i < last; i++)
+    {
+      flex_item& item = items[i];
+      coord_int size = PMAX(item.cross, line), offset = 0;
+      
+      switch (item.info->cross_align)
+      {
+        case flex_start:   break;
+        case flex_centre:  offset = (line - size) / 2; break;
+        case flex_end:     offset = line - size; break;
+        case flex_stretch: size = line; break;
+      }
+      
+      if (vertical)
+        item.info->consume(zone(cross_pos + offset, main_pos, cross_pos + offset + size, main_pos + item.main));
+      else 
+        item.info->consume(zone(main_pos, cross_pos + offset, main_pos + item.main, cross_pos + offset + size));
+      
+      main_pos += item.main + main_gap();
+    }
+    
+    cross_pos += line + cross_gap();
+  }
+}
+
+// Without wrapping, the row wants every window at its basis; with it, we fill
+// whatever we are given along the row, and want enough rows to hold them all
+void flex_layout::measure(coord_int& w, coord_int& h)
+{
+  coord_int space_main = (vertical ? container->e_h() : container->e_w()) - main_gap() * 2;
+  
+  std::vector<flex_item> items;
+  std::vector<int> rows;
+  collect(items, rows, space_main);
+  
+  coord_int main = -1, cross = cross_gap();
+  if (!wrap)
+  {
+    main = main_gap();
+    for (std::vector<flex_item>::size_type i = 0; i < items.size(); i++) main += items[i].main + main_gap();
+  }
+  
+  for (std::vector<int>::size_type r = 0; r < rows.size(); r++)
+  {
+    int last = (r + 1 < rows.size()) ? rows[r + 1] : items.size();
+    
+    coord_int line = 0;
+    for (int i = rows[r]; i < last; i++) if (items[i].cross > line) line = items[i].cross;
+    cross += line + cross_gap();
+  }
+  
+  if (vertical) { w = cross; h = main; }
+  else { w = main; h = cross; }
+}
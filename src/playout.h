@@ -3,16 +3,26 @@
 
 #include "pdefs.h"
 
+#include <vector>
+
 // Forward declarations:
 class base_window;
 class flow_layout;
 class layout_info;
+class flex_info;
    
 /* The layout_manager class can be inherited to provide different mechanisms
  * for placing a window's children on its surface. To do this, the layout-
  * manager is 'attached' to a particular window using 'set_layout'. The 
  * layout-manager will then recalculate the window's children whenever 
  * the window is resized. 
+ *
+ * Packing happens in two passes. The measure pass works bottom-up, asking each
+ * conserving manager how big its container would like to be, and storing that
+ * as the container's ideal size. The arrange pass ('pack') then works top-down,
+ * handing each child its area. Measurements are cached, and only thrown away by
+ * 'invalidate' when a child's ideal size or layout properties change, so that
+ * subtrees which haven't changed are neither measured nor arranged again.
  */ 
 class layout_manager
 {
@@ -21,6 +31,9 @@ class layout_manager
     bool packing;   // TRUE when this manager is currently being packed (allows for re-entrancy)
     bool repack;    // TRUE when this manager should repack itself again 
     bool conserve;  // TRUE if this manager should try to resize itself to accomodate its children
+    bool measured;  // TRUE while 'measured_w' and 'measured_h' are up to date
+    bool arranged;  // TRUE if our children have been placed since the last change
+    bool queued;    // TRUE while our container waits in the window_manager's pack queue
     
     base_window* container; // The window whose children we are managing
     
@@ -29,14 +42,28 @@ class layout_manager
     coord_int x_margin; // Gap between each object horizontally. 
     coord_int y_margin; // Gap between each object vertically.
 
+    coord_int measured_w;   // The cached result of 'measure'
+    coord_int measured_h;
+    coord_int measured_for; // The container's estate width when we were measured
+    coord_int arranged_w;   // The container's estate size when we were last arranged
+    coord_int arranged_h;
+
     // Override this to place all children according to whatever algorithm...
     virtual void pack() { }
     
+    // Override this to give the estate size the children would like, given the
+    // container's current estate width. Either can be -1 for "no preference".
+    virtual void measure(coord_int& w, coord_int& h) { w = -1; h = -1; }
+    
+    void measure_children(); // The measure pass for every conserving child manager
+    bool update_ideal();     // Sets our container's ideal size to our measurement
+    
   public:
   
     layout_manager(coord_int x, coord_int y) 
     : container(0), x_margin(x), y_margin(y), conserve(false), repack(false),
-      packing(false)
+      packing(false), measured(false), arranged(false), queued(false), measured_w(-1), 
+      measured_h(-1), measured_for(0), arranged_w(0), arranged_h(0)
     { }
     
     void set_conserve(bool c) { conserve = c; }
@@ -44,11 +71,25 @@ class layout_manager
     void suggest_size(coord_int w, coord_int h);
     
     void set_container(base_window* c); // Associate the given window as our manager
+    base_window* get_container() const { return container; }
   
     void pack_layout();
+    
+    // Returns our (cached) measurement, as described for 'measure' above
+    void get_measure(coord_int& w, coord_int& h);
+    
+    // Throws away our measurement. If we conserve, our container's size depends
+    // on it, so its own manager is invalidated too: the outermost manager that
+    // was affected is returned, and is the one that should be repacked.
+    layout_manager* invalidate();
+    
+    // Returns true if nothing has changed since our children were last placed
+    bool is_arranged() const;
   
     // Returns the first layout_info amongst our container's children.
     layout_info* get_first_layinfo() const;
+    
+    friend class window_manager;
 };
 
 /* Classes derived from 'layout_info' can be associated with a particular window
@@ -71,6 +112,17 @@ enum li_expand_type // Shortcut for supplying 2 bools
   li_expand_both = 3 // Because 1+2 = 3 means we can mask for these enums
 };    
 
+// Each kind of layout_info sets one of these, so that managers can find their
+// own kind with a 'get_type' check and a static_cast instead of RTTI.
+enum layout_info_type
+{
+  lit_basic,
+  lit_grid,
+  lit_compass,
+  lit_gobbler,
+  lit_flex
+};
+
 class layout_info
 {
   public:
@@ -78,7 +130,7 @@ class layout_info
     layout_info(li_expand_type e=li_expand_none, compass_orientation c=c_centre,
                 coord_int pw=0, coord_int ph=0)
     : master(0), ideal_w(0), ideal_h(0), pad_w(pw), pad_h(ph), 
-      expand_x(e & li_expand_w), expand_y(e & li_expand_h), align(c)
+      expand_x(e & li_expand_w), expand_y(e & li_expand_h), align(c), type(lit_basic)
     { }
   
     void set_master(base_window* m); // Associate this info object with a window
@@ -96,7 +148,7 @@ class layout_info
     // Function to place our master in the given area using expand/ideal rules
     void consume(const zone& area) const; 
     
-    void pack() const; // Repack our master's sibling list if necessary
+    void pack() const; // Invalidate and repack our master's sibling list if necessary
   
     // Member access functions:
     coord_int get_ideal_w() const { return ideal_w; }
@@ -106,6 +158,7 @@ class layout_info
     bool get_expand_w() const { return expand_x; }
     bool get_expand_h() const { return expand_y; }
     compass_orientation get_align() const { return align; }
+    layout_info_type get_type() const { return type; }
     
     coord_int get_w() const { return ideal_w + pad_w + pad_w; }
     coord_int get_h() const { return ideal_h + pad_h + pad_h; }
@@ -128,6 +181,10 @@ class layout_info
     mutable bool hidden; // Set to true if the window is hidden due to lack of space 
     // If we use less space than we are given, this is how we fit within it:
     compass_orientation align; 
+    
+  protected:
+  
+    layout_info_type type; // Set by derived classes to say which they are
 };
 
 /* This class implements an algorithm where windows are placed from left to
@@ -140,6 +197,7 @@ class flow_layout : public layout_manager
   public:
 
     void pack(); // Custom pack algorithm implemented here
+    void measure(coord_int& w, coord_int& h);
 
     flow_layout(coord_int x =2, coord_int y =2, bool f=false, bool c=false)
     : layout_manager(x, y), fill(f), centre(c)
@@ -151,16 +209,46 @@ class flow_layout : public layout_manager
     bool centre;
 };
 
+/* Each row and column of a grid is a 'track', which can be a fixed number of
+ * pixels, sized to fit the largest window in it (auto), or given a share of
+ * whatever space is left once the others have been sized (fraction). For a
+ * fraction track, 'size' is its weight in that share.
+ */
+enum grid_track_type
+{
+  track_fixed,
+  track_auto,
+  track_fraction
+};
+
+struct grid_track
+{
+  grid_track_type type;
+  coord_int size; // Pixels for a fixed track, weight for a fraction track
+  
+  grid_track(grid_track_type t =track_fraction, coord_int s =1) : type(t), size(s) { }
+};
+
 /* Grid-layout uses a system where the container's surface is divided up into
  * a series of 'cells'. The grid_layout class is told the number of cells it
  * should calculate, vertically and horizontally, and then can assign a window
  * to any of these cells through a custom layout-info object called 'grid_info'. 
+ * Unless told otherwise with 'set_column' and 'set_row', every track is an 
+ * equal fraction, so all the cells are the same size.
+ *
+ * The tracks are sized once per pack, into arrays holding the offset of each
+ * track's edge, so placing a window is just a matter of looking up its first 
+ * and last tracks.
  */
 class grid_layout : public layout_manager
 {
   public:
 
     void pack(); // Custom pack algorithm implemented here
+    void measure(coord_int& w, coord_int& h);
+    
+    void set_column(int i, const grid_track& t); // Changes the given track, and repacks
+    void set_row(int i, const grid_track& t);
 
     grid_layout(coord_int w =0, coord_int h =0, coord_int gw =2, coord_int gh =2)
     : layout_manager(gw, gh), grid_w(w), grid_h(h)
@@ -170,6 +258,22 @@ class grid_layout : public layout_manager
 
     int grid_w; // The number of cells across
     int grid_h; // The number of cells down
+    
+    std::vector<grid_track> columns; // Tracks that have been set, the rest
+    std::vector<grid_track> rows;    // are single fractions
+    
+    std::vector<coord_int> col_content; // Largest window in each track, for 
+    std::vector<coord_int> row_content; // the auto tracks and for measuring
+    std::vector<coord_int> col_offsets; // Offset of each track's leading edge, with
+    std::vector<coord_int> row_offsets; // one extra entry for the end of the last
+    
+    void gather(); // Counts the tracks, and fills in the content sizes
+    
+    // Sizes the tracks for the given space, leaving fractions at their content
+    // size if 'natural'
+    void solve(std::vector<coord_int>& offsets, const std::vector<grid_track>& tracks,
+               const std::vector<coord_int>& content, coord_int space, coord_int margin, 
+               bool natural) const;
 };
 
 class grid_info : public layout_info // Used in conjunction with grid_layout
@@ -189,7 +293,7 @@ class grid_info : public layout_info // Used in conjunction with grid_layout
               li_expand_type e=li_expand_both, compass_orientation c=c_centre,
               coord_int pw=1, coord_int ph=1)
     : layout_info(e, c, pw, ph), x_index(x), y_index(y), x_extend(xe), y_extend(ye)
-    { }
+    { type = lit_grid; }
     
     friend class grid_layout;
 };
@@ -217,7 +321,7 @@ class compass_info : public layout_info
     compass_info(compass_orientation p, li_expand_type e=li_expand_both, 
                  compass_orientation c=c_centre, coord_int pw=1, coord_int ph=1)
     : layout_info(e, c, pw, ph), pos(p)
-    { }
+    { type = lit_compass; }
     
     friend class compass_layout;
     
@@ -242,7 +346,7 @@ class gobbler_info : public layout_info
     gobbler_info(compass_direction d, float b, li_expand_type e=li_expand_both, 
                  compass_orientation c=c_centre, coord_int pw=1, coord_int ph=1)
     : layout_info(e, c, pw, ph), bias(b), dir(d)
-    { }
+    { type = lit_gobbler; }
     
     float get_bias() { return bias; }
     compass_direction get_dir() { return dir; }
@@ -252,5 +356,103 @@ class gobbler_info : public layout_info
     float bias;
     compass_direction dir;
 };
+
+/* Flex-layout places windows in a row (or a column, if 'vertical'), one after
+ * the other along the 'main' axis. Each window starts from its 'basis' size 
+ * along that axis, and then any space left over in the row is shared out
+ * between them in proportion to their 'grow' factors, or, if there wasn't
+ * enough space, taken from them in proportion to their 'shrink' factors times
+ * their basis. Nobody is made smaller than their 'min' or larger than their
+ * 'max'. If 'wrap' is set, windows that don't fit begin a new row. 
+ *
+ * Across the row, the 'cross' axis, each window is aligned according to its
+ * flex_info, the row being as tall as its tallest window (or as the whole
+ * container, if there is only one row and no wrapping).
+ *
+ * The solver shares the space out, and then whatever was left by windows that
+ * hit their limits amongst the rest, and so on until none do. Every pass but
+ * the last leaves another window at its limit, so a row of n windows takes at
+ * most n + 1 passes, and usually just one or two. */
+enum flex_align
+{
+  flex_start,   // Top (or left) of the row
+  flex_centre,
+  flex_end,     // Bottom (or right) of the row
+  flex_stretch  // Fill the whole height (or width) of the row
+};
+
+class flex_layout : public layout_manager
+{
+  public:
+  
+    void pack();
+    void measure(coord_int& w, coord_int& h);
+    
+    flex_layout(bool v =false, bool w =false, coord_int x =2, coord_int y =2)
+    : layout_manager(x, y), vertical(v), wrap(w)
+    { }
+    
+  private:
+  
+    bool vertical; // Place windows from top to bottom, rather than left to right
+    bool wrap;     // Start a new row when the current one is full
+    
+    struct flex_item // Working space for one window while we solve a row
+    {
+      flex_info* info;
+      coord_int main;  // Size along the row 
+      coord_int cross; // Size across the row
+      bool frozen;     // Set once the window has reached its min or max
+    };
+    
+    // Shares the free space of a row between items [first, last)
+    void solve_row(std::vector<flex_item>& items, int first, int last, coord_int space) const;
+    
+    // Keeps a size along the row within the window's min and max, which like
+    // its basis leave out its padding
+    coord_int limit(const flex_info* fi, coord_int main) const;
+    
+    // Gathers the items, and splits them into rows, noting where each one starts
+    void collect(std::vector<flex_item>& items, std::vector<int>& rows, coord_int space) const;
+    
+    coord_int main_gap() const { return vertical ? y_margin : x_margin; }
+    coord_int cross_gap() const { return vertical ? x_margin : y_margin; }
+};
+
+class flex_info : public layout_info
+{
+  public:
+  
+    flex_info(float g =0, float s =1, coord_int b =-1, flex_align a =flex_stretch,
+              coord_int mn =0, coord_int mx =coord_int_max, coord_int pw =0, coord_int ph =0)
+    : layout_info(li_expand_both, c_centre, pw, ph), grow(g), shrink(s), basis(b), 
+      min(mn), max(mx), cross_align(a)
+    { type = lit_flex; }
+    
+    // Member functions to set flex properties, repacking the tree if required
+    void set_grow(float g) { grow = g; pack(); }
+    void set_shrink(float s) { shrink = s; pack(); }
+    void set_basis(coord_int b =-1) { basis = b; pack(); }
+    void set_limits(coord_int mn =0, coord_int mx =coord_int_max) { min = mn; max = mx; pack(); }
+    void set_cross_align(flex_align a) { cross_align = a; pack(); }
+    
+    float get_grow() const { return grow; }
+    float get_shrink() const { return shrink; }
+    coord_int get_basis() const { return basis; }
+    coord_int get_min() const { return min; }
+    coord_int get_max() const { return max; }
+    flex_align get_cross_align() const { return cross_align; }
+    
+    friend class flex_layout;
+    
+  private:
+  
+    float grow;       // Share of any spare space this window takes
+    float shrink;     // Share of any missing space this window gives up (times its basis)
+    coord_int basis;  // Starting size along the row, or -1 to use the ideal size
+    coord_int min;    // Limits on the size along the row
+    coord_int max;
+    flex_align cross_align; // How the window sits across the row
+};
     
 #endif LAYOUT_HPP
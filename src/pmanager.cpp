@@ -2,6 +2,9 @@
 #include "psublim.h"
 #include "allegro.h"
 #include "pconsole.h"
+#include "playout.h"
+
+#include <algorithm> // For sorting the pack queue
 
 #define REPEAT_DELAY 200
 #define REPEAT_RATE  40
@@ -126,16 +129,25 @@ void window_manager::do_gui(base_window& iow, bool (*func)(window_manager&))
   io_win->remove();
 }
 
-void window_manager::purge(base_window* win)
+// Forgets any references we hold to the windows of a family that is leaving
+void window_manager::purge(base_window* family)
 {
-  if (gloop == win) gloop = 0;
-  if (o_target == win) o_target = 0;
-  if (keyfocus == win) keyfocus = 0;
-  if (target == win) target = 0;
-  if (drag_target == win) drag_target = 0;
+  for (pre_order_iterator i(family); *i; ++i)
+  {
+    base_window* win = *i;
+
+    if (gloop == win) gloop = 0;
+    if (o_target == win) o_target = 0;
+    if (keyfocus == win) keyfocus = 0;
+    if (target == win) target = 0;
+    if (drag_target == win) drag_target = 0;
   
-  for (base_window* loop = win->get_child(); loop; loop = loop->next)
-    purge(loop);
+    if (win->get_layout() && win->get_layout()->queued)
+    {
+      win->get_layout()->queued = false;
+      pack_queue.erase(std::remove(pack_queue.begin(), pack_queue.end(), win), pack_queue.end());
+    }
+  }
 }
 
 void window_manager::clear_cursor_library()
@@ -146,9 +158,58 @@ void window_manager::clear_cursor_library()
 
 void window_manager::draw()
 {
+  flush_packs();
   display_all();
 }
 
+// Queues a window for packing, unless it is already waiting
+void window_manager::queue_pack(base_window* win)
+{
+  layout_manager* layout = win->get_layout();
+  if (!layout || layout->queued) return;
+  
+  layout->queued = true;
+  pack_queue.push_back(win);
+}
+
+// Used to sort the pack queue by depth in the window tree
+struct pack_depth_less
+{
+  bool operator()(const std::pair<int, base_window*>& a, const std::pair<int, base_window*>& b) const
+  { return a.first < b.first; }
+};
+
+/* Packs all the queued windows. Parents are packed before their children, as
+ * arranging the parent will often resize the child and so pack it anyway, in
+ * which case its 'queued' flag is cleared and it is skipped here. Packing may
+ * queue more windows (if a measurement changed), so we go round until none are
+ * left.
+ */
+void window_manager::flush_packs()
+{
+  while (!pack_queue.empty())
+  {
+    std::vector< std::pair<int, base_window*> > order;
+    order.reserve(pack_queue.size());
+    
+    for (std::vector<base_window*>::size_type i = 0; i < pack_queue.size(); i++)
+    {
+      int depth = 0;
+      for (base_window* loop = pack_queue[i]->get_parent(); loop; loop = loop->get_parent()) depth++;
+      order.push_back(std::make_pair(depth, pack_queue[i]));
+    }
+    pack_queue.clear();
+    
+    std::stable_sort(order.begin(), order.end(), pack_depth_less());
+    
+    for (std::vector< std::pair<int, base_window*> >::size_type i = 0; i < order.size(); i++)
+    {
+      base_window* win = order[i].second;
+      if (win->get_layout() && win->get_layout()->queued) win->pack_now();
+    }
+  }
+}
+
 void window_manager::poll()
 {
   if (poll_in_action) return;
@@ -166,6 +227,8 @@ void window_manager::poll()
     if (keyfocus) keyfocus->event_key_blink();
     caret_blink_count = 0;
   }
+  
+  flush_packs(); // Everything this frame has had its say, so pack once
                  
   release_bitmap(get_buffer());
   
@@ -290,9 +353,10 @@ void window_manager::process_mouse()
     
   if (target)
   {
-    target->button_state = mouse_b;
-    target->mouse_x = ::mouse_x - target->get_cx();
-    target->mouse_y = ::mouse_y - target->get_cy();
+    window_extras& e = target->extra();
+    e.button_state = mouse_b;
+    e.mouse_x = ::mouse_x - target->get_cx();
+    e.mouse_y = ::mouse_y - target->get_cy();
   }                
 	
 	if (o_mouse_x != ::mouse_x) { std::cout << "mouse_x" << ::mouse_x << std::endl; };
@@ -310,8 +374,8 @@ void window_manager::process_mouse()
     {
       if (drag_target && !drag_target->disabled())
       {
-        drag_target->mouse_x = ::mouse_x - drag_target->get_cx();
-        drag_target->mouse_y = ::mouse_y - drag_target->get_cy();
+        drag_target->extra().mouse_x = ::mouse_x - drag_target->get_cx();
+        drag_target->extra().mouse_y = ::mouse_y - drag_target->get_cy();
         
         if(drag_target) drag_target->event_mouse_drag(::mouse_x-o_mouse_x,::mouse_y-o_mouse_y);
         if(drag_target) drag_target->transmit(mouse_drag_ei(::mouse_x, ::mouse_y, ::mouse_b, ::mouse_x-o_mouse_x,::mouse_y-o_mouse_y));
@@ -340,8 +404,8 @@ void window_manager::process_mouse()
       if(o_target) o_target->set_flag(evt_mouse_over, false);
       if(o_target) o_target->event_mouse_off();
       if(o_target) o_target->transmit(mouse_off_ei());      
-      if(o_target) o_target->mouse_x = -1;
-      if(o_target) o_target->mouse_y = -1;
+      if(o_target) o_target->extra().mouse_x = -1;
+      if(o_target) o_target->extra().mouse_y = -1;
     }
 
     if (target && !target->disabled())
@@ -359,8 +423,8 @@ void window_manager::process_mouse()
       coord_int mx = ::mouse_x - target->get_cx();
       coord_int my = ::mouse_y - target->get_cy();
       
-      target->click_x = mx;
-      target->click_y = my;      
+      target->extra().click_x = mx;
+      target->extra().click_y = my;      
       if(target) target->event_mouse_down(but);
       if(target) target->transmit(mouse_down_ei(mx, my, but));
       
@@ -385,14 +449,14 @@ void window_manager::process_mouse()
     {
       coord_int mx = ::mouse_x - drag_target->get_cx();
       coord_int my = ::mouse_y - drag_target->get_cy();
-      coord_int clx = drag_target->click_x;
-      coord_int cly = drag_target->click_y;
+      coord_int clx = drag_target->get_click_x();
+      coord_int cly = drag_target->get_click_y();
     
       if(drag_target) drag_target->event_mouse_up(but);
       if(drag_target) drag_target->transmit(mouse_up_ei(mx, my, but, clx, cly));
       if(drag_target) drag_target->set_flag(evt_dragged, false);
-      if(drag_target) drag_target->click_x = -1;
-      if(drag_target) drag_target->click_y = -1;
+      if(drag_target) drag_target->extra().click_x = -1;
+      if(drag_target) drag_target->extra().click_y = -1;
       
       but |= bt_snoop;
       for (base_window* gloop = drag_target ? drag_target->get_parent() : 0; gloop; gloop = gloop->get_parent())
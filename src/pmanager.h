@@ -19,6 +19,7 @@ class init_specifier;
 
 class window_manager : public window_master
 {
+  DEFINE_WINDOW_SIZE(window_manager)
   private:
      
     base_window* io_win; // The top window that events should be dispatched from
@@ -38,6 +39,8 @@ class window_manager : public window_master
   
     masked_image* cursor;
   
+    std::vector<base_window*> pack_queue; // Windows to be repacked at the end of the frame
+    
     bool poll_in_action;
     bool tree_altered;  
     bool caret_blink; 
@@ -67,20 +70,27 @@ class window_manager : public window_master
      
     base_window* get_keyfocus() { return keyfocus; }
     base_window* get_target() { return target; }
+
+    // Returns the window with the given id if it is one of ours, or 0
+    base_window* lookup(window_id id)
+    { base_window* win = base_window::from_id(id); return (win && win->get_manager() == this) ? win : 0; }
     masked_image* get_cursor() { return cursor; }
       
     void draw(); 
-    void purge(base_window* win);
+    void purge(base_window* family);
     
     void clear_cursor_library();
     void load_cursor(cursor_name cur, std::string file);
     void set_cursor(BITMAP *image);
     void set_cursor(cursor_name cur =cursor_normal);    
     void set_tree_altered() { tree_altered = true; }
+    
+    void queue_pack(base_window* win); // Has 'win' repacked at the end of this frame
+    void flush_packs(); // Repacks every queued window now, parents before children
     void set_keyfocus(base_window* new_active);
   
-    coord_int get_cursor_x() { return mouse_x; }
-    coord_int get_cursor_y() { return mouse_y; }
+    coord_int get_cursor_x() { return get_mouse_x(); }
+    coord_int get_cursor_y() { return get_mouse_y(); }
 
     bool show_caret() { return caret_blink; }
     void set_caret(bool b) { caret_blink_count = 0; caret_blink = b; }
@@ -1,8 +1,9 @@
 #include "pmaster.h"
 #include "allegro.h"
+#include "pwork.h"
 
 window_master::window_master(int depth)
-: display_delegation_depth(0), buffer_depth(depth)
+: display_delegation_depth(0), buffer_depth(depth), tile_size(0)
 {
   set_flag(grx_master);
 }
@@ -62,3 +63,122 @@ void window_master::flush_display_delegation()
 
 
 
+
+// Work item that draws one tile of a master's buffer on the work pool.
+struct window_tile_job : public work_item
+{
+  BITMAP* tile; // Sub-bitmap of the buffer, so that its clipping is our own
+  zone area;    // The part of the buffer the tile covers
+  const std::vector<base_window*>* wins;
+  const ptheme* theme;
+  
+  void run() { window_master::render_tile(tile, area, *wins, *theme); }
+};
+
+/* Draws each window's vis-zones, as far as they fall in 'area', onto the tile. 
+ * The vis-zones of different windows never overlap, so it doesn't matter which
+ * order the windows, or the tiles, are drawn in.
+ */
+void window_master::render_tile(BITMAP* tile, const zone& area, const std::vector<base_window*>& wins, const ptheme& t)
+{
+  for (std::vector<base_window*>::size_type i = 0; i < wins.size(); i++)
+  {
+    base_window* win = wins[i];
+    graphics_context context(tile, win->get_cx() - area.ax, win->get_cy() - area.ay, t);
+    
+    for (zone* loop = win->vis_list; loop; loop = loop->next)
+    {
+      zone shared(*loop);
+      if (shared.clip(&area) == -1) continue; // This vis-zone is in another tile
+      
+      shared.offset(-area.ax, -area.ay); // Tile co-ordinates
+      context.clip(&shared);
+      win->draw(context);
+    }
+  }
+}
+
+/* Tiled version of 'display_all'. The family is walked in the same order as
+ * 'display_all', and sub-spying is done as we go, just as 'display' would. Those
+ * windows that have declared themselves thread-safe are then drawn a tile at a
+ * time on the work pool, and once that has finished, the rest are drawn on 
+ * this thread. Nothing else may touch the buffer while the pool is drawing, 
+ * nor Allegro's global drawing state, which is why the others must wait.
+ */
+bool window_master::display_tiled()
+{
+  if (tile_size <= 0 || is_video() || !buffer || should_delegate()) return false;
+  
+  work_pool& pool = penguin_pool();
+  if (!pool.workers()) return false;
+  
+  std::vector<base_window*> order; // Windows in the order 'display_all' visits them
+  std::vector<base_window*> tiled; // Those we can draw on the pool
+  std::vector<base_window*> serial; // Those we can't
+  
+  // Post-order walk of our family, children before parents, without ourselves
+  for (base_window* loop = child; loop; )
+  {
+    if (loop->child) { loop = loop->child; continue; }
+    
+    while (loop != this)
+    {
+      order.push_back(loop);
+      if (loop->next) { loop = loop->next; break; }
+      loop = loop->parent;
+    }
+    
+    if (loop == this) break;
+  }
+  
+  for (std::vector<base_window*>::size_type i = 0; i < order.size(); i++)
+  {
+    base_window* win = order[i];
+    if (!win->visible() || !win->flag(sys_active) || !win->sensitive() || !win->master) continue;
+    
+    win->inform_sub(&win->clipped()); // Draw to any subliminal windows above
+    
+    if (win->master == this && win->flag(grx_thread_safe)) tiled.push_back(win);
+    else serial.push_back(win);
+  }
+  
+  if (!tiled.empty())
+  {
+    int tiles_x = (buffer->w + tile_size - 1) / tile_size;
+    int tiles_y = (buffer->h + tile_size - 1) / tile_size;
+    std::vector<window_tile_job> jobs(tiles_x * tiles_y);
+    work_batch batch;
+    
+    for (int ty = 0, n = 0; ty < tiles_y; ty++)
+    {
+      for (int tx = 0; tx < tiles_x; tx++, n++)
+      {
+        window_tile_job& job = jobs[n];
+        job.area.ax = tx * tile_size;
+        job.area.ay = ty * tile_size;
+        job.area.bx = PMAX(job.area.ax + tile_size - 1, buffer->w - 1);
+        job.area.by = PMAX(job.area.ay + tile_size - 1, buffer->h - 1);
+        job.tile = create_sub_bitmap(buffer, job.area.ax, job.area.ay, job.area.w() + 1, job.area.h() + 1);
+        job.wins = &tiled;
+        job.theme = &theme;
+        
+        pool.submit(batch, &job);
+      }
+    }
+    
+    pool.wait(batch);
+    
+    for (std::vector<window_tile_job>::size_type i = 0; i < jobs.size(); i++)
+      destroy_bitmap(jobs[i].tile);
+  }
+  
+  for (std::vector<base_window*>::size_type i = 0; i < serial.size(); i++)
+    serial[i]->_display();
+  
+  // Now that the drawing is done, send the display events from this thread
+  for (std::vector<base_window*>::size_type i = 0; i < tiled.size(); i++)
+    tiled[i]->post_display();
+  
+  display(); // And lastly, display ourselves just as 'display_all' would
+  return true;
+}
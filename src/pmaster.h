@@ -6,6 +6,7 @@
 
 class window_master : public base_window
 {
+  DEFINE_WINDOW_SIZE(window_master)
   private:  
       
     int display_delegation_depth; // Stores the number of delegation spans that are active 
@@ -15,6 +16,15 @@ class window_master : public base_window
     ptheme theme; // The theme all children will use
     
     int buffer_depth; // Colour-depth of the memory bitmap, 0 if a screen bitmap
+    
+    coord_int tile_size; // Edge of the squares used by tiled rendering, 0 if off
+    
+    // Displays our whole family by splitting the buffer into tiles and drawing 
+    // them on the work pool. Returns false if tiled rendering can't be used.
+    bool display_tiled();
+    
+    // Draws the given windows over the portion of the buffer that 'tile' covers
+    static void render_tile(BITMAP* tile, const zone& area, const std::vector<base_window*>& wins, const ptheme& t);
   
   protected:
   
@@ -35,12 +45,21 @@ class window_master : public base_window
     bool should_delegate() { return (display_delegation_depth > 0); } // TRUE if delegation is in effect
     
     bool is_video() { return (buffer_depth == 0); } // True if the buffer is a video bitmap
+    
+    /* Tiled rendering: full displays of this family are split into square tiles
+       of the given size, which are drawn on the work pool. Only windows with the
+       'grx_thread_safe' flag are drawn on the pool, the rest are drawn after 
+       them as normal. Pass 0 to turn it off. Has no effect on a video buffer, or
+       if Penguin was built without PENGUIN_THREADS. */
+    void set_tiled_rendering(coord_int size =128) { tile_size = size; }
+    coord_int get_tile_size() const { return tile_size; }
    
     // Constructors, passed the desired colour-depth of the memory bitmap, or 0 to use the screen
     window_master(int depth =0);
     
     friend class base_window;
     friend class window_sub;
+    friend struct window_tile_job;
 };
 
 #endif MASTER_HPP
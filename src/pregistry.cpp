@@ -0,0 +1,50 @@
+#include "pregistry.h"
+
+window_registry& window_registry::global()
+{
+  static window_registry registry;
+  return registry;
+}
+
+window_id window_registry::add(base_window* win)
+{
+  int s = free_head;
+
+  if (s != -1)
+  {
+    free_head = slots[s].next_free;
+    if (free_head == -1) free_tail = -1;
+  } else
+  {
+    if (slots.size() > slot_mask) throw overflow_exception();
+
+    slot e = { 0, 0, -1 };
+    s = slots.size();
+    slots.push_back(e);
+  }
+
+  slots[s].win = win;
+  slots[s].next_free = -1;
+  used++;
+
+  return (window_id(slots[s].generation) << slot_bits) | s;
+}
+
+void window_registry::release(window_id id)
+{
+  unsigned int s = id & slot_mask;
+  if (s >= slots.size() || slots[s].generation != (id >> slot_bits) || !slots[s].win) return;
+
+  slot& e = slots[s];
+  e.win = 0;
+  used--;
+
+  if (e.generation == generation_mask) return; // Retired, its ids all used up
+
+  e.generation++;
+  e.next_free = -1;
+
+  if (free_tail != -1) slots[free_tail].next_free = s;
+  else free_head = s;
+  free_tail = s;
+}
@@ -0,0 +1,75 @@
+#ifndef PREGISTRY_H
+#define PREGISTRY_H
+
+#include "pdefs.h"
+#include <vector>
+
+class base_window;
+
+/* A window's id is a handle that stays the same for its whole life, wherever it
+ * is moved in the tree. The low bits are the index of the window's slot in the
+ * registry, and the high bits are a generation count for that slot, which goes
+ * up each time the slot is freed. A handle kept after its window has gone is
+ * then recognised as stale, rather than found to point at whatever window has
+ * been given the slot since. The first window in each slot has generation 0, so
+ * early ids are small enough to type at the console.
+ */
+typedef unsigned int window_id;
+
+/* The registry is a slot map from ids to windows: looking a window up is a
+ * bounds check and a compare. Freed slots are queued and re-used oldest first,
+ * so the table only grows to the most windows that have existed at once, and
+ * a slot only comes round again once every other free slot has. A slot whose
+ * generation has run out is retired rather than let wrap round to ids it has
+ * already given out, at the cost of one slot in every 4096 re-uses.
+ */
+class window_registry
+{
+  private:
+
+    struct slot
+    {
+      base_window* win;        // The window in this slot, or 0 if it is free
+      unsigned int generation; // Bumped each time the slot is freed
+      int next_free;           // The next free slot, if we are queued, or -1
+    };
+
+    std::vector<slot> slots;
+    int free_head; // The free slot to be re-used next, or -1
+    int free_tail; // The slot freed last, or -1
+    int used;      // The number of slots holding a window
+
+  public:
+
+    enum
+    {
+      slot_bits = 20,                    // Up to a million windows at once,
+      slot_mask = (1 << slot_bits) - 1,  // and 4096 generations a slot
+      generation_mask = (1 << (32 - slot_bits)) - 1
+    };
+
+    window_id add(base_window* win); // Gives the window a slot, and returns its id
+    void release(window_id id);      // Frees the id's slot, making the id stale
+
+    // Returns the window with the given id, or 0 if the id is stale or unknown
+    base_window* lookup(window_id id) const
+    {
+      unsigned int s = id & slot_mask;
+      if (s >= slots.size()) return 0;
+
+      const slot& e = slots[s];
+      return (e.generation == (id >> slot_bits)) ? e.win : 0;
+    }
+
+    bool valid(window_id id) const { return lookup(id) != 0; }
+    int size() const { return used; }
+    int capacity() const { return slots.size(); }
+
+    // The registry every window is entered in, made on first use so that
+    // windows that are themselves static can safely register
+    static window_registry& global();
+
+    window_registry() : free_head(-1), free_tail(-1), used(0) { }
+};
+
+#endif
@@ -16,7 +16,7 @@ void window_sub::sub_buffer_updated(zone* list)
 {
   sub_changed_hook(list); // Call the hook
 
-  if (flag(grx_sensitive) && list) 
+  if (sensitive() && list) 
   {
     // If this subliminal window is a linear, just display the effected areas by
     // calling 'draw_arb_zones' with no recursion flags
@@ -15,6 +15,7 @@ struct BITMAP;
  */
 class window_sub : public base_window
 {
+  DEFINE_WINDOW_SIZE(window_sub)
   private:
                       
     BITMAP *sub_buffer; // The bitmap containing the image of what is beneath us
@@ -59,6 +60,7 @@ class window_sub : public base_window
 /* This is a portable magnifier to enlarge a portion of the screen under it. */
 class window_magnifier : public window_sub
 {
+  DEFINE_WINDOW_SIZE(window_magnifier)
   protected:
   
     void event_mouse_down(bt_int button); 
@@ -116,6 +118,7 @@ class window_magnifier : public window_sub
  */
 class masked_image : public window_sub
 {
+  DEFINE_WINDOW_SIZE(masked_image)
   private:
   
     void draw(const graphics_context& grx); 
@@ -147,6 +150,7 @@ class masked_image : public window_sub
 
 class shadowed_masked_image : public masked_image
 {
+  DEFINE_WINDOW_SIZE(shadowed_masked_image)
   private:
 
     BITMAP* shadow_mask; // Bitmap representing the shadow to be applied
@@ -170,6 +174,7 @@ class shadowed_masked_image : public masked_image
 struct RLE_SPRITE;
 class rle_masked_image : public masked_image
 {
+  DEFINE_WINDOW_SIZE(rle_masked_image)
   private:
 
     RLE_SPRITE* rle_image;
@@ -0,0 +1,722 @@
+#include "ptext.h"
+#include "pfont.h"
+#include <cstring>
+
+/* New blocks are at least this big, so that text typed or appended a little at
+ * a time lands in a few large pieces rather than many small ones. */
+static const int block_size = 4096;
+
+text_buffer::text_buffer(const text_buffer& t)
+: root(retain(t.root)), tail(t.tail), seed(t.seed)
+{
+  if (tail) tail->refs++;
+}
+
+text_buffer& text_buffer::operator=(const text_buffer& t)
+{
+  retain(t.root);
+  if (t.tail) t.tail->refs++;
+
+  release(root);
+  release(tail);
+
+  root = t.root;
+  tail = t.tail;
+  return *this;
+}
+
+text_buffer::~text_buffer()
+{
+  release(root);
+  release(tail);
+}
+
+text_buffer::node* text_buffer::make(block* b, int off, int len, unsigned int prio, node* l, node* r)
+{
+  node* n = new node;
+
+  n->b = b;
+  n->off = off;
+  n->len = len;
+  n->total = total(l) + len + total(r);
+  n->prio = prio;
+  n->l = l;
+  n->r = r;
+  n->refs = 1;
+
+  b->refs++;
+  return n;
+}
+
+void text_buffer::release(node* n)
+{
+  if (!n || --n->refs) return;
+
+  release(n->l);
+  release(n->r);
+  release(n->b);
+  delete n;
+}
+
+void text_buffer::release(block* b)
+{
+  if (!b || --b->refs) return;
+
+  delete[] b->data;
+  delete b;
+}
+
+/* Splits the text below 't' into its first 'k' characters and the rest. If the
+ * split falls inside a piece, it becomes two pieces of the same block. */
+void text_buffer::split(node* t, int k, node*& a, node*& b)
+{
+  if (!t)
+  {
+    a = b = 0;
+    return;
+  }
+
+  int ls = total(t->l);
+
+  if (k <= ls)
+  {
+    node* m;
+    split(t->l, k, a, m);
+    b = make(t->b, t->off, t->len, t->prio, m, retain(t->r));
+  } else if (k >= ls + t->len)
+  {
+    node* m;
+    split(t->r, k - ls - t->len, m, b);
+    a = make(t->b, t->off, t->len, t->prio, retain(t->l), m);
+  } else
+  {
+    int o = k - ls;
+    a = make(t->b, t->off, o, t->prio, retain(t->l), 0);
+    b = make(t->b, t->off + o, t->len - o, t->prio, 0, retain(t->r));
+  }
+}
+
+text_buffer::node* text_buffer::merge(node* a, node* b)
+{
+  if (!a) return retain(b);
+  if (!b) return retain(a);
+
+  if (a->prio > b->prio)
+    return make(a->b, a->off, a->len, a->prio, retain(a->l), merge(a->r, b));
+  else
+    return make(b->b, b->off, b->len, b->prio, merge(a, b->l), retain(b->r));
+}
+
+// Lengthens the last piece by 'n' characters, for text added straight after it
+text_buffer::node* text_buffer::extend_last(node* t, int n)
+{
+  if (!t->r) return make(t->b, t->off, t->len + n, t->prio, retain(t->l), 0);
+  return make(t->b, t->off, t->len, t->prio, retain(t->l), extend_last(t->r, n));
+}
+
+// Xorshift is plenty for treap priorities
+unsigned int text_buffer::next_prio()
+{
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
+
+/* Copies the characters onto the end of the tail block, if they fit, or else
+ * into a new one that becomes the tail. Other buffers may share the tail, and
+ * add to it too, but only ever past 'used', where no piece can lie. */
+int text_buffer::store(const char* s, int n, block*& b)
+{
+  if (!tail || tail->size - tail->used < n)
+  {
+    block* nb = new block;
+    nb->size = (n > block_size) ? n : block_size;
+    nb->data = new char[nb->size];
+    nb->used = 0;
+    nb->refs = 1;
+
+    release(tail);
+    tail = nb;
+  }
+
+  b = tail;
+  memcpy(b->data + b->used, s, n);
+  b->used += n;
+
+  return b->used - n;
+}
+
+char text_buffer::operator[](int i) const
+{
+  const char* s;
+  return run(i, s) ? *s : 0;
+}
+
+int text_buffer::run(int pos, const char*& s) const
+{
+  const node* t = root;
+
+  while (t)
+  {
+    int ls = total(t->l);
+
+    if (pos < ls) t = t->l;
+    else if (pos < ls + t->len)
+    {
+      s = t->b->data + t->off + (pos - ls);
+      return t->len - (pos - ls);
+    } else
+    {
+      pos -= ls + t->len;
+      t = t->r;
+    }
+  }
+
+  s = 0;
+  return 0;
+}
+
+std::string text_buffer::substr(int pos, int n) const
+{
+  std::string out;
+  out.reserve(n);
+
+  while (n > 0)
+  {
+    const char* s;
+    int got = run(pos, s);
+    if (!got) break;
+
+    if (got > n) got = n;
+    out.append(s, got);
+    pos += got;
+    n -= got;
+  }
+
+  return out;
+}
+
+std::string text_buffer::str() const
+{
+  return substr(0, length());
+}
+
+bool text_buffer::equals(const std::string& s) const
+{
+  if ((int)s.length() != length()) return false;
+
+  for (int pos = 0; pos < length();)
+  {
+    const char* r;
+    int got = run(pos, r);
+    if (memcmp(r, s.data() + pos, got)) return false;
+    pos += got;
+  }
+
+  return true;
+}
+
+void text_buffer::assign(const std::string& s)
+{
+  release(root);
+  root = 0;
+  insert(0, s);
+}
+
+/* Text going straight after the piece last added to the tail block, as when
+ * typing or appending, just lengthens that piece. */
+void text_buffer::insert(int pos, const char* s, int n)
+{
+  if (n <= 0) return;
+
+  block* b;
+  int off = store(s, n, b);
+
+  node* front;
+  node* back;
+  split(root, pos, front, back);
+
+  const node* last = front;
+  while (last && last->r) last = last->r;
+
+  node* joined;
+  if (last && last->b == b && last->off + last->len == off) joined = extend_last(front, n);
+  else
+  {
+    node* p = make(b, off, n, next_prio(), 0, 0);
+    joined = merge(front, p);
+    release(p);
+  }
+
+  node* t = merge(joined, back);
+
+  release(front);
+  release(back);
+  release(joined);
+  release(root);
+  root = t;
+}
+
+void text_buffer::erase(int pos, int n)
+{
+  if (n <= 0) return;
+
+  node* front;
+  node* rest;
+  node* middle;
+  node* back;
+
+  split(root, pos, front, rest);
+  split(rest, n, middle, back);
+
+  node* t = merge(front, back);
+
+  release(front);
+  release(rest);
+  release(middle);
+  release(back);
+  release(root);
+  root = t;
+}
+
+text_layout::text_layout(const text_layout& t)
+: font(t.font), metrics(t.metrics), text(t.text), wrap_w(t.wrap_w), wrap(t.wrap), valid(t.valid),
+  space_w(t.space_w), line_h(t.line_h), root(copy(t.root)), seed(t.seed),
+  changed_first(t.changed_first), changed_last(t.changed_last)
+{ }
+
+text_layout& text_layout::operator=(const text_layout& t)
+{
+  if (&t == this) return *this;
+
+  destroy(root);
+  root = copy(t.root);
+
+  font = t.font;
+  metrics = t.metrics;
+  text = t.text;
+  wrap_w = t.wrap_w;
+  wrap = t.wrap;
+  valid = t.valid;
+  space_w = t.space_w;
+  line_h = t.line_h;
+  seed = t.seed;
+  changed_first = t.changed_first;
+  changed_last = t.changed_last;
+
+  return *this;
+}
+
+void text_layout::fix(line_node* n)
+{
+  n->total_chars = total_chars(n->l) + n->chars + total_chars(n->r);
+  n->total_words = total_words(n->l) + n->words.size() + total_words(n->r);
+  n->total_lines = total_lines(n->l) + 1 + total_lines(n->r);
+}
+
+// Unlike text_buffer's, our nodes belong to us alone, so are changed in place
+void text_layout::split(line_node* t, int k, line_node*& a, line_node*& b)
+{
+  if (!t)
+  {
+    a = b = 0;
+    return;
+  }
+
+  if (k <= total_lines(t->l))
+  {
+    split(t->l, k, a, t->l);
+    b = t;
+  } else
+  {
+    split(t->r, k - total_lines(t->l) - 1, t->r, b);
+    a = t;
+  }
+
+  fix(t);
+}
+
+text_layout::line_node* text_layout::merge(line_node* a, line_node* b)
+{
+  if (!a) return b;
+  if (!b) return a;
+
+  if (a->prio > b->prio)
+  {
+    a->r = merge(a->r, b);
+    fix(a);
+    return a;
+  } else
+  {
+    b->l = merge(a, b->l);
+    fix(b);
+    return b;
+  }
+}
+
+text_layout::line_node* text_layout::copy(const line_node* n)
+{
+  if (!n) return 0;
+
+  line_node* c = new line_node(*n);
+  c->l = copy(n->l);
+  c->r = copy(n->r);
+
+  return c;
+}
+
+void text_layout::destroy(line_node* n)
+{
+  if (!n) return;
+
+  destroy(n->l);
+  destroy(n->r);
+  delete n;
+}
+
+const text_layout::line_node* text_layout::locate(int what, int k, int& line, int& start, int& first) const
+{
+  const line_node* n = root;
+  line = start = first = 0;
+
+  while (n)
+  {
+    int below = (what == by_line) ? total_lines(n->l) : (what == by_char) ? total_chars(n->l) : total_words(n->l);
+    int own = (what == by_line) ? 1 : (what == by_char) ? n->chars : int(n->words.size());
+
+    if (k < below)
+    {
+      n = n->l;
+      continue;
+    }
+
+    line += total_lines(n->l);
+    start += total_chars(n->l);
+    first += total_words(n->l);
+
+    if (k < below + own || !n->r) return n;
+
+    k -= below + own;
+    line++;
+    start += n->chars;
+    first += n->words.size();
+    n = n->r;
+  }
+
+  return 0;
+}
+
+/* The fresh lines' words are swapped into the new nodes, rather than copied.
+ * Each line runs up to where the next one starts, and the last up to 'end'. */
+void text_layout::splice(int first, int last, std::deque<fresh_line>& fresh, int end)
+{
+  line_node *front, *middle, *back;
+  split(root, first, front, middle);
+  split(middle, last - first, middle, back);
+  destroy(middle);
+
+  line_node* made = 0;
+  for (std::deque<fresh_line>::size_type i = 0; i < fresh.size(); i++)
+  {
+    line_node* n = new line_node;
+    n->words.swap(fresh[i].words);
+    n->chars = ((i + 1 < fresh.size()) ? fresh[i + 1].start : end) - fresh[i].start;
+    n->l = n->r = 0;
+
+    seed ^= seed << 13; // Xorshift, as for text_buffer's priorities
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    n->prio = seed;
+
+    fix(n);
+    made = merge(made, n);
+  }
+
+  root = merge(merge(front, made), back);
+}
+
+bool text_layout::update(FONT* f, const std::string& s, coord_int width, bool w)
+{
+  if (!valid || !text.equals(s)) set_text(s);
+  return update(f, width, w);
+}
+
+bool text_layout::update(FONT* f, coord_int width, bool w)
+{
+  if (valid && f == font && width == wrap_w && w == wrap) return false;
+
+  font = f;
+  wrap_w = width;
+  wrap = w;
+
+  build();
+  valid = true;
+
+  changed_first = 0;
+  changed_last = -1;
+
+  return true;
+}
+
+// The text is taken to end with a break, one past its last character, so that
+// the characters of the lines add up to one more than its length
+void text_layout::build()
+{
+  destroy(root);
+  root = 0;
+
+  metrics = &font_metrics::of(font);
+  line_h = metrics->get_height();
+  space_w = metrics->advance(' ');
+
+  std::deque<fresh_line> fresh;
+  int resume;
+  scan(0, -1, 0, fresh, resume);
+  splice(0, 0, fresh, text.length() + 1);
+}
+
+/* Lays the words out from character 'from', which begins a line, adding the
+ * lines to 'out'.
+ *
+ * A word goes onto a new line if it would run over the edge and would fit on
+ * a line of its own, or if it is too wide for any line and has something in
+ * front of it. Word widths are the sums of their characters' widths, which is
+ * what text_length would give, without having to copy each word out first.
+ *
+ * How a line is laid out depends only on where it starts, so if 'sync' isn't
+ * -1, then as soon as a line starts at or after character 'sync' where one
+ * started in the current tables ('delta' characters earlier), the rest would
+ * come out as before: the scan stops there, sets 'resume' to where that line
+ * now starts, and returns its number in the current tables. Otherwise it
+ * returns -1. */
+int text_layout::scan(int from, int sync, int delta, std::deque<fresh_line>& out, int& resume) const
+{
+  coord_int cur_x = 0;
+  coord_int cur_w = 0;
+  int last = from;
+  int len = text.length();
+  text_buffer::cursor rd(text);
+
+  out.push_back(fresh_line());
+  out.back().start = from;
+
+  for (int cur = from; cur <= len; cur++)
+  {
+    char c = (cur < len) ? rd[cur] : 0;
+
+    if (c > 32)
+    {
+      cur_w += metrics->advance(c);
+      continue;
+    }
+
+    if (wrap)
+    if ((cur_x + cur_w > wrap_w && cur_w < wrap_w) || (cur_w >= wrap_w && cur_x != 0))
+    {
+      int k = resumes_at(last, sync, delta);
+      if (k != -1) return resume = last, k;
+
+      cur_x = 0;
+      out.push_back(fresh_line());
+      out.back().start = last;
+    }
+
+    fresh_line& fl = out.back();
+    word wd = { last - fl.start, cur - fl.start, cur_x, cur_w, 0 };
+    fl.words.push_back(wd);
+
+    cur_x += cur_w + space_w;
+    cur_w = 0;
+    last = cur + 1;
+
+    if (c == '\n')
+    {
+      int k = resumes_at(last, sync, delta);
+      if (k != -1) return resume = last, k;
+
+      cur_x = 0;
+      out.push_back(fresh_line()); // There is always a word after it
+      out.back().start = last;
+    }
+  }
+
+  return -1;
+}
+
+// Returns the line a line starting at 'cpos' after an edit can be taken from,
+// as 'scan' describes, or -1 if there isn't one
+int text_layout::resumes_at(int cpos, int sync, int delta) const
+{
+  if (sync == -1 || cpos < sync) return -1;
+
+  int line, start, first;
+  locate(by_char, cpos - delta, line, start, first);
+
+  return (start == cpos - delta) ? line : -1;
+}
+
+void text_layout::edit(int pos, int removed, const std::string& s)
+{
+  text.replace(pos, removed, s);
+  reflow(pos, removed, s.length());
+}
+
+void text_layout::edit(const text_buffer& t, int pos, int removed, int added)
+{
+  text = t;
+  reflow(pos, removed, added);
+}
+
+/* The new lines are laid out on their own, and then put into the treap in
+ * place of the old ones between the restart and the point where the layout
+ * falls back into step. Nothing beyond that needs changing at all. */
+void text_layout::reflow(int pos, int removed, int added)
+{
+  if (!valid)
+  {
+    changed_first = 0;
+    changed_last = -1;
+    return;
+  }
+
+  // Everything before 'pos' is as it was, so the old tables can still be asked
+  // where its line starts, and whether that start follows a newline
+  int first = line_of(pos);
+  if (first > 0 && text[line_start(first) - 1] != '\n') first--;
+
+  std::deque<fresh_line> fresh;
+  int resume = text.length() + 1;
+
+  int old_lines = lines();
+  int k = scan(line_start(first), pos + added, added - removed, fresh, resume);
+  if (k == -1) k = old_lines;
+
+  int new_resume = first + fresh.size();
+  splice(first, k, fresh, resume);
+
+  changed_first = first;
+  changed_last = (new_resume != k) ? -1 : new_resume;
+}
+
+text_layout::word text_layout::get_word(int i) const
+{
+  int line, start, first;
+  const line_node* n = locate(by_word, i, line, start, first);
+
+  word wd = n->words[i - first];
+  wd.start += start;
+  wd.end += start;
+  wd.line = line;
+
+  return wd;
+}
+
+int text_layout::first_word(int line) const
+{
+  int l, start, first;
+  locate(by_line, line, l, start, first);
+
+  return first;
+}
+
+int text_layout::last_word(int line) const
+{
+  int l, start, first;
+  const line_node* n = locate(by_line, line, l, start, first);
+
+  return first + n->words.size() - 1;
+}
+
+int text_layout::line_of(int cpos) const
+{
+  int line, start, first;
+  locate(by_char, (cpos < 0) ? 0 : cpos, line, start, first);
+
+  return line;
+}
+
+int text_layout::line_start(int line) const
+{
+  int l, start, first;
+  locate(by_line, line, l, start, first);
+
+  return start;
+}
+
+int text_layout::line_end(int line) const
+{
+  int l, start, first;
+  const line_node* n = locate(by_line, line, l, start, first);
+
+  return start + n->words.back().end;
+}
+
+// Word ends only go up, so within the character's line, the first that isn't
+// before it can be found by halving. Positions past the end of the text
+// belong to the last word.
+int text_layout::word_at(int cpos) const
+{
+  int line, start, first;
+  const line_node* n = locate(by_char, (cpos < 0) ? 0 : cpos, line, start, first);
+
+  int lo = 0, hi = n->words.size() - 1;
+
+  while (lo < hi)
+  {
+    int mid = (lo + hi) / 2;
+    if (start + n->words[mid].end < cpos) lo = mid + 1; else hi = mid;
+  }
+
+  return first + lo;
+}
+
+coord_int text_layout::char_x(int cpos) const
+{
+  word wd = get_word(word_at(cpos));
+  coord_int x = wd.x;
+  text_buffer::cursor rd(text);
+
+  for (int n = wd.start; n < cpos && n < wd.end; n++)
+    x += metrics->advance((unsigned char)rd[n]);
+
+  return x;
+}
+
+void text_layout::find_coords(int cpos, coord_int& x, coord_int& y, int top) const
+{
+  x = char_x(cpos);
+  y = (line_of(cpos) - top) * line_h;
+}
+
+/* The point's line is found directly from its height. Along the line, the
+ * first word reaching past the point is searched for the character whose
+ * midpoint the point lies before. A point beyond the end of the line gives
+ * the break at its end. */
+int text_layout::find_index(coord_int x, coord_int y, int top) const
+{
+  int line = top + ((y < 0) ? 0 : y / line_h);
+  if (line >= lines()) return text.length();
+
+  int l, start, first;
+  const line_node* ln = locate(by_line, line, l, start, first);
+  text_buffer::cursor rd(text);
+
+  for (std::vector<word>::size_type i = 0; i < ln->words.size(); i++)
+  {
+    const word& wd = ln->words[i];
+    if (wd.x + wd.w + space_w <= x) continue;
+
+    coord_int cx = wd.x;
+    for (int n = start + wd.start; n < start + wd.end; n++)
+    {
+      int cw = metrics->advance((unsigned char)rd[n]);
+      cx += cw;
+      if (cx > x + cw/2) return n;
+    }
+
+    return start + wd.end;
+  }
+
+  return start + ln->words.back().end;
+}
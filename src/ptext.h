@@ -0,0 +1,274 @@
+#ifndef PTEXT_H
+#define PTEXT_H
+
+#include "pdefs.h"
+#include <string>
+#include <vector>
+#include <deque>
+
+struct FONT;
+class font_metrics;
+
+/* A text_buffer holds a piece of text as a 'piece table': the characters
+ * themselves are only ever added to the ends of shared blocks, and never moved
+ * or changed once there, while the text is the sequence of pieces of those
+ * blocks it is made from. Inserting or erasing splits and joins pieces, not
+ * characters, so costs the same however long the text is.
+ *
+ * The pieces are kept in a treap ordered by position, each node knowing how
+ * many characters lie beneath it, which gives O(log n) edits and lookups.
+ * Nodes are never altered once made: an edit builds new nodes along the paths
+ * it changes and shares the rest. So copying a buffer only copies a pointer,
+ * and an old copy stays just as it was, which is all an undo snapshot needs.
+ */
+class text_buffer
+{
+  private:
+
+    struct block // Characters, shared by every buffer with pieces in them
+    {
+      char* data;
+      int size;
+      int used; // Characters below this are taken, and will never change
+      int refs;
+    };
+
+    struct node // A piece of text, and the treap below it
+    {
+      block* b;
+      int off, len;      // The piece is 'len' characters of 'b' from 'off'
+      int total;         // Characters in this piece and all those below it
+      unsigned int prio; // Parents have higher priorities than their children
+      node* l;
+      node* r;
+      int refs;
+    };
+
+    node* root;
+    block* tail;       // The block new characters go into, while it has room
+    unsigned int seed; // For node priorities
+
+    static int total(const node* n) { return n ? n->total : 0; }
+
+    // These all leave the references they are passed alone, and return new ones
+    static node* make(block* b, int off, int len, unsigned int prio, node* l, node* r);
+    static void split(node* t, int k, node*& a, node*& b);
+    static node* merge(node* a, node* b);
+    static node* extend_last(node* t, int n);
+
+    static node* retain(node* n) { if (n) n->refs++; return n; }
+    static void release(node* n);
+    static void release(block* b);
+
+    int store(const char* s, int n, block*& b); // Copies into a block, returning the offset
+    unsigned int next_prio();
+
+  public:
+
+    int length() const { return total(root); }
+    bool empty() const { return !root; }
+
+    char operator[](int i) const;
+    int run(int pos, const char*& s) const; // Points 's' at the characters from 'pos' that lie together, returning how many
+    std::string substr(int pos, int n) const;
+    std::string str() const;
+    bool equals(const std::string& s) const;
+
+    void assign(const std::string& s);
+    void insert(int pos, const char* s, int n);
+    void insert(int pos, const std::string& s) { insert(pos, s.data(), s.length()); }
+    void append(const std::string& s) { insert(length(), s); }
+    void erase(int pos, int n);
+    void replace(int pos, int n, const std::string& s) { erase(pos, n); insert(pos, s); }
+
+    /* Reads a buffer from front to back a run at a time, for scanning through
+       it without a treap lookup per character. Indices must be in range. */
+    class cursor
+    {
+      private:
+
+        const text_buffer& buf;
+        int lo, hi;
+        const char* s;
+
+      public:
+
+        char operator[](int i)
+        {
+          if (i < lo || i >= hi) hi = i + buf.run(lo = i, s);
+          return s[i - lo];
+        }
+
+        cursor(const text_buffer& b) : buf(b), lo(0), hi(0), s(0) { }
+    };
+
+    text_buffer& operator=(const text_buffer& t);
+
+    text_buffer() : root(0), tail(0), seed(2463534242u) { }
+    text_buffer(const std::string& s) : root(0), tail(0), seed(2463534242u) { assign(s); }
+    text_buffer(const text_buffer& t);
+    ~text_buffer();
+};
+
+/* A text_layout works out, once, where each word of a piece of multiline text
+ * goes: how wide it is, and which line and how far along that line it lands
+ * once the text has been wrapped to a given width in a given font. All of the
+ * questions the multiline text functions ask - which line a character is on,
+ * where a line starts, what lies under a point - are then answered from these
+ * tables in O(log n), rather than by scanning the text from its start.
+ *
+ * A 'word' here is a run of characters up to a space, newline or other control
+ * character, or the end of the text, so every character belongs to exactly
+ * one word: either inside it, or as the break that ends it. Positions are
+ * given relative to the top-left of the text, which the multiline functions
+ * place 4 pixels in and 3 down from the corner of their zone.
+ *
+ * Lines are numbered from 0 here; the free functions in pgrx.h keep their old
+ * numbering from 1.
+ */
+class text_layout
+{
+  public:
+
+    struct word
+    {
+      int start;   // Index of the word's first character
+      int end;     // Index of the break that follows it (or the end of the text)
+      coord_int x; // Offset of its left edge from the start of its line
+      coord_int w; // Its width
+      int line;    // The line it lies on
+    };
+
+  private:
+
+    /* The lines are kept in a treap ordered by position, as text_buffer keeps
+       its pieces, each node knowing how many characters, words and lines lie
+       beneath it. A line's words are stored counted from the line's own start,
+       and lines don't know their numbers, so an edit only replaces the lines it
+       lays out again: those after it move along without being touched. */
+    struct line_node
+    {
+      std::vector<word> words; // Starts and ends are from the line's start; 'line' is unused
+      int chars;               // Characters from the line's start to the next line's
+      int total_chars, total_words, total_lines; // In this line and all those below it
+      unsigned int prio;
+      line_node* l;
+      line_node* r;
+    };
+
+    struct fresh_line // A line as 'scan' lays it out, before it goes into the treap
+    {
+      int start;
+      std::vector<word> words; // As in a line_node
+    };
+
+    enum { by_line, by_char, by_word }; // What 'locate' counts along
+
+    FONT* font;
+    const font_metrics* metrics; // Our font's character widths
+    text_buffer text;
+    coord_int wrap_w; // Width words are wrapped to
+    bool wrap;
+    bool valid;
+
+    coord_int space_w; // Width of a space in our font
+    coord_int line_h;  // Height of a line
+
+    line_node* root;
+    unsigned int seed; // For node priorities
+
+    int changed_first; // The lines the last layout or edit changed,
+    int changed_last;  // with -1 for 'to the end'
+
+    static int total_chars(const line_node* n) { return n ? n->total_chars : 0; }
+    static int total_words(const line_node* n) { return n ? n->total_words : 0; }
+    static int total_lines(const line_node* n) { return n ? n->total_lines : 0; }
+
+    static void fix(line_node* n); // Works out its totals again from its children's
+    static void split(line_node* t, int k, line_node*& a, line_node*& b); // After 'k' lines
+    static line_node* merge(line_node* a, line_node* b);
+    static line_node* copy(const line_node* n);
+    static void destroy(line_node* n);
+
+    // Finds the line holding the k'th line, character or word, and the number,
+    // first character and first word of that line. Anything past the end
+    // is taken to be in the last line.
+    const line_node* locate(int what, int k, int& line, int& start, int& first) const;
+
+    // Puts the lines into the treap in place of lines [first, last), the last
+    // of them running up to character 'end'
+    void splice(int first, int last, std::deque<fresh_line>& fresh, int end);
+
+    void build();
+    void reflow(int pos, int removed, int added);
+    int scan(int from, int sync, int delta, std::deque<fresh_line>& out, int& resume) const;
+    int resumes_at(int cpos, int sync, int delta) const;
+
+  public:
+
+    /* Lays out the text for the given font, width and wrapping, unless it is
+       laid out that way already. Returns true if it had to be laid out anew. */
+    bool update(FONT* f, const std::string& s, coord_int width, bool w =true);
+    bool update(FONT* f, coord_int width, bool w =true); // As above, for the text we have
+    void set_text(const std::string& s) { text.assign(s); valid = false; }
+    void set_text(const text_buffer& t) { text = t; valid = false; }
+    void invalidate() { valid = false; }
+
+    /* Replaces 'removed' characters at 'pos' with 's', and lays out again only
+       from the line the edit starts on (or the one before, which may now take
+       some of it back) until the lines start where they did before. How long
+       that takes depends on the lines laid out, and not on the length of the
+       text, beyond the O(log n) of finding them. */
+    void edit(int pos, int removed, const std::string& s);
+
+    // As above, where 't' is our text with the edit already made, for widgets
+    // that keep the text themselves and share it with us
+    void edit(const text_buffer& t, int pos, int removed, int added);
+
+    // The lines changed by the last layout or edit: from 'changed_from' up to,
+    // but not including, 'changed_to', which is -1 if everything below moved
+    int changed_from() const { return changed_first; }
+    int changed_to() const { return changed_last; }
+
+    const text_buffer& get_text() const { return text; }
+    coord_int get_space_w() const { return space_w; }
+    coord_int get_line_h() const { return line_h; }
+
+    int lines() const { return total_lines(root); }
+    int word_count() const { return total_words(root); }
+    word get_word(int i) const;
+
+    int first_word(int line) const; // First word on the line
+    int last_word(int line) const;  // Last word on the line
+
+    int word_at(int cpos) const; // The word the character is in, or ends
+    int line_of(int cpos) const;
+    int line_start(int line) const;
+    int line_end(int line) const;
+
+    coord_int char_x(int cpos) const; // Offset of the character from the start of its line
+
+    // Finds the position of the character, relative to the text's top-left,
+    // when the text is scrolled to show 'top' as its first line
+    void find_coords(int cpos, coord_int& x, coord_int& y, int top =0) const;
+
+    // Finds the character nearest the given point, as above
+    int find_index(coord_int x, coord_int y, int top =0) const;
+
+    text_layout& operator=(const text_layout& t);
+
+    text_layout()
+    : font(0), metrics(0), wrap_w(0), wrap(true), valid(false), space_w(0), line_h(0), root(0), seed(2463534242u),
+      changed_first(0), changed_last(-1) { }
+    text_layout(FONT* f, const std::string& s, coord_int width, bool w =true)
+    : font(0), metrics(0), wrap_w(0), wrap(true), valid(false), space_w(0), line_h(0), root(0), seed(2463534242u),
+      changed_first(0), changed_last(-1)
+    { update(f, s, width, w); }
+    text_layout(const text_layout& t);
+    ~text_layout() { destroy(root); }
+};
+
+// Width a text_layout should wrap to, to fill the given zone as render_multiline does
+inline coord_int multiline_width(const zone& z) { return z.bx - z.ax - 4; }
+
+#endif
@@ -0,0 +1,174 @@
+#include "pvirtual.h"
+#include "pgrx.h"
+
+window_virtual::window_virtual(virtual_source* s)
+: source(s), vscroll(hv_vertical), scroll(0)
+{
+  add_child(vscroll);
+  set_flag(grx_thread_safe);
+}
+
+window_virtual::~window_virtual()
+{
+  set_source(0);
+}
+
+void window_virtual::draw(const graphics_context& grx)
+{
+  grx.draw_frame(0,0,w(),h(),ft_bevel_in);
+  grx.rectfill(2,2,w()-2,h()-2,theme().white);
+}
+
+void window_virtual::pre_load()
+{
+  listen(vscroll, LISTENER(window_virtual::scrolled, scroll_ei));
+}
+
+void window_virtual::post_load()
+{
+  update_scrollbar();
+  update_view();
+}
+
+void window_virtual::position_children()
+{
+  vscroll.place(c_east, normal_size);
+  update_scrollbar();
+  update_view();
+}
+
+void window_virtual::scrolled(const scroll_ei& ei)
+{
+  scroll = ei.value;
+  update_view();
+}
+
+/* The scrollbar covers the estimated height of every item. If the list has
+ * shrunk, the scrollbar will pull its value back in range, and tell us. */
+void window_virtual::update_scrollbar()
+{
+  if (!source || !flag(sys_loaded)) return;
+
+  int est = PMIN(1, source->estimate());
+
+  vscroll.set_unit_step(est);
+  vscroll.set_page_step(e_h());
+  vscroll.set_max(PMIN(0, source->count() * est - e_h()));
+}
+
+/* Returns the widget showing the given item. If none is, a spare widget from the
+ * pool is bound to it, and only if there are no spares is a new one created. */
+base_window* window_virtual::widget_for(int item)
+{
+  for (std::vector<base_window*>::size_type i = 0; i < pool.size(); i++)
+    if (bound[i] == item) return pool[i];
+
+  for (std::vector<base_window*>::size_type i = 0; i < pool.size(); i++)
+  {
+    if (bound[i] == -1)
+    {
+      bound[i] = item;
+      source->bind(*pool[i], item);
+      pool[i]->show();
+      return pool[i];
+    }
+  }
+
+  base_window* w = source->create();
+  source->bind(*w, item);
+
+  pool.push_back(w);
+  bound.push_back(item);
+  add_child(w, 0, false); // Behind the scrollbar
+
+  return w;
+}
+
+/* Works out which items are in view, from the scroll position and the estimated
+ * item height, then hands back the widgets of any items that have gone out of
+ * view, and binds and places widgets for those in it. Widgets that already
+ * show an item in view are only moved, not bound again. */
+void window_virtual::update_view()
+{
+  if (!source || !flag(sys_loaded)) return;
+
+  int n = source->count();
+  int est = PMIN(1, source->estimate());
+  int first = PMAX(scroll / est, n);
+  coord_int top = -(scroll % est);
+  coord_int right = e_w() - vscroll.w();
+
+  int last = first;
+  for (coord_int y = top; last < n && y < e_h(); last++) y += source->extent(last);
+
+  delegate_displays();
+
+  for (std::vector<base_window*>::size_type i = 0; i < pool.size(); i++)
+  {
+    if (bound[i] != -1 && (bound[i] < first || bound[i] >= last))
+    {
+      bound[i] = -1;
+      pool[i]->hide();
+    }
+  }
+
+  for (int i = first; i < last; i++)
+  {
+    coord_int h = source->extent(i);
+    widget_for(i)->move(0, top, right, top + h);
+    top += h;
+  }
+
+  undelegate_displays();
+}
+
+void window_virtual::set_source(virtual_source* s)
+{
+  for (std::vector<base_window*>::size_type i = 0; i < pool.size(); i++)
+  {
+    pool[i]->remove();
+    if (source) source->destroy(pool[i]);
+  }
+
+  pool.clear();
+  bound.clear();
+
+  source = s;
+  scroll = 0;
+  vscroll.set_value(0);
+
+  update_scrollbar();
+  update_view();
+}
+
+// Widgets still showing a valid item are bound to it again in place, rather
+// than being handed back and flickering off and on
+void window_virtual::refresh()
+{
+  int n = source ? source->count() : 0;
+
+  for (std::vector<int>::size_type i = 0; i < bound.size(); i++)
+  {
+    if (bound[i] == -1) continue;
+
+    if (bound[i] < n) source->bind(*pool[i], bound[i]);
+    else
+    {
+      bound[i] = -1;
+      pool[i]->hide();
+    }
+  }
+
+  update_scrollbar();
+  update_view();
+}
+
+void window_virtual::scroll_to(int item)
+{
+  if (source) vscroll.set_value(item * PMIN(1, source->estimate()));
+}
+
+int window_virtual::first_visible() const
+{
+  return source ? scroll / PMIN(1, source->estimate()) : 0;
+}
@@ -0,0 +1,88 @@
+#ifndef PVIRTUAL_H
+#define PVIRTUAL_H
+
+#include "pwidgets.h"
+#include <vector>
+
+/* A virtual_source supplies the items shown by a window_virtual. Rather than
+ * the view holding a window for every item, the source is asked to 'create' a
+ * small pool of widgets, and then to 'bind' whichever of them are free to the
+ * items that have come into view. A bound widget keeps showing its item until
+ * the item scrolls out of sight, when it is handed back for re-use.
+ *
+ * Only 'extent' is asked of items that are actually on screen; the size of the
+ * whole list (and so the scrollbar) is worked out from 'estimate', so that a
+ * source never needs to look at all of its items.
+ */
+class virtual_source
+{
+  public:
+
+    virtual int count() const = 0;          // The number of items
+    virtual coord_int estimate() const = 0; // The typical height of an item
+    virtual coord_int extent(int i) const { return estimate(); } // The height of item i
+
+    virtual base_window* create() = 0; // Returns a new widget for the pool
+    virtual void bind(base_window& w, int i) = 0; // Sets the widget up to show item i
+    virtual void destroy(base_window* w) { delete w; } // Disposes of a pool widget
+
+    virtual ~virtual_source() { }
+};
+
+/* The virtualizing container. Its items are stacked from top to bottom, each
+ * the full width of the view, with a scrollbar down the right-hand side. Only
+ * as many widgets exist as are needed to fill the view, so a list of a hundred
+ * thousand items costs no more to load than one of twenty.
+ */
+class window_virtual : public base_window
+{
+  DEFINE_WINDOW_SIZE(window_virtual)
+  private:
+
+    void draw(const graphics_context& grx);
+
+  protected:
+
+    virtual_source* source;
+    window_scrollbar vscroll;
+
+    std::vector<base_window*> pool; // Every widget the source has created for us
+    std::vector<int> bound;         // The item each of those shows, or -1 if spare
+
+    int scroll; // Offset of the top of the view into the list, in estimated pixels
+
+    coord_int e_ax() const { return 2; }
+    coord_int e_ay() const { return 2; }
+    coord_int e_bx() const { return w()-2; }
+    coord_int e_by() const { return h()-2; }
+
+    void pre_load();
+    void post_load();
+    void position_children();
+
+    void scrolled(const scroll_ei& ei);
+
+    void update_scrollbar(); // Sizes the scrollbar to the estimated list height
+    void update_view();      // Binds and places widgets for the items in view
+
+    base_window* widget_for(int item); // Finds the widget bound to an item, or binds one
+
+  public:
+
+    void set_source(virtual_source* s); // Drops the current pool, and shows the new items
+    virtual_source* get_source() const { return source; }
+
+    void refresh(); // Re-binds every visible item, for when the source's data changes
+    void scroll_to(int item); // Brings the item to the top of the view
+
+    int first_visible() const; // The item at the top of the view
+    int pool_size() const { return pool.size(); }
+
+    coord_int normal_w() const { return 150; }
+    coord_int normal_h() const { return 100; }
+
+    window_virtual(virtual_source* s =0);
+    ~window_virtual();
+};
+
+#endif
@@ -1,6 +1,13 @@
 #include "pwidgets.h"
 #include "pgrx.h"
+#include "pfont.h"
 #include "allegro.h"
+#include <ctype.h>
+#include <algorithm>
+
+#ifdef PENGUIN_THREADS
+#include <pthread.h>
+#endif
 
 base_widget& widget_ei::source() const 
 { 
@@ -14,7 +21,9 @@ void window_block::draw(const graphics_context& grx)
 
 window_block::window_block(int rr, int gg, int bb) 
 : col((rr << 16) | (gg << 8) | bb  | 16777216)
-{ }
+{ 
+  set_flag(grx_thread_safe);
+}
 
 void window_block::pre_load()
 {
@@ -245,9 +254,16 @@ void window_label::draw(const graphics_context& grx)
   grx.draw_frame(0, 0, w(), h(), frame);
   
   if (multiline)
-    grx.render_multiline(text.c_str(), zone(2,2,w()-2,h()-2), theme().frame);
+    grx.render_multiline(text_lines(), text_zone(), theme().frame);
   else
-    grx.render_line(c_centre, text.c_str(), zone(2,2,w()-2,h()-2), theme().black, theme().frame);
+    grx.render_line(c_centre, text.c_str(), text_zone(), theme().black, theme().frame);
+}
+
+// Lays our text out again, only if it has been replaced or our size has changed
+const text_layout& window_label::text_lines()
+{
+  breaks.update(theme().font, multiline_width(text_zone()));
+  return breaks;
 }
 
 void window_scrollbar::draw(const graphics_context& grx)
@@ -434,22 +450,7 @@ void window_checkbox::draw(const graphics_context& grx)
 {                                  
   coord_int rx, ry;      
   grx.render_backdrop(rx, ry, zone(0,0,12,h()), 12, 12, theme().frame);
-  
-  grx.draw_frame(rx, ry, rx+12, ry+12, ft_bevel_in);
-  grx.rectfill(rx+2, ry+2, rx+10, ry+10, theme().white);
-  
-  if (state)
-  {
-    int col = theme().black;
-    
-    grx.hline(rx+9,ry+3,rx+9,col);
-    grx.hline(rx+8,ry+4,rx+9,col);
-    grx.hline(rx+7,ry+5,rx+9,col); grx.hline(rx+3,ry+5,rx+3,col);
-    grx.hline(rx+6,ry+6,rx+8,col); grx.hline(rx+3,ry+6,rx+4,col);
-    grx.hline(rx+3,ry+7,rx+7,col);
-    grx.hline(rx+4,ry+8,rx+6,col);
-    grx.hline(rx+5,ry+9,rx+5,col);
-  } 
+  grx.draw_glyph(state ? tg_check_on : tg_check_off, rx, ry);
   
   grx.render_line(c_west, text.c_str(), zone(13,0,w(),h()), theme().black, theme().frame);
 }
@@ -540,158 +541,140 @@ void window_radiobutton::set_value(int val)
 
 void window_radiobutton::draw(const graphics_context& grx) 
 {    
-  /* white:
-     2: 4-7, 10
-     3: 3-8, 10
-     4: 2-9, 11
-     5: 2-9, 11
-     6: 2-9, 11
-     7: 2-9, 11
-     8: 3-8, 10
-     9: 4-7, 10
-     10: 2-3, 8-9
-     11: 4-7 
-     
-     dark:
-     0: 4-7
-     1: 2-3, 8-9
-     2: 1
-     3: 1
-     4: 0
-     5: 0
-     6: 0
-     7: 0
-     8: 1
-     9: 1
-     
-     black:
-     1: 4-7
-     2: 2-3, 8-9
-     3: 2
-     4: 1
-     5: 1
-     6: 1
-     7: 1 
-     8: 2
-  
-     grey:
-     0: 0-3,8-11
-     1: 0-1,10-11
-     2: 0,11
-     3: 0,9,11
-     4: 10
-     5: 10
-     6: 10
-     7 :10
-     8: 0,9,11
-     9: 0,3-4,8-9,11
-     10:0-1,4-7,10-11
-     11:0-3,8-11
-   */       
-                                                  
   coord_int rx, ry;      
   grx.render_backdrop(rx, ry, zone(0,0,0+12,h()), 11, 11, theme().frame);
-
-  int col = theme().frame;
-  grx.hline(rx+0,ry+0,rx+3,col); grx.hline(rx+8,ry+0,rx+11,col);
-  grx.hline(rx+0,ry+1,rx+1,col); grx.hline(rx+10,ry+1,rx+11,col);
-  grx.putpixel(rx+0,ry+2,col); grx.putpixel(rx+11,ry+2,col);
-  grx.putpixel(rx+0,ry+3,col); grx.putpixel(rx+9,ry+3,col); grx.putpixel(rx+11,ry+3,col); 
-  grx.putpixel(rx+10,ry+4,col);
-  grx.putpixel(rx+10,ry+5,col);
-  grx.putpixel(rx+10,ry+6,col);
-  grx.putpixel(rx+10,ry+7,col);
-  grx.putpixel(rx+0,ry+8,col); grx.putpixel(rx+9,ry+8,col); grx.putpixel(rx+11,ry+8,col);
-  grx.putpixel(rx+0,ry+9,col); grx.putpixel(rx+11,ry+9,col); 
-  grx.hline(rx+2,ry+9,rx+3,col); grx.hline(rx+8,ry+9,rx+9,col); 
-  grx.hline(rx+0,ry+10,rx+1,col); grx.hline(rx+4,ry+10,rx+7,col);grx.hline(rx+10,ry+10,rx+11,col);
-  grx.hline(rx+0,ry+11,rx+3,col); grx.hline(rx+8,ry+11,rx+11,col);  
-  
-  col = theme().frame_white;
-  grx.hline(rx+4,ry+2,rx+7,col); grx.putpixel(rx+10,ry+2,col);
-  grx.hline(rx+3,ry+3,rx+8,col); grx.putpixel(rx+10,ry+3,col);
-  grx.hline(rx+2,ry+4,rx+9,col); grx.putpixel(rx+11,ry+4,col);
-  grx.hline(rx+2,ry+5,rx+9,col); grx.putpixel(rx+11,ry+5,col);
-  grx.hline(rx+2,ry+6,rx+9,col); grx.putpixel(rx+11,ry+6,col);
-  grx.hline(rx+2,ry+7,rx+9,col); grx.putpixel(rx+11,ry+7,col);
-  grx.hline(rx+3,ry+8,rx+8,col); grx.putpixel(rx+10,ry+8,col);
-  grx.hline(rx+4,ry+9,rx+7,col); grx.putpixel(rx+10,ry+9,col);
-  grx.hline(rx+2,ry+10,rx+3,col); grx.hline(rx+8,ry+10,rx+9,col);
-  grx.hline(rx+4,ry+11,rx+7,col); 
-  
-  col = theme().frame_low;
-  grx.hline(rx+4,ry+0,rx+7,col);
-  grx.hline(rx+2,ry+1,rx+3,col); grx.hline(rx+8,ry+1,rx+9,col);
-  grx.putpixel(rx+1,ry+2,col);
-  grx.putpixel(rx+1,ry+3,col);
-  grx.putpixel(rx+0,ry+4,col);
-  grx.putpixel(rx+0,ry+5,col);
-  grx.putpixel(rx+0,ry+6,col);
-  grx.putpixel(rx+0,ry+7,col);
-  grx.putpixel(rx+1,ry+8,col);
-  grx.putpixel(rx+1,ry+9,col);
-  
-  col = theme().frame_black;
-  grx.hline(rx+4,ry+1,rx+7,col);
-  grx.hline(rx+2,ry+2,rx+3,col); grx.hline(rx+8,ry+2,rx+9,col);
-  grx.putpixel(rx+2,ry+3,col);
-  grx.putpixel(rx+1,ry+4,col);
-  grx.putpixel(rx+1,ry+5,col);
-  grx.putpixel(rx+1,ry+6,col);
-  grx.putpixel(rx+1,ry+7,col);
-  grx.putpixel(rx+2,ry+8,col);
-   
-/*   DOT:
-    
-     5: 5-6
-     6: 4-7
-     7: 4-7
-     8: 5-6
-*/  
-  
-  if (state)
-  {
-    grx.hline(rx+5,ry+4,rx+6,col);
-    grx.hline(rx+4,ry+5,rx+7,col);
-    grx.hline(rx+4,ry+6,rx+7,col);
-    grx.hline(rx+5,ry+7,rx+6,col);
-  } 
+  grx.draw_glyph(state ? tg_radio_on : tg_radio_off, rx, ry);
   
   grx.render_line(c_west, text.c_str(), zone(13, 0, w(), h()), theme().black, theme().frame);
 }
 
+// Lays our text out again, only if it has been replaced or our size has changed
+// since last time; edits keep the layout up to date as they go
+const text_layout& window_textbox::text_lines()
+{
+  breaks.update(theme().font, multiline_width(text_zone()), wordwrap);
+  return breaks;
+}
+
+// Snapshots cost no more than a copy of the buffer's root, so one is kept for
+// every edit, up to a limit
+void window_textbox::edit_text(int pos, int removed, const std::string& s)
+{
+  snapshot snap = { text, edit_pos };
+  history.push_back(snap);
+  if (history.size() > 100) history.pop_front();
+
+  text.replace(pos, removed, s);
+  breaks.edit(text, pos, removed, s.length());
+}
+
+void window_textbox::append(const std::string& s)
+{
+  int old_caret = multiline ? text_lines().line_of(edit_pos) : 0;
+
+  edit_text(text.length(), 0, s);
+  show_edit(old_caret, true);
+}
+
+void window_textbox::insert(const std::string& s)
+{
+  int old_caret = multiline ? text_lines().line_of(edit_pos) : 0;
+
+  edit_text(edit_pos, 0, s);
+  edit_pos += s.length();
+  show_edit(old_caret, true);
+}
+
+void window_textbox::undo()
+{
+  if (history.empty()) return;
+
+  text = history.back().text;
+  edit_pos = history.back().edit_pos;
+  history.pop_back();
+
+  breaks.set_text(text);
+
+  delegate_displays();
+  change_text();
+  display();
+  undelegate_displays();
+
+  if (listened_to()) transmit(string_input_ei(text.str()));
+}
+
+/* Draws the strip of our text area holding those lines through 'draw_arb_zones',
+ * as window_cells does for a cell, so that only the vis-zones it touches are
+ * drawn. Lines scrolled out of view are left alone. */
+void window_textbox::display_lines(int first, int last)
+{
+  if (!visible() || !flag(sys_active)) return;
+
+  zone tz = text_zone();
+  coord_int lh = text_lines().get_line_h();
+
+  coord_int ay = (first <= line) ? tz.ay : tz.ay + 3 + (first - line) * lh;
+  coord_int by = (last == -1) ? tz.by : PMAX(tz.ay + 3 + (last - line) * lh, tz.by);
+  if (ay >= by) return;
+
+  zone* area = new zone(get_cx() + tz.ax, get_cy() + ay, get_cx() + tz.bx, get_cy() + by);
+
+  draw_arb_zones(area, DAZ_F_SPYSUB);
+  delete_zonelist(area);
+}
+
+int window_textbox::line_to_char(int l)
+{
+  const text_layout& lay = text_lines();
+
+  if (l <= 1) return 0;
+  if (l > lay.lines()) return text.length();
+  return lay.line_start(l - 1);
+}
+
 void window_textbox::draw(const graphics_context& grx)
 {                                                       
   grx.draw_frame(0, 0, w(), h(), ft_bevel_in);
   
   if (multiline)
   {
-    grx.render_multiline(text, zone(2,2,w()-2-(vscroll.flag(vis_visible)?16:0),h()-2), theme().pane, (flag(evt_keyfocus) && get_manager()->show_caret()) ? edit_pos : std::string::npos, line, wordwrap);
+    grx.render_multiline(text_lines(), text_zone(), theme().pane, (flag(evt_keyfocus) && get_manager()->show_caret()) ? edit_pos : std::string::npos, line);
   } else
   {
-    grx.render_line(c_west, text.c_str(), zone(2,2,w()-2,h()-2), theme().text, theme().pane, (flag(evt_keyfocus) && get_manager()->show_caret()) ? edit_pos : std::string::npos);
+    grx.render_line(c_west, text.str().c_str(), zone(2,2,w()-2,h()-2), theme().text, theme().pane, (flag(evt_keyfocus) && get_manager()->show_caret()) ? edit_pos : std::string::npos);
   }
 }
 
 void window_textbox::event_key_down(kb_event kb)
 {
   char c = kb.get_char();
-  zone text_zone(2,2,w()-2,h()-2);
+
+  int old_caret = multiline ? text_lines().line_of(edit_pos) : 0;
+  bool edited = false;
+
+  if (c == 26)
+  {
+    get_manager()->set_caret(true);
+    undo();
+    return;
+  }
 
   if (c == 8)
   {
     if (edit_pos > 0)
     {
-      text.erase(edit_pos-1, 1);
+      edit_text(edit_pos-1, 1, "");
       edit_pos--;
+      edited = true;
     }
     
   } else if (c == 13)
   {
     if (multiline)
     {
-      text.insert(edit_pos, 1, '\n');
+      edit_text(edit_pos, 0, "\n");
       edit_pos++;
+      edited = true;
     }    
   } else
   {
@@ -699,7 +682,11 @@ void window_textbox::event_key_down(kb_event kb)
     {
       case pk_del:
       {
-        if (edit_pos < text.length()) text.erase(edit_pos, 1);\
+        if (edit_pos < text.length())
+        {
+          edit_text(edit_pos, 1, "");
+          edited = true;
+        }
         
       } break;
         
@@ -719,8 +706,8 @@ void window_textbox::event_key_down(kb_event kb)
       {
         if (multiline)
         {
-          int line = char_to_line(theme().font, text, text_zone, edit_pos);
-          if (line > 1) edit_pos = line_to_char(theme().font, text, text_zone, line);
+          int line = text_lines().line_of(edit_pos) + 1;
+          if (line > 1) edit_pos = line_to_char(line);
           else edit_pos = 0;
           
         } else edit_pos = 0;                  
@@ -731,10 +718,10 @@ void window_textbox::event_key_down(kb_event kb)
       {
         if (multiline && vscroll.visible())
         {
-          int cur_line = char_to_line(theme().font, text, text_zone, edit_pos);
+          int cur_line = text_lines().line_of(edit_pos) + 1;
           cur_line -= vscroll.get_page_step();
           if (cur_line < 1) cur_line = 1;
-          edit_pos = line_to_char(theme().font, text, text_zone, cur_line);
+          edit_pos = line_to_char(cur_line);
         }
       } break;
       
@@ -742,10 +729,10 @@ void window_textbox::event_key_down(kb_event kb)
       {
         if (multiline && vscroll.visible())
         {
-          int cur_line = char_to_line(theme().font, text, text_zone, edit_pos);
+          int cur_line = text_lines().line_of(edit_pos) + 1;
           cur_line += vscroll.get_page_step();
           if (cur_line > lines) cur_line = lines;
-          edit_pos = line_to_char(theme().font, text, text_zone, cur_line);
+          edit_pos = line_to_char(cur_line);
         }
       } break;
        
@@ -753,13 +740,13 @@ void window_textbox::event_key_down(kb_event kb)
       {
         if (multiline)
         {
-          int line = char_to_line(theme().font, text, text_zone, edit_pos);
+          int line = text_lines().line_of(edit_pos) + 1;
           
           if (line > 1)
           {
-            int start = line_to_char(theme().font, text, text_zone, line);           
+            int start = line_to_char(line);           
             int column = edit_pos - start;
-            int last_line = line_to_char(theme().font, text, text_zone, line-1); 
+            int last_line = line_to_char(line-1); 
             edit_pos = last_line + column;
             if (edit_pos >= start) edit_pos = start-1;
           }        
@@ -770,13 +757,12 @@ void window_textbox::event_key_down(kb_event kb)
       case pk_tab:
       {
         int pos = edit_pos;
-        if (multiline) pos -= first_char_in_line(theme().font, text, text_zone, edit_pos);
+        if (multiline) pos -= text_lines().line_start(text_lines().line_of(edit_pos));
         
-        do
-        {
-          text.insert(edit_pos, 1, ' ');
-          edit_pos++, pos++;
-        } while (pos % 4);
+        int spaces = 4 - pos % 4;
+        edit_text(edit_pos, 0, std::string(spaces, ' '));
+        edit_pos += spaces;
+        edited = true;
         
       } break;
       
@@ -784,14 +770,14 @@ void window_textbox::event_key_down(kb_event kb)
       {
         if (multiline)
         {
-          int line = char_to_line(theme().font, text, text_zone, edit_pos);
+          int line = text_lines().line_of(edit_pos) + 1;
           
           if (line < lines)
           {
-            int start = line_to_char(theme().font, text, text_zone, line);           
+            int start = line_to_char(line);           
             int column = edit_pos - start;
-            int next_line = line_to_char(theme().font, text, text_zone, line+1); 
-            int chars = chars_in_line(theme().font, text, text_zone, line+1);
+            int next_line = line_to_char(line+1); 
+            int chars = text_lines().line_end(line) - next_line;
             edit_pos = next_line + column;
             if (edit_pos > next_line + chars) edit_pos = next_line + chars;
           }        
@@ -803,8 +789,8 @@ void window_textbox::event_key_down(kb_event kb)
       {
         if (multiline)
         {
-          int line = char_to_line(theme().font, text, text_zone, edit_pos);
-          if (line < lines) edit_pos = line_to_char(theme().font, text, text_zone, line+1)-1;
+          int line = text_lines().line_of(edit_pos) + 1;
+          if (line < lines) edit_pos = line_to_char(line+1)-1;
           else edit_pos = text.length();
           
         } else edit_pos = text.length();        
@@ -815,8 +801,9 @@ void window_textbox::event_key_down(kb_event kb)
       {
         if (c)
         {
-          text.insert(edit_pos, 1,  c);
+          edit_text(edit_pos, 0, std::string(1, c));
           edit_pos++;
+          edited = true;
         }      
       }
     }    
@@ -825,29 +812,53 @@ void window_textbox::event_key_down(kb_event kb)
   if (edit_pos > text.length()) edit_pos = text.length(); 
   if (edit_pos < 0) edit_pos = 0;
  
-  delegate_displays();
-          
   get_manager()->set_caret(true);
+  show_edit(old_caret, edited);
+}
+
+void window_textbox::show_edit(int old_caret, bool edited)
+{
+  delegate_displays();
+
+  int old_line = line;
+  bool old_scroll = vscroll.flag(vis_visible);
   change_text();
-  display();
+
+  // Unless we scrolled, only the lines the edit re-wrapped, and those the
+  // caret left and arrived on, need drawing again
+  if (!multiline || line != old_line || vscroll.flag(vis_visible) != old_scroll) display();
+  else
+  {
+    int new_caret = text_lines().line_of(edit_pos);
+    int first = PMAX(old_caret, new_caret), last = PMIN(old_caret, new_caret) + 1;
+
+    if (edited)
+    {
+      first = PMAX(first, breaks.changed_from());
+      last = (breaks.changed_to() == -1) ? -1 : PMIN(last, breaks.changed_to());
+    }
+
+    display_lines(first, last);
+  }
   
   undelegate_displays();
   
-  transmit(string_input_ei(text));  
+  // Copying out a long text is costly, so is only done for someone to hear it
+  if (listened_to()) transmit(string_input_ei(text.str()));  
 }
 
 void window_textbox::event_mouse_down(bt_int button)
 {
   set_keyfocus();
   
-  zone text_zone(2, 2, w()-2-(vscroll.flag(vis_visible)?16:0), h()-2);
+  zone text_zone = this->text_zone();
   
   if (multiline) 
   {
-    edit_pos = find_multiline_index(theme().font, text, text_zone, get_mouse_x(), get_mouse_y(), line, wordwrap);
+    edit_pos = text_lines().find_index(get_mouse_x() - text_zone.ax - 4, get_mouse_y() - text_zone.ay - 3, line);
   } else
   {
-    edit_pos = find_line_index(theme().font, c_west, std::string(text).c_str(), text_zone, get_mouse_x());
+    edit_pos = find_line_index(theme().font, c_west, text.str().c_str(), text_zone, get_mouse_x());
   }
   
   get_manager()->set_caret(true);
@@ -860,7 +871,7 @@ void window_textbox::change_text()
   if (flag(sys_active) && multiline)
   {
     int max_lines = (h()-7) / text_height(theme().font);
-    lines = lines_in_multiline(theme().font, text, zone(2,2,w()-2-(vscroll.flag(vis_visible)?16:0),h()-2), wordwrap);
+    lines = text_lines().lines();
   
     if (lines > max_lines)              
     {
@@ -869,7 +880,7 @@ void window_textbox::change_text()
       vscroll.set_max(lines - max_lines);
       vscroll.set_page_step(max_lines);
       
-      int cline = char_to_line(theme().font, text, zone(2,2,w()-2-(vscroll.flag(vis_visible)?16:0),h()-2), edit_pos); 
+      int cline = text_lines().line_of(edit_pos) + 1; 
       if (cline <= line) vscroll.set_value(cline-1);
       else if (cline > line + max_lines) vscroll.set_value(cline);   
       else vscroll.display();
@@ -905,93 +916,632 @@ void window_textbox::position_children()
   }
 }  
 
+/* Only the rows that reach into the clipping rectangle are drawn, and only
+ * their items are asked of the source, so redrawing a row or two of a long list
+ * costs no more than it does for a short one. */
 void window_listbox::draw(const graphics_context& grx)
 { 
   grx.draw_frame(0, 0, w(), h(), ft_bevel_in);
   
   clipper clip(grx, 2, 2, w()-2, h()-2);
+
+  BITMAP* bmp = grx;
+  coord_int ct = bmp->ct - grx.get_oy(), cb = bmp->cb - grx.get_oy();
+
+  coord_int rh = row_h();
+  int first = line + ((ct > 2) ? (ct - 2) / rh : 0);
+  int last = line + ((cb > 2) ? (cb - 2 + rh - 1) / rh : 0);
+  if (last > source->count()) last = source->count();
   
-  coord_int ypos = 2;
-  int txt_h = text_height(theme().font);        
-  for (int n = line; n < list.size() && ypos < h()-2; n++)
+  coord_int ypos = 2 + (first - line) * rh;
+  for (int n = first; n < last; n++)
   {
-    if (n == cur_sel) grx.render_line(c_west, list[n].c_str(), zone(2,ypos,w()-2,ypos+txt_h), theme().pane, theme().bar);
-    else              grx.render_line(c_west, list[n].c_str(), zone(2,ypos,w()-2,ypos+txt_h), theme().text, theme().pane);
+    std::string s = source->item(n);
+
+    if (n == cur_sel) grx.render_line(c_west, s.c_str(), zone(2,ypos,w()-2,ypos+rh-1), theme().pane, theme().bar);
+    else              grx.render_line(c_west, s.c_str(), zone(2,ypos,w()-2,ypos+rh-1), theme().text, theme().pane);
       
-    ypos += txt_h + 1;
+    ypos += rh;
   } 
   
   if (ypos <= h()-2) grx.rectfill(2,ypos,w()-2,h()-2,theme().pane);
 }  
-    
-void window_listbox::add_item(const std::string& s)
+
+coord_int window_listbox::row_h() const
 {
-  list.push_back(s);
-  change_list();
-} 
+  return font_metrics::of(theme().font).get_height() + 1;
+}
 
-void window_listbox::remove_item(const std::string& s)
+/* Draws the strip of rows through 'draw_arb_zones', as window_cells does for a
+ * cell, so that only the vis-zones it touches are drawn. Rows scrolled out of
+ * view are left alone. */
+void window_listbox::display_rows(int first, int last)
 {
-  for (std::vector<std::string>::iterator r = list.begin(); r != list.end(); r++)
+  if (!visible() || !flag(sys_active)) return;
+
+  coord_int rh = row_h();
+  coord_int ay = (first <= line) ? 2 : 2 + (first - line) * rh;
+  coord_int by = (last == -1) ? h()-2 : PMAX(2 + (last - line) * rh, h()-2);
+  if (ay >= by) return;
+
+  zone* area = new zone(get_cx() + 2, get_cy() + ay, get_cx() + w()-2, get_cy() + by);
+
+  draw_arb_zones(area, DAZ_F_SPYSUB);
+  delete_zonelist(area);
+}
+
+void window_listbox::change_selection(int n)
+{
+  int old = cur_sel;
+  cur_sel = n;
+
+  if (old != -1) display_rows(old, old + 1);
+  if (n != -1) display_rows(n, n + 1);
+}
+
+std::string prefix_index::fold(const std::string& s)
+{
+  std::string f(s);
+  for (std::string::size_type i = 0; i < f.length(); i++) f[i] = tolower((unsigned char)f[i]);
+
+  return f;
+}
+
+void prefix_index::shift(int first, int n)
+{
+  for (std::vector<key_map::iterator>::size_type i = first; i < items.size(); i++) items[i]->second += n;
+}
+
+void prefix_index::build(const list_source& s)
+{
+  drop();
+  inserted(s, 0, s.count());
+  built = true;
+}
+
+void prefix_index::drop()
+{
+  keys.clear();
+  items.clear();
+  built = false;
+}
+
+void prefix_index::inserted(const list_source& s, int first, int n)
+{
+  shift(first, n);
+
+  std::vector<key_map::iterator> fresh(n);
+  for (int i = 0; i < n; i++) fresh[i] = keys.insert(std::make_pair(fold(s.item(first + i)), first + i));
+
+  items.insert(items.begin() + first, fresh.begin(), fresh.end());
+}
+
+void prefix_index::removed(int first, int n)
+{
+  for (int i = first; i < first + n; i++) keys.erase(items[i]);
+  items.erase(items.begin() + first, items.begin() + first + n);
+
+  shift(first, -n);
+}
+
+void prefix_index::changed(const list_source& s, int first, int n)
+{
+  for (int i = first; i < first + n; i++)
   {
-    if (*r == s) 
+    keys.erase(items[i]);
+    items[i] = keys.insert(std::make_pair(fold(s.item(i)), i));
+  }
+}
+
+// The first key not before the prefix is the first, in text order, to start
+// with it, if any does
+int prefix_index::find(const std::string& prefix) const
+{
+  std::string f = fold(prefix);
+  key_map::const_iterator i = keys.lower_bound(f);
+
+  return (i != keys.end() && i->first.compare(0, f.length(), f) == 0) ? i->second : -1;
+}
+
+/* A list_order_job runs an order on a thread of its own, over its own copy of
+ * the items, so that nothing it reads can change under it. Items are filtered,
+ * then sorted in runs of a few thousand rows, and the runs merged together in
+ * pairs, so that there is somewhere to check for being cancelled and to say how
+ * far it has got between each step of the work.
+ *
+ * It isn't given to the work pool, as a thread waiting on the pool may take
+ * queued items to run itself, and the pool has no workers at all on a single
+ * processor: either way, the sort could end up on the GUI thread. A thread of
+ * its own is time-sliced with the GUI's, even then. Built without threads, it
+ * is run there and then by 'start'. */
+class list_order_job
+{
+  private:
+
+    struct comparer // For the standard algorithms, which copy it about
     {
-      list.erase(r);
-      
-      if (cur_sel == r-list.begin()) 
+      const list_order* order;
+      const std::vector<std::string>* items;
+
+      bool operator()(int a, int b) const { return order->before((*items)[a], (*items)[b]); }
+    };
+
+  public:
+
+    const list_order& order;
+    std::vector<std::string> items; // Copied by the listbox when we start
+    std::vector<int> rows;          // What we came up with, once we are done
+
+    volatile bool cancelled;
+    volatile bool finished;
+    volatile int progress; // In thousandths
+
+#ifdef PENGUIN_THREADS
+    pthread_t thread;
+    bool threaded; // If 'thread' was started, and hasn't been joined yet
+    static void* thread_proc(void* j) { ((list_order_job*)j)->run(); return 0; }
+#endif
+
+    void work(); // The filtering and sorting itself
+    void run();  // As above, then says we have finished
+    void start(); // Runs us, on our thread if we have one
+    void join();  // Waits for us to finish, which we must before being deleted
+
+    list_order_job(const list_order& o) : order(o), cancelled(false), finished(false), progress(0)
+#ifdef PENGUIN_THREADS
+    , threaded(false)
+#endif
+    { }
+};
+
+void list_order_job::start()
+{
+#ifdef PENGUIN_THREADS
+  if (pthread_create(&thread, 0, thread_proc, this) == 0)
+  {
+    threaded = true;
+    return;
+  }
+#endif
+
+  run(); // Not having a thread, we make do with the caller's
+}
+
+void list_order_job::join()
+{
+#ifdef PENGUIN_THREADS
+  if (threaded) pthread_join(thread, 0);
+  threaded = false;
+#endif
+}
+
+// Set however we stop, cancelled or not, and once it is, joining is all but free
+void list_order_job::run()
+{
+  work();
+  finished = true;
+}
+
+void list_order_job::work()
+{
+  const int run_len = 4096;
+  int n = items.size();
+
+  rows.reserve(n);
+  for (int i = 0; i < n; i++)
+  {
+    if (i % run_len == 0)
+    {
+      if (cancelled) return;
+      progress = (int)(333.0 * i / n);
+    }
+
+    if (order.keep(items[i])) rows.push_back(i);
+  }
+
+  int m = rows.size();
+  if (!order.sorts() || m < 2)
+  {
+    progress = 1000;
+    return;
+  }
+
+  comparer c = { &order, &items };
+
+  for (int b = 0; b < m; b += run_len)
+  {
+    if (cancelled) return;
+    progress = 333 + (int)(333.0 * b / m);
+
+    std::stable_sort(rows.begin() + b, rows.begin() + PMAX(b + run_len, m), c);
+  }
+
+  int passes = 0;
+  for (int w = run_len; w < m; w *= 2) passes++;
+
+  std::vector<int> merged(m);
+
+  for (int w = run_len, pass = 0; w < m; w *= 2, pass++)
+  {
+    if (cancelled) return;
+    progress = 666 + 334 * pass / passes;
+
+    for (int lo = 0; lo < m; lo += 2 * w)
+    {
+      if (cancelled) return;
+
+      // As std::merge, but looking out for being cancelled as it goes, since
+      // the last pass merges every row in one go
+      int mid = PMAX(lo + w, m), hi = PMAX(lo + 2 * w, m);
+      int a = lo, b = mid, k = lo;
+
+      while (a < mid && b < hi)
       {
-        cur_sel = -1;
-        transmit(selection_change_ei("", -1));
+        if (k % run_len == 0 && cancelled) return;
+        merged[k++] = c(rows[b], rows[a]) ? rows[b++] : rows[a++];
       }
-      change_list();      
-      break;
+
+      while (a < mid) merged[k++] = rows[a++];
+      while (b < hi) merged[k++] = rows[b++];
     }
+
+    rows.swap(merged);
   }
+
+  progress = 1000;
 }
 
-void window_listbox::remove_item(int n)
+/* Rows of items are kept in step with the items: new items are shown at the
+ * end, and removed ones are taken out wherever they are. */
+static void rows_inserted(std::vector<int>& rows, int first, int n)
+{
+  for (std::vector<int>::size_type i = 0; i < rows.size(); i++)
+    if (rows[i] >= first) rows[i] += n;
+
+  for (int i = first; i < first + n; i++) rows.push_back(i);
+}
+
+static void rows_removed(std::vector<int>& rows, int first, int n)
 {
-  if (n >= 0 && n < list.size())
+  std::vector<int>::size_type kept = 0;
+
+  for (std::vector<int>::size_type i = 0; i < rows.size(); i++)
+  {
+    if (rows[i] >= first + n) rows[kept++] = rows[i] - n;
+    else if (rows[i] < first) rows[kept++] = rows[i];
+  }
+  rows.resize(kept);
+}
+
+static void rows_cut(std::vector<int>& rows, int count)
+{
+  std::vector<int>::size_type kept = 0;
+
+  for (std::vector<int>::size_type i = 0; i < rows.size(); i++)
+    if (rows[i] < count) rows[kept++] = rows[i];
+  rows.resize(kept);
+}
+
+window_listbox::~window_listbox()
+{
+  cancel_order();
+}
+
+void window_listbox::set_source(list_source* s)
+{
+  cancel_order();
+
+  data = source = s ? s : &list;
+  ordered.rows.clear();
+  index.drop();
+  line = 0;
+  vscroll.set_value(0);
+  items_changed();
+
+  if (order) start_order();
+}
+
+// Orders are run by the frame, so we need only listen for frames while we have one
+void window_listbox::set_order(list_order* o)
+{
+  cancel_order();
+  stale = false;
+
+  if (flag(sys_active) && o && !order)
+    listen(*get_manager(), LISTENER(window_listbox::polled, window_manager::poll_ei));
+  else if (flag(sys_active) && !o && order)
+    forget(*get_manager(), LISTENER(window_listbox::polled, window_manager::poll_ei));
+
+  order = o;
+
+  if (order) start_order();
+  else if (source != data)
+  {
+    int sel = data_item(cur_sel);
+
+    source = data;
+    ordered.rows.clear();
+    reordered(sel);
+  }
+}
+
+/* The copy of the items is taken here, on the GUI thread, as the source can't
+ * be asked for them from any other. Built without threads, the order will
+ * have been run by the time it has been started, and is finished at once. */
+void window_listbox::start_order()
+{
+  cancel_order();
+  stale = false;
+
+  job = new list_order_job(*order);
+
+  int n = data->count();
+  job->items.reserve(n);
+  for (int i = 0; i < n; i++) job->items.push_back(data->item(i));
+
+  job->start();
+  if (job->finished) finish_order();
+}
+
+void window_listbox::cancel_order()
+{
+  edits.clear();
+  if (!job) return;
+
+  job->cancelled = true;
+  job->join();
+
+  delete job;
+  job = 0;
+}
+
+/* The rows the order came up with are swapped in whole, and the selection kept
+ * on the item it was on, wherever that has got to. Joining the job's thread
+ * makes sure we see all that it did. Items edited since it started are put
+ * in step first, as they are in the rows we show. */
+void window_listbox::finish_order()
+{
+  job->join();
+
+  for (std::vector<row_edit>::size_type i = 0; i < edits.size(); i++)
+  {
+    const row_edit& e = edits[i];
+
+    if (e.kind == items_in) rows_inserted(job->rows, e.first, e.n);
+    else if (e.kind == items_out) rows_removed(job->rows, e.first, e.n);
+    else rows_cut(job->rows, e.first);
+  }
+  edits.clear();
+
+  int sel = data_item(cur_sel);
+
+  ordered.base = data;
+  ordered.rows.swap(job->rows);
+  source = &ordered;
+
+  delete job;
+  job = 0;
+
+  reordered(sel);
+  transmit(list_order_ei(1000, true));
+}
+
+/* Items that changed since the order started mean starting it again, but not
+ * until it has finished: what it came up with is shown in the meantime, and
+ * then it is started once over the items as they are by then, however many
+ * times they changed while it ran. */
+void window_listbox::polled(const window_manager::poll_ei& ei)
+{
+  if (job && job->finished) finish_order();
+  if (stale && !job) start_order();
+  if (!job) return;
+
+  transmit(list_order_ei(job->progress, false));
+}
+
+void window_listbox::edited(edit_kind kind, int first, int n)
+{
+  if (!order) return;
+
+  stale = true;
+  if (!job) return;
+
+  row_edit e = { kind, first, n };
+  edits.push_back(e);
+}
+
+int window_listbox::row_of(int item) const
+{
+  if (item == -1 || source == data) return item;
+
+  for (std::vector<int>::size_type i = 0; i < ordered.rows.size(); i++)
+    if (ordered.rows[i] == item) return i;
+
+  return -1;
+}
+
+void window_listbox::reordered(int sel_item)
+{
+  int old = cur_sel;
+  cur_sel = row_of(sel_item);
+
+  index.drop();
+  change_list();
+  display();
+
+  if (cur_sel != old) transmit(selection_change_ei(get_item(cur_sel), cur_sel));
+}
+
+/* The selection follows its item about, and is dropped if the item is removed.
+ * Everything from the first row affected down moves, so is drawn again.
+ *
+ * Once an order has been run, the rows are kept in step with the items: new
+ * items are shown at the end until the order has been run again, and removed
+ * ones are taken out wherever they are, so the whole list is drawn again. */
+void window_listbox::items_inserted(int first, int n)
+{
+  edited(items_in, first, n);
+
+  if (source != data)
+  {
+    int sel = data_item(cur_sel);
+    rows_inserted(ordered.rows, first, n);
+
+    reordered((sel >= first) ? sel + n : sel);
+    return;
+  }
+
+  if (cur_sel >= first) cur_sel += n;
+  if (index.valid()) index.inserted(*source, first, n);
+
+  change_list();
+  display_rows(first, -1);
+}
+
+void window_listbox::items_removed(int first, int n)
+{
+  edited(items_out, first, n);
+
+  if (source != data)
+  {
+    int sel = data_item(cur_sel);
+    rows_removed(ordered.rows, first, n);
+
+    reordered((sel >= first + n) ? sel - n : (sel >= first) ? -1 : sel);
+    return;
+  }
+
+  if (index.valid()) index.removed(first, n);
+
+  if (cur_sel >= first + n) cur_sel -= n;
+  else if (cur_sel >= first)
+  {
+    cur_sel = -1;
+    transmit(selection_change_ei("", -1));
+  }
+
+  change_list();
+  display_rows(first, -1);
+}
+
+void window_listbox::items_changed(int first, int n)
+{
+  if (n == -1) edited(items_cut, data->count(), 0); // There may be fewer items than there were
+  else if (order) stale = true;
+
+  if (source != data)
   {
-    list.erase(list.begin() + n);
-    if (n == cur_sel) 
+    int sel = data_item(cur_sel);
+
+    if (n == -1)
     {
-      cur_sel = -1;
-      transmit(selection_change_ei("", -1));
+      rows_cut(ordered.rows, data->count());
+      if (sel >= data->count()) sel = -1;
     }
-    change_list();
+
+    reordered(sel);
+    return;
+  }
+
+  if (n == -1) index.drop(); // Built again when next needed
+  else if (index.valid()) index.changed(*source, first, n);
+
+  if (cur_sel >= source->count())
+  {
+    cur_sel = -1;
+    transmit(selection_change_ei("", -1));
   }
+
+  change_list();
+  display_rows(first, (n == -1) ? -1 : first + n);
+}
+    
+void window_listbox::add_item(const std::string& s)
+{
+  insert_items(list.count(), std::vector<std::string>(1, s));
+} 
+
+void window_listbox::add_items(const std::vector<std::string>& s)
+{
+  insert_items(list.count(), s);
+}
+
+void window_listbox::insert_items(int at, const std::vector<std::string>& s)
+{
+  if (data != &list || s.empty()) return;
+
+  if (at < 0 || at > list.count()) at = list.count();
+  list.items.insert(list.items.begin() + at, s.begin(), s.end());
+
+  items_inserted(at, s.size());
+}
+
+void window_listbox::remove_item(const std::string& s)
+{
+  if (data != &list) return;
+
+  for (int n = 0; n < list.count(); n++)
+  {
+    if (list.items[n] == s) 
+    {
+      remove_items(n, 1);
+      break;
+    }
+  }
+}
+
+void window_listbox::remove_item(int n)
+{
+  remove_items(n, 1);
+}
+
+void window_listbox::remove_items(int first, int n)
+{
+  if (data != &list || first < 0 || first >= list.count()) return;
+
+  if (n > list.count() - first) n = list.count() - first;
+  list.items.erase(list.items.begin() + first, list.items.begin() + first + n);
+
+  items_removed(first, n);
 }
 
 void window_listbox::clear_list()
 {
-  list.clear();
+  if (data != &list) return;
+
+  edited(items_cut, 0, 0);
+
+  list.items.clear();
+  ordered.rows.clear();
+  index.drop();
   cur_sel = -1;
   transmit(selection_change_ei("", -1));
+
   change_list();
+  display();
 }
 
+/* Sizes the scrollbar to the list, showing it only if the list won't fit. The
+ * scrollbar pulls its value back in range if the list has shrunk, and tells
+ * us, which redraws everything anyway. */
 void window_listbox::change_list()
 {
   if (!flag(sys_active)) return;
 
-  int max_lines = (h()-4) / (text_height(theme().font)+1);
+  int max_lines = (h()-4) / row_h();
+  int n = source->count();
   
-  if (!vscroll.flag(vis_visible) && list.size() > max_lines)              
+  if (n > max_lines)              
   {
-    vscroll.set_max(list.size() - max_lines);
     vscroll.set_page_step(max_lines);
+    vscroll.set_max(n - max_lines);
     vscroll.show();
-    line = 0;
-    
-    
-  } else if (list.size() < max_lines)
+  } else
   {
+    line = 0;
+    vscroll.set_value(0);
     vscroll.hide();  
   }
-  
-      
-  display();
 }
 
 void window_listbox::pre_load()
@@ -1002,22 +1552,24 @@ void window_listbox::pre_load()
 
 void window_listbox::post_load()
 { 
-  if (list.size()) change_list();
+  if (order) listen(*get_manager(), LISTENER(window_listbox::polled, window_manager::poll_ei));
+  if (source->count()) change_list();
+}
+
+void window_listbox::pre_unload()
+{
+  if (order) forget(*get_manager(), LISTENER(window_listbox::polled, window_manager::poll_ei));
 }
 
 void window_listbox::select(int n)
 {
-  if (n >= 0 && n < list.size())
+  if (n >= 0 && n < source->count())
   {
-    cur_sel = n;
-    display();
-    
-    transmit(selection_change_ei(list[cur_sel], cur_sel));
+    change_selection(n);
+    transmit(selection_change_ei(source->item(cur_sel), cur_sel));
   } else
   {
-    cur_sel = -1;
-    display();
-    
+    change_selection(-1);
     transmit(selection_change_ei("", -1));
   }
 }
@@ -1029,25 +1581,24 @@ void window_listbox::set_value(int v)
 
 void window_listbox::set_text(const std::string& str)
 {
-  for (int n = 0; n < list.size(); n++)
+  for (int n = 0; n < source->count(); n++)
   {
-    if (list[n] == str)
+    if (source->item(n) == str)
     {
       select(n);
       return;
     }
   }
   
-  cur_sel = list.size();
-  list.push_back(str);    
-  change_list();  
-  
-  transmit(selection_change_ei(list[cur_sel], cur_sel));
+  if (data != &list) return;
+
+  add_item(str);
+  select(row_of(list.count() - 1));
 }
 
 std::string window_listbox::get_item(int n)
 { 
-  return (n >= 0 && n < list.size()) ? list[n] : ""; 
+  return (n >= 0 && n < source->count()) ? source->item(n) : ""; 
 }
 
 void window_listbox::position_children()
@@ -1062,85 +1613,109 @@ void window_listbox::event_mouse_down(bt_int button)
   
   if (!(button & bt_snoop))
   {   
-    int index = (get_click_y()-2) / (text_height(theme().font)+1) + line;
+    int index = (get_click_y()-2) / row_h() + line;
     
-    if (index >= 0 && index < list.size() && index != cur_sel)
+    if (index >= 0 && index < source->count() && index != cur_sel)
     {
-      cur_sel = index;
-      display();  
-      
-      transmit(selection_change_ei(list[cur_sel], cur_sel));
+      change_selection(index);
+      transmit(selection_change_ei(source->item(cur_sel), cur_sel));
     }
   }
 }  
 
+// Moving the selection within the view redraws just the two rows; moving it
+// out of view scrolls, which redraws the lot
+void window_listbox::show_selection(int n)
+{
+  int page = vscroll.flag(vis_visible) ? vscroll.get_page_step() : source->count();
+  int top = line;
+
+  if (n >= line + page) top = n - page + 1;
+  else if (n < line) top = n;
+
+  if (top == line) change_selection(n);
+  else
+  {
+    cur_sel = n;
+    vscroll.set_value(top);
+  }
+}
+
 void window_listbox::event_key_down(kb_event key)
 {
   if (key.is_scan(pk_up))
   {
     if (cur_sel > 0) 
     {
-      cur_sel--;
-      
-      if (cur_sel >= line+vscroll.get_page_step()) vscroll.set_value(cur_sel - vscroll.get_page_step() + 1);
-      else if (cur_sel < line) vscroll.set_value(cur_sel);
-      else display();
-      
-      transmit(selection_change_ei(list[cur_sel], cur_sel));
+      show_selection(cur_sel - 1);
+      transmit(selection_change_ei(source->item(cur_sel), cur_sel));
     }    
   } else if (key.is_scan(pk_down))
   {
-    if (cur_sel < list.size()-1) 
+    if (cur_sel < source->count()-1) 
     {
-      cur_sel++;
-      
-      if (cur_sel >= line+vscroll.get_page_step()) vscroll.set_value(cur_sel - vscroll.get_page_step() + 1);
-      else if (cur_sel < line) vscroll.set_value(cur_sel);
-      else display();
-      
-      transmit(selection_change_ei(list[cur_sel], cur_sel));
+      show_selection(cur_sel + 1);
+      transmit(selection_change_ei(source->item(cur_sel), cur_sel));
     }
   } else if (key.is_scan(pk_enter))
   {
-    transmit(selection_change_ei(list[cur_sel], cur_sel));
+    if (cur_sel > -1) transmit(selection_change_ei(source->item(cur_sel), cur_sel));
   
   } else if (char c = key.get_char())
   {
-    for (int n = 0; n < list.size(); n++)
+    // Keys typed within about a second of each other build up a prefix to
+    // search for, and backspace takes the last one off again
+    if (retrace_count - typed_at > 70) typed.clear();
+    typed_at = retrace_count;
+
+    if (c == 8) 
     {
-      if (list[n][0] == c)
-      { 
-        cur_sel = n;
-        display();
-        
-        transmit(selection_change_ei(list[cur_sel], cur_sel));
-        break;
-      }
+      if (!typed.empty()) typed.erase(typed.length() - 1);
+    } else typed += c;
+
+    if (!index.valid()) index.build(*source);
+    int n = typed.empty() ? -1 : index.find(typed);
+
+    if (n != -1 && n != cur_sel)
+    { 
+      show_selection(n);
+      transmit(selection_change_ei(source->item(n), n));
     }
   } else base_widget::event_key_down(key);
 }
 
 window_image::window_image(std::string file, display_method m)
-: image(0), method(m)
+: image(0)
 {
   PALETTE pal;
   image = load_bmp(file.c_str(), pal);
     ASSERT(image);
+  change_method(m);
 }
 
 window_image::window_image(BITMAP* bmp, display_method m)
-: image(0), method(m)
+: image(0)
 {
   if (bmp)
   {
     image = create_bitmap_ex(bitmap_color_depth(bmp), bmp->w, bmp->h);
     if (image) blit(bmp, image, 0, 0, 0, 0, bmp->w, bmp->h);
   }
+  change_method(m);
 }
 
 window_image::window_image()
-: image(0), method(centre)
+: image(0)
 {
+  change_method(centre);
+}
+
+// Allegro's stretch_blit keeps its state in statics, so only images that
+// aren't stretched can be drawn on any thread
+void window_image::change_method(display_method m)
+{
+  method = m;
+  set_flag(grx_thread_safe, m != stretch);
 }
 
 window_image::~window_image()
@@ -1238,7 +1813,7 @@ void window_image::load(BITMAP* bmp, display_method m)
     set_image(bmp);
   }
   
-  method = m;
+  change_method(m);
   display();
 }
 
@@ -1257,13 +1832,13 @@ void window_image::load(std::string file, display_method m)
     set_image(bmp);
   }
   
-  method = m;
+  change_method(m);
   display();
 }
 
 void window_image::set_method(display_method m)
 {
-  method = m;
+  change_method(m);
   display();
 }
 
@@ -1408,5 +1983,6 @@ window_pane::window_pane(base_window& c, scrollstate h, scrollstate v)
   add_child(hscroll);
   add_child(vscroll);
   add_child(corner_block);
+  set_flag(grx_thread_safe);
 }
  
@@ -2,6 +2,8 @@
 #define PWIDGETS_H
 
 #include <string>
+#include <deque>
+#include <map>
 
 #include "pbasewin.h"
 #include "pmanager.h"
@@ -15,6 +17,7 @@
  */
 class window_placer : public base_window
 {
+  DEFINE_WINDOW_SIZE(window_placer)
   public:
   
     window_placer(coord_int width =0, coord_int height =0)
@@ -23,6 +26,7 @@ class window_placer : public base_window
 
 class window_block : public base_window
 {
+  DEFINE_WINDOW_SIZE(window_block)
   private:
   
     void draw(const graphics_context& grx);    
@@ -39,7 +43,8 @@ class window_block : public base_window
 };  
 
 class window_container : public base_window
-{    
+{
+  DEFINE_WINDOW_SIZE(window_container)
   public:
   
     using base_window::add_child;
@@ -50,14 +55,21 @@ class window_container : public base_window
 
 class window_panel : public window_container
 {
+  DEFINE_WINDOW_SIZE(window_panel)
   private:
   
     bool pos_visible(coord_int x, coord_int y) const;
     void draw(const graphics_context& grx);
+    
+  public:
+  
+    window_panel()
+    { set_flag(grx_thread_safe); }
 };
 
 class window_frame : public window_container
 {
+  DEFINE_WINDOW_SIZE(window_frame)
   private:
   
     void draw(const graphics_context& grx);
@@ -75,11 +87,12 @@ class window_frame : public window_container
   
     window_frame(frame_type f =ft_bevel_in)
     : frame(f)
-    { }
+    { set_flag(grx_thread_safe); }
 };
 
 class window_lframe : public window_container
 {
+  DEFINE_WINDOW_SIZE(window_lframe)
   private:
   
     void draw(const graphics_context& grx);
@@ -112,6 +125,7 @@ class window_lframe : public window_container
 
 class window_main : public window_frame
 {
+  DEFINE_WINDOW_SIZE(window_main)
   protected:
 
     std::string title;
@@ -139,6 +153,7 @@ class window_main : public window_frame
 
 class base_widget : public base_window
 {
+  DEFINE_WINDOW_SIZE(base_widget)
   private:
   
     // Should be set to give a description of the purpose of the widget. 
@@ -208,6 +223,7 @@ struct string_input_ei : public input_ei
 
 class base_button : public base_widget
 {
+  DEFINE_WINDOW_SIZE(base_button)
   private:
   
     void draw(const graphics_context& grx);
@@ -251,6 +267,7 @@ class base_button : public base_widget
 
 class window_button : public base_button
 {
+  DEFINE_WINDOW_SIZE(window_button)
   protected:
 
     void event_key_down(kb_event kd);
@@ -269,6 +286,7 @@ class window_button : public base_button
 
 class window_icon : public window_button
 {
+  DEFINE_WINDOW_SIZE(window_icon)
   private:
   
     void draw(const graphics_context& grx);
@@ -280,7 +298,7 @@ class window_icon : public window_button
   public:
   
     window_icon(BITMAP* i =0) : icon(i)
-    { }
+    { set_flag(grx_thread_safe); }
     
     void set_icon(BITMAP* i) { icon = i; display(); }
     BITMAP* get_icon() const { return icon; }
@@ -289,6 +307,7 @@ class window_icon : public window_button
 
 class window_toggle : public base_button
 {
+  DEFINE_WINDOW_SIZE(window_toggle)
   protected:
   
     void event_key_down(kb_event kd);
@@ -306,7 +325,8 @@ class window_toggle : public base_button
 };    
 
 class window_label : public base_widget
-{          
+{
+  DEFINE_WINDOW_SIZE(window_label)
   private:
 
     void draw(const graphics_context& grx);
@@ -316,16 +336,23 @@ class window_label : public base_widget
     std::string text;
     frame_type frame;
     bool multiline;
+
+    text_layout breaks; // Where our text's lines break, if we are multiline
+
+    // The area our text is drawn in, and where its lines break there
+    zone text_zone() const { return zone(2,2,w()-2,h()-2); }
+    const text_layout& text_lines();
   
   public:
   
     window_label(const std::string& t = "", bool multi =false, frame_type f =ft_shallow_in)
     : base_widget(false), text(t), frame(f), multiline(multi)
-    { }
+    { breaks.set_text(text); }
   
     void set_text(const std::string& s)
     {
       text = s;
+      breaks.set_text(text);
       display();
     }
     
@@ -336,6 +363,7 @@ class window_label : public base_widget
 
 class window_scrollbar : public base_widget
 {
+  DEFINE_WINDOW_SIZE(window_scrollbar)
   private:
   
     void draw(const graphics_context& grx);
@@ -362,7 +390,8 @@ class window_scrollbar : public base_widget
     void event_mouse_up(bt_int button);
   
     class slider_bar : public base_window
-    {   
+    {
+      DEFINE_WINDOW_SIZE(slider_bar)
       private:
 
         void draw(const graphics_context& grx);
@@ -434,6 +463,7 @@ struct scroll_ei : public int_input_ei
 
 class window_image : public base_window
 {
+  DEFINE_WINDOW_SIZE(window_image)
   public: // TODO: Add arbitrary alignment
   
     enum display_method
@@ -459,6 +489,7 @@ class window_image : public base_window
     display_method method;
     
     void pre_load();
+    void change_method(display_method m);
     
   private:
   
@@ -470,6 +501,7 @@ class window_image : public base_window
 
 class window_canvas : public base_window
 {
+  DEFINE_WINDOW_SIZE(window_canvas)
   public:
   
     const graphics_context context();    
@@ -493,6 +525,7 @@ class window_canvas : public base_window
   
 class window_checkbox : public window_label
 {
+  DEFINE_WINDOW_SIZE(window_checkbox)
   private:
   
     bool state;
@@ -519,6 +552,7 @@ class window_checkbox : public window_label
 
 class window_radiobutton : public window_label
 {
+  DEFINE_WINDOW_SIZE(window_radiobutton)
   private:
     
     bool state;
@@ -546,13 +580,14 @@ class window_radiobutton : public window_label
 
 class window_textbox : public base_widget
 {
+  DEFINE_WINDOW_SIZE(window_textbox)
   private:
   
     void draw(const graphics_context& grx);
     
   protected:
    
-    std::string text;
+    text_buffer text;
     int lines;
     int line;
     unsigned int edit_pos;
@@ -560,6 +595,25 @@ class window_textbox : public base_widget
     bool wordwrap;
         
     window_scrollbar vscroll;
+
+    text_layout breaks; // Where our text's lines break, if we are multiline
+
+    struct snapshot
+    {
+      text_buffer text;
+      unsigned int edit_pos;
+    };
+
+    std::deque<snapshot> history; // Our text before each recent edit, newest last
+
+    // The area our text is drawn in, and where its lines break there
+    zone text_zone() const { return zone(2,2,w()-2-(vscroll.flag(vis_visible)?16:0),h()-2); }
+    const text_layout& text_lines();
+    int line_to_char(int l); // The first character on line 'l', counting from 1
+
+    void edit_text(int pos, int removed, const std::string& s);
+    void show_edit(int old_caret, bool edited); // Redraws what an edit changed, and tells listeners
+    void display_lines(int first, int last); // Redraws lines 'first' up to 'last', or to the bottom if -1
         
     void event_mouse_down(bt_int button);
     void event_mouse_on() { set_cursor(cursor_caret); }
@@ -588,6 +642,7 @@ class window_textbox : public base_widget
     { 
       if (multiline) add_child(vscroll); 
       set_flag(evt_snoop_clicks); 
+      breaks.set_text(text);
     }
     
     int get_value() const 
@@ -597,22 +652,28 @@ class window_textbox : public base_widget
     
     void set_text(const std::string& s)
     {
-      text = s;
+      text.assign(s);
+      breaks.set_text(text);
+      history.clear();
       change_text();
       display();
     }
     
     std::string get_text() const
     {
-      return text;
+      return text.str();
     }
     
     void reset()
     { 
-      text = "";
-      change_text();
-      display();
+      set_text("");
     }
+
+    void append(const std::string& s); // Adds to the end of the text
+    void insert(const std::string& s); // Adds at the caret, moving it past what was added
+
+    bool can_undo() const { return !history.empty(); }
+    void undo(); // Takes back the last edit, which CTRL-Z also does
     
     coord_int e_ax() const { return 2; }
     coord_int e_ay() const { return 2; }
@@ -623,8 +684,101 @@ class window_textbox : public base_widget
     coord_int normal_h() const { return 23; }
 };           
 
+/* A list_source supplies the items shown by a window_listbox. The listbox only
+ * asks for the items it is drawing, or whose text it is sending in an event,
+ * so a source can stand in front of any amount of data without it having to
+ * be copied in.
+ */
+class list_source
+{
+  public:
+
+    virtual int count() const = 0;                 // The number of items
+    virtual std::string item(int i) const = 0;     // The text of item i
+
+    virtual ~list_source() { }
+};
+
+// The source a listbox has of its own, which holds the items it is given
+class string_list_source : public list_source
+{
+  public:
+
+    std::vector<std::string> items;
+
+    int count() const { return items.size(); }
+    std::string item(int i) const { return items[i]; }
+};
+
+/* An index of a source's items in order of their text, regardless of case, for
+ * finding the first item that starts with some prefix in O(log n). It is kept
+ * up to date through the same notifications a listbox gets, without going back
+ * to the source for anything but new items; only inserting or removing items
+ * other than at the end has to renumber those after them.
+ */
+class prefix_index
+{
+  private:
+
+    typedef std::multimap<std::string, int> key_map;
+
+    key_map keys;                         // Each item's folded text, to the item
+    std::vector<key_map::iterator> items; // Each item's entry in 'keys'
+    bool built;
+
+    static std::string fold(const std::string& s);
+    void shift(int first, int n); // Renumbers the items from 'first' on by n
+
+  public:
+
+    bool valid() const { return built; }
+    void build(const list_source& s);
+    void drop();
+
+    void inserted(const list_source& s, int first, int n);
+    void removed(int first, int n);
+    void changed(const list_source& s, int first, int n);
+
+    int find(const std::string& prefix) const; // An item starting with 'prefix', or -1
+
+    prefix_index() : built(false) { }
+};
+
+/* A list_order picks out and arranges the items a listbox shows, by their
+ * text. It is run on a worker thread, over a copy of the items taken when it
+ * starts, so its functions must be safe to call from another thread, and must
+ * not look at the listbox or its source.
+ */
+class list_order
+{
+  public:
+
+    virtual bool keep(const std::string& item) const { return true; } // Whether to show it
+    virtual bool before(const std::string& a, const std::string& b) const { return false; }
+    virtual bool sorts() const { return true; } // False if 'before' need not be asked
+
+    virtual ~list_order() { }
+};
+
+// The items of a source, as picked out and arranged by a list_order
+class ordered_source : public list_source
+{
+  public:
+
+    list_source* base;
+    std::vector<int> rows; // The item of 'base' shown on each row
+
+    int count() const { return rows.size(); }
+    std::string item(int i) const { return base->item(rows[i]); }
+
+    ordered_source() : base(0) { }
+};
+
+class list_order_job;
+
 class window_listbox : public base_widget
 {
+  DEFINE_WINDOW_SIZE(window_listbox)
   private:
   
     void draw(const graphics_context& grx);
@@ -632,10 +786,46 @@ class window_listbox : public base_widget
   protected:  
   
     int cur_sel;
-    std::vector<std::string> list;
+    string_list_source list; // Our own items, used unless we are given a source
+    list_source* data;       // Where our items come from
+    ordered_source ordered;  // Those items as our order last left them
+    list_source* source;     // What we show: 'data', or 'ordered' once an order has run
     window_scrollbar vscroll;
     int line;
+
+    enum edit_kind { items_in, items_out, items_cut }; // Cuts leave the first 'first' items
+
+    struct row_edit
+    {
+      edit_kind kind;
+      int first;
+      int n;
+    };
+
+    list_order* order;   // What arranges our items, if anything
+    list_order_job* job; // The order being run, if it is
+    bool stale;          // Our items have changed since the order last started
+    std::vector<row_edit> edits; // Made while the order ran, for its rows to catch up with
+
+    prefix_index index; // Our items by their text, built the first time it is needed
+    std::string typed;  // What has been typed, for searching the index
+    int typed_at;       // When the last key of it was typed, in retraces
     
+    coord_int row_h() const; // Height of each item's row
+    void display_rows(int first, int last); // Redraws rows 'first' up to 'last', or to the bottom if -1
+    void change_selection(int n);           // Selects n, redrawing just the two rows
+    void show_selection(int n);             // As above, scrolling n into view if need be
+
+    int data_item(int row) const { return (row == -1 || source == data) ? row : ordered.rows[row]; }
+    int row_of(int item) const;        // The row showing an item of 'data', or -1
+    void reordered(int sel_item);      // Shows 'source' afresh, with that item still selected
+
+    void start_order();  // Runs our order over a copy of our items
+    void cancel_order();
+    void finish_order(); // Shows what the order came up with
+    void polled(const window_manager::poll_ei& ei); // Watches over the order each frame
+    void edited(edit_kind kind, int first, int n);  // Marks the order stale, noting the edit
+
     void event_mouse_down(bt_int button);
     void event_key_down(kb_event kb);
     
@@ -650,6 +840,7 @@ class window_listbox : public base_widget
     
     void pre_load();    
     void post_load();
+    void pre_unload();
     
     void scrolled(const scroll_ei& ei)
     {        
@@ -660,22 +851,51 @@ class window_listbox : public base_widget
   public:
   
     std::string get_item(int n);
+    int count() const { return source->count(); } // The number of rows shown
     void select(int n);
-    
+
+    /* Shows the items of another source, or of our own list again if 's' is 0.
+       The source is not ours to delete, and must outlive its use by us. */
+    void set_source(list_source* s);
+    list_source* get_source() const { return data; }
+
+    /* Filters and sorts our items by the order, or shows them all as they come
+       if it is 0. The order is run in the background, and a list_order_ei is
+       sent each frame until it has finished, when its result is swapped in
+       all at once. Whenever the items change, the rows already shown are kept
+       in step, and the order is run again. Rows, as used by 'select' and the
+       like, are then counted in the order's arrangement, while the functions
+       below still take the positions of items in the source. */
+    void set_order(list_order* o);
+    list_order* get_order() const { return order; }
+    bool ordering() const { return job != 0; } // Whether the order is still running
+
+    // A source whose items have changed should tell us which ones, so that we
+    // can fix the selection, size the scrollbar once, and redraw only from there
+    void items_inserted(int first, int n);
+    void items_removed(int first, int n);
+    void items_changed(int first =0, int n =-1); // Rewritten in place, all by default
+
+    // These edit our own list, and do nothing while we are showing another source
     void add_item(const std::string& s);
+    void add_items(const std::vector<std::string>& s);
+    void insert_items(int at, const std::vector<std::string>& s);
     void remove_item(const std::string& s);
     void remove_item(int n);
+    void remove_items(int first, int n);
     void clear_list();   
         
     int get_value() const { return cur_sel; }
-    std::string get_text() const { return (cur_sel > -1) ? list[cur_sel] : ""; }
+    std::string get_text() const { return (cur_sel > -1) ? source->item(cur_sel) : ""; }
     
     void set_value(int v);
     void set_text(const std::string& str);
     
     window_listbox()
-    : base_widget(true), cur_sel(-1), vscroll(hv_vertical), line(0)
+    : base_widget(true), cur_sel(-1), data(&list), source(&list), vscroll(hv_vertical), line(0),
+      order(0), job(0), stale(false), typed_at(0)
     { add_child(vscroll); set_flag(evt_snoop_clicks); }    
+    ~window_listbox();
 };      
 
 struct selection_change_ei : public string_input_ei
@@ -688,8 +908,19 @@ struct selection_change_ei : public string_input_ei
   { }
 };
 
+struct list_order_ei : public input_ei // A listbox's order is running, or has finished
+{ DEFINE_EI(list_order_ei, input_ei)
+
+  const int progress; // How far it has got, in thousandths
+  const bool done;
+
+  list_order_ei(int p, bool d) : progress(p), done(d)
+  { }
+};
+
 class window_pane : public base_window
 {
+  DEFINE_WINDOW_SIZE(window_pane)
   public:
   
     coord_int e_ax() const { return 2; }
@@ -0,0 +1,236 @@
+#include "pwork.h"
+
+#ifdef PENGUIN_THREADS
+#include <unistd.h> // For sysconf, to count processors
+#endif
+
+#ifdef PENGUIN_THREADS
+
+// The worker threads are passed this, so they know which pool and queue is theirs
+struct work_thread_info
+{
+  work_pool* pool;
+  int home;
+};
+
+work_pool::work_pool(int n)
+: queued(0), next_queue(0), stopping(false)
+{
+  if (n < 0)
+  {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    n = (cpus > 1) ? int(cpus - 1) : 0;
+  }
+
+  pthread_mutex_init(&lock, 0);
+  pthread_cond_init(&work_cond, 0);
+  pthread_cond_init(&done_cond, 0);
+
+  // All the queues must exist before any worker starts looking for work to steal
+  for (int i = 0; i < n; i++)
+  {
+    work_queue* q = new work_queue;
+    pthread_mutex_init(&q->lock, 0);
+    queues.push_back(q);
+  }
+
+  for (int i = 0; i < n; i++)
+  {
+    pthread_t thread;
+    work_thread_info* info = new work_thread_info;
+    info->pool = this;
+    info->home = i;
+
+    if (pthread_create(&thread, 0, worker_main, info) == 0) threads.push_back(thread);
+    else delete info;
+  }
+}
+
+work_pool::~work_pool()
+{
+  pthread_mutex_lock(&lock);
+  stopping = true;
+  pthread_cond_broadcast(&work_cond);
+  pthread_mutex_unlock(&lock);
+
+  for (std::vector<pthread_t>::size_type i = 0; i < threads.size(); i++)
+    pthread_join(threads[i], 0);
+
+  for (std::vector<work_queue*>::size_type i = 0; i < queues.size(); i++)
+  {
+    pthread_mutex_destroy(&queues[i]->lock);
+    delete queues[i];
+  }
+
+  pthread_cond_destroy(&done_cond);
+  pthread_cond_destroy(&work_cond);
+  pthread_mutex_destroy(&lock);
+}
+
+int work_pool::workers() const
+{
+  return threads.size();
+}
+
+/* Finds the next item to run. A worker looks at the back of its own queue first,
+ * since the most recently queued work is the most likely to still be in cache,
+ * and then tries to steal from the front of every other queue in turn. Threads
+ * from outside the pool pass -1, and so only ever steal.
+ */
+work_item* work_pool::take(int home)
+{
+  work_item* item = 0;
+
+  if (home >= 0)
+  {
+    work_queue* q = queues[home];
+    pthread_mutex_lock(&q->lock);
+    if (!q->items.empty())
+    {
+      item = q->items.back();
+      q->items.pop_back();
+    }
+    pthread_mutex_unlock(&q->lock);
+  }
+
+  int n = queues.size();
+  for (int i = 1; !item && i <= n; i++)
+  {
+    work_queue* q = queues[(home + i + n) % n];
+    pthread_mutex_lock(&q->lock);
+    if (!q->items.empty())
+    {
+      item = q->items.front();
+      q->items.pop_front();
+    }
+    pthread_mutex_unlock(&q->lock);
+  }
+
+  if (item)
+  {
+    pthread_mutex_lock(&lock);
+    queued--;
+    pthread_mutex_unlock(&lock);
+  }
+
+  return item;
+}
+
+// Runs the item, and wakes anyone waiting if that was the last one in its batch
+void work_pool::finish(work_item* item)
+{
+  work_batch* batch = item->batch;
+  item->run();
+
+  if (__sync_sub_and_fetch(&batch->pending, 1) == 0)
+  {
+    pthread_mutex_lock(&lock);
+    pthread_cond_broadcast(&done_cond);
+    pthread_mutex_unlock(&lock);
+  }
+}
+
+void* work_pool::worker_main(void* arg)
+{
+  work_thread_info* info = static_cast<work_thread_info*>(arg);
+  work_pool& pool = *info->pool;
+  int home = info->home;
+  delete info;
+
+  while (true)
+  {
+    if (work_item* item = pool.take(home))
+    {
+      pool.finish(item);
+      continue;
+    }
+
+    // Nothing to be had anywhere, so sleep until something is queued
+    pthread_mutex_lock(&pool.lock);
+    while (!pool.queued && !pool.stopping) pthread_cond_wait(&pool.work_cond, &pool.lock);
+    bool stop = pool.stopping && !pool.queued;
+    pthread_mutex_unlock(&pool.lock);
+
+    if (stop) break;
+  }
+
+  return 0;
+}
+
+void work_pool::submit(work_batch& batch, work_item* item)
+{
+  item->batch = &batch;
+  __sync_add_and_fetch(&batch.pending, 1);
+
+  // Without any workers we might as well just get on with it
+  if (queues.empty())
+  {
+    finish(item);
+    return;
+  }
+
+  pthread_mutex_lock(&lock);
+  work_queue* q = queues[next_queue];
+  next_queue = (next_queue + 1) % queues.size();
+  pthread_mutex_unlock(&lock);
+
+  pthread_mutex_lock(&q->lock);
+  q->items.push_back(item);
+  pthread_mutex_unlock(&q->lock);
+
+  pthread_mutex_lock(&lock);
+  queued++;
+  pthread_cond_signal(&work_cond);
+  pthread_mutex_unlock(&lock);
+}
+
+/* The waiting thread doesn't just sleep: it steals work like any worker, which
+ * means a batch can still be waited on from inside another item without the
+ * pool deadlocking, and that the caller's own processor is put to use.
+ */
+void work_pool::wait(work_batch& batch)
+{
+  while (!batch.done())
+  {
+    if (work_item* item = take(-1))
+    {
+      finish(item);
+      continue;
+    }
+
+    pthread_mutex_lock(&lock);
+    while (!batch.done() && !queued) pthread_cond_wait(&done_cond, &lock);
+    pthread_mutex_unlock(&lock);
+  }
+}
+
+#else // PENGUIN_THREADS
+
+work_pool::work_pool(int)
+{ }
+
+work_pool::~work_pool()
+{ }
+
+int work_pool::workers() const
+{
+  return 0;
+}
+
+// Without threads, items are simply run on the spot
+void work_pool::submit(work_batch& batch, work_item* item)
+{
+  item->batch = &batch;
+  item->run();
+}
+
+void work_pool::wait(work_batch&)
+{ }
+
+#endif // PENGUIN_THREADS
+
+work_pool& penguin_pool()
+{
+  static work_pool pool;
+  return pool;
+}
@@ -0,0 +1,115 @@
+#ifndef PWORK_H
+#define PWORK_H
+
+#include "pdefs.h"
+
+#ifdef PENGUIN_THREADS
+#include <pthread.h>
+#include <deque>
+#include <vector>
+#endif
+
+class work_pool;
+class work_batch;
+
+/* A single unit of work to be handed to a work_pool. Derived classes override
+ * 'run' to do whatever they need to; the pool never deletes an item, so they
+ * can happily live on the stack of whoever submits them, as long as that caller
+ * waits on the batch before they go out of scope.
+ */
+class work_item
+{
+  private:
+
+    work_batch* batch; // The batch we belong to, told when we are finished
+
+  public:
+
+    virtual void run() = 0;
+    virtual ~work_item() { }
+
+    work_item() : batch(0) { }
+
+    friend class work_pool;
+};
+
+/* A batch is simply a count of submitted items that have not yet finished. The
+ * submitter waits on it through 'work_pool::wait', which will also run queued
+ * items itself rather than sit idle.
+ */
+class work_batch
+{
+  private:
+
+    volatile int pending; // Items submitted to this batch but not yet run
+
+  public:
+
+    bool done() const { return pending == 0; }
+
+    work_batch() : pending(0) { }
+
+    friend class work_pool;
+};
+
+/* Work-stealing thread pool. Each worker thread owns a queue: it takes work from
+ * the back of its own queue, and when that runs dry it steals from the front of
+ * the others. Submissions from outside the pool are dealt round-robin over the
+ * queues so that an even spread of work is available from the start.
+ *
+ * If Penguin is built without PENGUIN_THREADS, the pool has no workers and
+ * 'submit' runs each item immediately on the calling thread. Code using the
+ * pool therefore doesn't need to care which build it is in, it only needs to
+ * make sure that its items don't touch each other's data.
+ */
+class work_pool
+{
+  private:
+
+#ifdef PENGUIN_THREADS
+    struct work_queue
+    {
+      pthread_mutex_t lock;
+      std::deque<work_item*> items;
+    };
+
+    std::vector<work_queue*> queues;   // One queue per worker
+    std::vector<pthread_t> threads;    // The workers themselves
+
+    pthread_mutex_t lock;     // Guards 'queued', 'stopping' and both conditions
+    pthread_cond_t work_cond; // Signalled whenever new work is queued
+    pthread_cond_t done_cond; // Broadcast whenever a batch drains
+
+    int queued;      // Number of items sitting in queues
+    int next_queue;  // Next queue an external submission will go to
+    bool stopping;   // Set when the workers should exit
+
+    work_item* take(int home); // Pops from our own queue, or steals from another
+    void finish(work_item* item); // Runs an item and informs its batch
+
+    static void* worker_main(void* arg);
+#endif
+
+    work_pool(const work_pool&)
+    { throw illegal_operation_exception(); }
+
+  public:
+
+    // Hand an item to the pool, counting it against the given batch
+    void submit(work_batch& batch, work_item* item);
+
+    // Block until every item in the batch has been run, helping out meanwhile
+    void wait(work_batch& batch);
+
+    int workers() const; // Number of worker threads, 0 if none
+
+    // Creates the pool with the given number of workers. Passing -1 will start
+    // one fewer worker than there are processors, as the caller helps out too.
+    work_pool(int n =-1);
+    ~work_pool();
+};
+
+// Returns the pool shared by the whole GUI, creating it on first use
+work_pool& penguin_pool();
+
+#endif
@@ -0,0 +1,445 @@
+#include "pzarray.h"
+
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define PZ_SSE2
+#endif
+
+// AVX2 needs a compiler that can target it a function at a time, so that the
+// rest of the library still runs on processors without it.
+#if defined(PZ_SSE2) && defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#include <immintrin.h>
+#define PZ_AVX2
+#define PZ_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+// The kernels all take the four co-ordinate arrays, their length, the mask and
+// the output, and return the number of zones the test held for.
+typedef int (*zone_test_kernel)(const coord_int*, const coord_int*, const coord_int*, const coord_int*, int, const zone&, unsigned char*);
+typedef int (*zone_clip_kernel)(coord_int*, coord_int*, coord_int*, coord_int*, int, const zone&, signed char*);
+
+struct zone_kernels
+{
+  zone_test_kernel overlapping;
+  zone_test_kernel contained;
+  zone_clip_kernel clip;
+  const char* name;
+};
+
+/* The plain versions. These are used on processors without SSE2, and by the
+   others to finish off whatever is left over after the last full vector. */
+
+static int scalar_overlapping(const coord_int* ax, const coord_int* ay, const coord_int* bx, const coord_int* by, int n, const zone& m, unsigned char* out)
+{
+  int hits = 0;
+  for (int i = 0; i < n; i++)
+    hits += out[i] = !(m.ax > bx[i] || m.bx < ax[i] || m.ay > by[i] || m.by < ay[i]);
+  return hits;
+}
+
+static int scalar_contained(const coord_int* ax, const coord_int* ay, const coord_int* bx, const coord_int* by, int n, const zone& m, unsigned char* out)
+{
+  int hits = 0;
+  for (int i = 0; i < n; i++)
+    hits += out[i] = (ax[i] >= m.ax && bx[i] <= m.bx && ay[i] >= m.ay && by[i] <= m.by);
+  return hits;
+}
+
+static int scalar_clip(coord_int* ax, coord_int* ay, coord_int* bx, coord_int* by, int n, const zone& m, signed char* out)
+{
+  int hits = 0;
+  for (int i = 0; i < n; i++)
+  {
+    if (m.ax > bx[i] || m.bx < ax[i] || m.ay > by[i] || m.by < ay[i])
+    {
+      out[i] = -1;
+      continue;
+    }
+
+    // Just as 'zone::clip' counts them
+    int clips = 0;
+    if (m.ax < ax[i]) clips++; else ax[i] = m.ax;
+    if (m.ay < ay[i]) clips++; else ay[i] = m.ay;
+    if (m.bx > bx[i]) clips++; else bx[i] = m.bx;
+    if (m.by > by[i]) clips++; else by[i] = m.by;
+
+    out[i] = clips;
+    hits++;
+  }
+  return hits;
+}
+
+#ifdef PZ_SSE2
+
+/* The vector kernels are written in terms of these little helpers, so that the
+   same code serves both widths of coord_int. With 16-bit co-ordinates, SSE2 has
+   8 lanes; with 32-bit, only 4, and no min or max instructions. */
+
+#ifdef PENGUIN_COORD32
+
+enum { sse2_lanes = 4 };
+
+static inline __m128i sse2_set(coord_int a) { return _mm_set1_epi32(a); }
+static inline __m128i sse2_gt(__m128i a, __m128i b) { return _mm_cmpgt_epi32(a, b); }
+static inline __m128i sse2_add(__m128i a, __m128i b) { return _mm_add_epi32(a, b); }
+static inline __m128i sse2_sub(__m128i a, __m128i b) { return _mm_sub_epi32(a, b); }
+static inline __m128i sse2_select(__m128i m, __m128i a, __m128i b) { return _mm_or_si128(_mm_and_si128(m, a), _mm_andnot_si128(m, b)); }
+static inline __m128i sse2_max(__m128i a, __m128i b) { return sse2_select(_mm_cmpgt_epi32(a, b), a, b); }
+static inline __m128i sse2_min(__m128i a, __m128i b) { return sse2_select(_mm_cmpgt_epi32(a, b), b, a); }
+
+// Packs each lane down to a byte, and stores them
+static inline void sse2_store_bytes(void* out, __m128i lanes)
+{
+  int bytes = _mm_cvtsi128_si32(_mm_packs_epi16(_mm_packs_epi32(lanes, lanes), lanes));
+  memcpy(out, &bytes, sizeof(bytes));
+}
+
+#else
+
+enum { sse2_lanes = 8 };
+
+static inline __m128i sse2_set(coord_int a) { return _mm_set1_epi16(a); }
+static inline __m128i sse2_gt(__m128i a, __m128i b) { return _mm_cmpgt_epi16(a, b); }
+static inline __m128i sse2_add(__m128i a, __m128i b) { return _mm_add_epi16(a, b); }
+static inline __m128i sse2_sub(__m128i a, __m128i b) { return _mm_sub_epi16(a, b); }
+static inline __m128i sse2_select(__m128i m, __m128i a, __m128i b) { return _mm_or_si128(_mm_and_si128(m, a), _mm_andnot_si128(m, b)); }
+static inline __m128i sse2_max(__m128i a, __m128i b) { return _mm_max_epi16(a, b); }
+static inline __m128i sse2_min(__m128i a, __m128i b) { return _mm_min_epi16(a, b); }
+
+static inline void sse2_store_bytes(void* out, __m128i lanes)
+{
+  _mm_storel_epi64((__m128i*)out, _mm_packs_epi16(lanes, lanes));
+}
+
+#endif
+
+static inline __m128i sse2_load(const coord_int* p) { return _mm_loadu_si128((const __m128i*)p); }
+static inline void sse2_store(coord_int* p, __m128i a) { _mm_storeu_si128((__m128i*)p, a); }
+
+// Returns the number of lanes of the comparison result (m) that are set
+static inline int sse2_count(__m128i m) { return __builtin_popcount(_mm_movemask_epi8(m)) / (16 / sse2_lanes); }
+
+/* SSE2 versions. Each comparison gives a lane of all ones where it holds, which
+   are or-ed together to give a 'miss' mask, and then packed down into bytes for
+   the output. */
+
+static int sse2_overlapping(const coord_int* ax, const coord_int* ay, const coord_int* bx, const coord_int* by, int n, const zone& m, unsigned char* out)
+{
+  const __m128i m_ax = sse2_set(m.ax), m_ay = sse2_set(m.ay);
+  const __m128i m_bx = sse2_set(m.bx), m_by = sse2_set(m.by);
+  const __m128i one = sse2_set(1);
+
+  int i = 0, hits = 0;
+  for (; i + sse2_lanes <= n; i += sse2_lanes)
+  {
+    __m128i z_ax = sse2_load(ax + i), z_ay = sse2_load(ay + i);
+    __m128i z_bx = sse2_load(bx + i), z_by = sse2_load(by + i);
+
+    __m128i miss = _mm_or_si128(_mm_or_si128(sse2_gt(m_ax, z_bx), sse2_gt(z_ax, m_bx)),
+                                _mm_or_si128(sse2_gt(m_ay, z_by), sse2_gt(z_ay, m_by)));
+
+    sse2_store_bytes(out + i, _mm_andnot_si128(miss, one));
+    hits += sse2_lanes - sse2_count(miss);
+  }
+
+  return hits + scalar_overlapping(ax + i, ay + i, bx + i, by + i, n - i, m, out + i);
+}
+
+static int sse2_contained(const coord_int* ax, const coord_int* ay, const coord_int* bx, const coord_int* by, int n, const zone& m, unsigned char* out)
+{
+  const __m128i m_ax = sse2_set(m.ax), m_ay = sse2_set(m.ay);
+  const __m128i m_bx = sse2_set(m.bx), m_by = sse2_set(m.by);
+  const __m128i one = sse2_set(1);
+
+  int i = 0, hits = 0;
+  for (; i + sse2_lanes <= n; i += sse2_lanes)
+  {
+    __m128i z_ax = sse2_load(ax + i), z_ay = sse2_load(ay + i);
+    __m128i z_bx = sse2_load(bx + i), z_by = sse2_load(by + i);
+
+    __m128i outside = _mm_or_si128(_mm_or_si128(sse2_gt(m_ax, z_ax), sse2_gt(z_bx, m_bx)),
+                                   _mm_or_si128(sse2_gt(m_ay, z_ay), sse2_gt(z_by, m_by)));
+
+    sse2_store_bytes(out + i, _mm_andnot_si128(outside, one));
+    hits += sse2_lanes - sse2_count(outside);
+  }
+
+  return hits + scalar_contained(ax + i, ay + i, bx + i, by + i, n - i, m, out + i);
+}
+
+static int sse2_clip(coord_int* ax, coord_int* ay, coord_int* bx, coord_int* by, int n, const zone& m, signed char* out)
+{
+  const __m128i m_ax = sse2_set(m.ax), m_ay = sse2_set(m.ay);
+  const __m128i m_bx = sse2_set(m.bx), m_by = sse2_set(m.by);
+
+  int i = 0, hits = 0;
+  for (; i + sse2_lanes <= n; i += sse2_lanes)
+  {
+    __m128i z_ax = sse2_load(ax + i), z_ay = sse2_load(ay + i);
+    __m128i z_bx = sse2_load(bx + i), z_by = sse2_load(by + i);
+
+    __m128i miss = _mm_or_si128(_mm_or_si128(sse2_gt(m_ax, z_bx), sse2_gt(z_ax, m_bx)),
+                                _mm_or_si128(sse2_gt(m_ay, z_by), sse2_gt(z_ay, m_by)));
+
+    // Each comparison is -1 where that side needed clipping, so their sum is -clips
+    __m128i clips = sse2_sub(_mm_setzero_si128(),
+                    sse2_add(sse2_add(sse2_gt(z_ax, m_ax), sse2_gt(z_ay, m_ay)),
+                             sse2_add(sse2_gt(m_bx, z_bx), sse2_gt(m_by, z_by))));
+    sse2_store_bytes(out + i, _mm_or_si128(miss, clips)); // Misses are -1
+
+    // Zones that missed the mask are left alone
+    sse2_store(ax + i, sse2_select(miss, z_ax, sse2_max(z_ax, m_ax)));
+    sse2_store(ay + i, sse2_select(miss, z_ay, sse2_max(z_ay, m_ay)));
+    sse2_store(bx + i, sse2_select(miss, z_bx, sse2_min(z_bx, m_bx)));
+    sse2_store(by + i, sse2_select(miss, z_by, sse2_min(z_by, m_by)));
+
+    hits += sse2_lanes - sse2_count(miss);
+  }
+
+  return hits + scalar_clip(ax + i, ay + i, bx + i, by + i, n - i, m, out + i);
+}
+
+#endif // PZ_SSE2
+
+#ifdef PZ_AVX2
+
+/* The AVX2 helpers. Twice the lanes of SSE2, and the only wrinkle is that 
+   packing works within each 128-bit half, so the packed bytes have to be put
+   back in order before they can be stored. */
+
+#ifdef PENGUIN_COORD32
+
+enum { avx2_lanes = 8 };
+
+PZ_TARGET_AVX2 static inline __m256i avx2_set(coord_int a) { return _mm256_set1_epi32(a); }
+PZ_TARGET_AVX2 static inline __m256i avx2_gt(__m256i a, __m256i b) { return _mm256_cmpgt_epi32(a, b); }
+PZ_TARGET_AVX2 static inline __m256i avx2_add(__m256i a, __m256i b) { return _mm256_add_epi32(a, b); }
+PZ_TARGET_AVX2 static inline __m256i avx2_sub(__m256i a, __m256i b) { return _mm256_sub_epi32(a, b); }
+PZ_TARGET_AVX2 static inline __m256i avx2_max(__m256i a, __m256i b) { return _mm256_max_epi32(a, b); }
+PZ_TARGET_AVX2 static inline __m256i avx2_min(__m256i a, __m256i b) { return _mm256_min_epi32(a, b); }
+
+PZ_TARGET_AVX2 static inline void avx2_store_bytes(void* out, __m256i lanes)
+{
+  __m256i packed = _mm256_packs_epi16(_mm256_packs_epi32(lanes, lanes), lanes);
+  packed = _mm256_permutevar8x32_epi32(packed, _mm256_setr_epi32(0, 4, 0, 0, 0, 0, 0, 0));
+  _mm_storel_epi64((__m128i*)out, _mm256_castsi256_si128(packed));
+}
+
+#else
+
+enum { avx2_lanes = 16 };
+
+PZ_TARGET_AVX2 static inline __m256i avx2_set(coord_int a) { return _mm256_set1_epi16(a); }
+PZ_TARGET_AVX2 static inline __m256i avx2_gt(__m256i a, __m256i b) { return _mm256_cmpgt_epi16(a, b); }
+PZ_TARGET_AVX2 static inline __m256i avx2_add(__m256i a, __m256i b) { return _mm256_add_epi16(a, b); }
+PZ_TARGET_AVX2 static inline __m256i avx2_sub(__m256i a, __m256i b) { return _mm256_sub_epi16(a, b); }
+PZ_TARGET_AVX2 static inline __m256i avx2_max(__m256i a, __m256i b) { return _mm256_max_epi16(a, b); }
+PZ_TARGET_AVX2 static inline __m256i avx2_min(__m256i a, __m256i b) { return _mm256_min_epi16(a, b); }
+
+PZ_TARGET_AVX2 static inline void avx2_store_bytes(void* out, __m256i lanes)
+{
+  __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi16(lanes, lanes), 0xD8);
+  _mm_storeu_si128((__m128i*)out, _mm256_castsi256_si128(packed));
+}
+
+#endif
+
+PZ_TARGET_AVX2 static inline __m256i avx2_load(const coord_int* p) { return _mm256_loadu_si256((const __m256i*)p); }
+PZ_TARGET_AVX2 static inline void avx2_store(coord_int* p, __m256i a) { _mm256_storeu_si256((__m256i*)p, a); }
+PZ_TARGET_AVX2 static inline int avx2_count(__m256i m) { return __builtin_popcount(_mm256_movemask_epi8(m)) / (32 / avx2_lanes); }
+
+PZ_TARGET_AVX2 static int avx2_overlapping(const coord_int* ax, const coord_int* ay, const coord_int* bx, const coord_int* by, int n, const zone& m, unsigned char* out)
+{
+  const __m256i m_ax = avx2_set(m.ax), m_ay = avx2_set(m.ay);
+  const __m256i m_bx = avx2_set(m.bx), m_by = avx2_set(m.by);
+  const __m256i one = avx2_set(1);
+
+  int i = 0, hits = 0;
+  for (; i + avx2_lanes <= n; i += avx2_lanes)
+  {
+    __m256i z_ax = avx2_load(ax + i), z_ay = avx2_load(ay + i);
+    __m256i z_bx = avx2_load(bx + i), z_by = avx2_load(by + i);
+
+    __m256i miss = _mm256_or_si256(_mm256_or_si256(avx2_gt(m_ax, z_bx), avx2_gt(z_ax, m_bx)),
+                                   _mm256_or_si256(avx2_gt(m_ay, z_by), avx2_gt(z_ay, m_by)));
+
+    avx2_store_bytes(out + i, _mm256_andnot_si256(miss, one));
+    hits += avx2_lanes - avx2_count(miss);
+  }
+
+  return hits + sse2_overlapping(ax + i, ay + i, bx + i, by + i, n - i, m, out + i);
+}
+
+PZ_TARGET_AVX2 static int avx2_contained(const coord_int* ax, const coord_int* ay, const coord_int* bx, const coord_int* by, int n, const zone& m, unsigned char* out)
+{
+  const __m256i m_ax = avx2_set(m.ax), m_ay = avx2_set(m.ay);
+  const __m256i m_bx = avx2_set(m.bx), m_by = avx2_set(m.by);
+  const __m256i one = avx2_set(1);
+
+  int i = 0, hits = 0;
+  for (; i + avx2_lanes <= n; i += avx2_lanes)
+  {
+    __m256i z_ax = avx2_load(ax + i), z_ay = avx2_load(ay + i);
+    __m256i z_bx = avx2_load(bx + i), z_by = avx2_load(by + i);
+
+    __m256i outside = _mm256_or_si256(_mm256_or_si256(avx2_gt(m_ax, z_ax), avx2_gt(z_bx, m_bx)),
+                                      _mm256_or_si256(avx2_gt(m_ay, z_ay), avx2_gt(z_by, m_by)));
+
+    avx2_store_bytes(out + i, _mm256_andnot_si256(outside, one));
+    hits += avx2_lanes - avx2_count(outside);
+  }
+
+  return hits + sse2_contained(ax + i, ay + i, bx + i, by + i, n - i, m, out + i);
+}
+
+PZ_TARGET_AVX2 static int avx2_clip(coord_int* ax, coord_int* ay, coord_int* bx, coord_int* by, int n, const zone& m, signed char* out)
+{
+  const __m256i m_ax = avx2_set(m.ax), m_ay = avx2_set(m.ay);
+  const __m256i m_bx = avx2_set(m.bx), m_by = avx2_set(m.by);
+
+  int i = 0, hits = 0;
+  for (; i + avx2_lanes <= n; i += avx2_lanes)
+  {
+    __m256i z_ax = avx2_load(ax + i), z_ay = avx2_load(ay + i);
+    __m256i z_bx = avx2_load(bx + i), z_by = avx2_load(by + i);
+
+    __m256i miss = _mm256_or_si256(_mm256_or_si256(avx2_gt(m_ax, z_bx), avx2_gt(z_ax, m_bx)),
+                                   _mm256_or_si256(avx2_gt(m_ay, z_by), avx2_gt(z_ay, m_by)));
+
+    __m256i clips = avx2_sub(_mm256_setzero_si256(),
+                    avx2_add(avx2_add(avx2_gt(z_ax, m_ax), avx2_gt(z_ay, m_ay)),
+                             avx2_add(avx2_gt(m_bx, z_bx), avx2_gt(m_by, z_by))));
+    avx2_store_bytes(out + i, _mm256_or_si256(miss, clips));
+
+    avx2_store(ax + i, _mm256_blendv_epi8(avx2_max(z_ax, m_ax), z_ax, miss));
+    avx2_store(ay + i, _mm256_blendv_epi8(avx2_max(z_ay, m_ay), z_ay, miss));
+    avx2_store(bx + i, _mm256_blendv_epi8(avx2_min(z_bx, m_bx), z_bx, miss));
+    avx2_store(by + i, _mm256_blendv_epi8(avx2_min(z_by, m_by), z_by, miss));
+
+    hits += avx2_lanes - avx2_count(miss);
+  }
+
+  return hits + sse2_clip(ax + i, ay + i, bx + i, by + i, n - i, m, out + i);
+}
+
+#endif // PZ_AVX2
+
+// Picks the best kernels this processor can run. Only done once.
+static zone_kernels pick_zone_kernels()
+{
+  zone_kernels k;
+  k.overlapping = scalar_overlapping;
+  k.contained = scalar_contained;
+  k.clip = scalar_clip;
+  k.name = "scalar";
+
+#ifdef PZ_SSE2
+  k.overlapping = sse2_overlapping;
+  k.contained = sse2_contained;
+  k.clip = sse2_clip;
+  k.name = "SSE2";
+#endif
+
+#ifdef PZ_AVX2
+  if (__builtin_cpu_supports("avx2"))
+  {
+    k.overlapping = avx2_overlapping;
+    k.contained = avx2_contained;
+    k.clip = avx2_clip;
+    k.name = "AVX2";
+  }
+#endif
+
+  return k;
+}
+
+static const zone_kernels& kernels()
+{
+  static const zone_kernels k = pick_zone_kernels();
+  return k;
+}
+
+const char* zone_kernel_name()
+{
+  return kernels().name;
+}
+
+void zone_array::push_list(const zone* list)
+{
+  for (; list; list = list->next) push_back(*list);
+}
+
+zone* zone_array::make_list() const
+{
+  zone* list = 0;
+  for (int i = size() - 1; i >= 0; i--) push_front(list, new zone(get(i)));
+  return list;
+}
+
+int zone_array::overlapping(const zone& mask, unsigned char* out) const
+{
+  if (empty()) return 0;
+  return kernels().overlapping(&ax[0], &ay[0], &bx[0], &by[0], size(), mask, out);
+}
+
+int zone_array::contained(const zone& mask, unsigned char* out) const
+{
+  if (empty()) return 0;
+  return kernels().contained(&ax[0], &ay[0], &bx[0], &by[0], size(), mask, out);
+}
+
+int zone_array::clip(const zone& mask, signed char* out)
+{
+  if (empty()) return 0;
+  return kernels().clip(&ax[0], &ay[0], &bx[0], &by[0], size(), mask, out);
+}
+
+/* Array version of 'occlude'. For each mask, the overlap kernel finds every zone
+ * that it touches in one sweep. Those zones are split exactly as 'occlude' does,
+ * with the new pieces added to the end, and the zones that were split are then
+ * squeezed out of the arrays. The pieces never overlap the mask that made them,
+ * so they needn't be tested against it again.
+ */
+void zone_array::occlude(const zone* mask)
+{
+  for (; mask && !empty(); mask = mask->next)
+  {
+    int n = size();
+    hits.resize(n);
+    if (!overlapping(*mask, &hits[0])) continue;
+
+    int kept = 0;
+    for (int i = 0; i < n; i++)
+    {
+      coord_int z_ax = ax[i], z_ay = ay[i], z_bx = bx[i], z_by = by[i];
+
+      if (!hits[i]) // Untouched, so shuffle it down over any split zones
+      {
+        ax[kept] = z_ax; ay[kept] = z_ay; bx[kept] = z_bx; by[kept] = z_by;
+        kept++;
+        continue;
+      }
+
+      coord_int mask_ay = mask->ay;
+      coord_int mask_by = mask->by;
+
+      if (mask_ay <= z_ay) mask_ay = z_ay; else push_back(z_ax, z_ay, z_bx, mask_ay - 1);
+      if (mask_by >= z_by) mask_by = z_by; else push_back(z_ax, mask_by + 1, z_bx, z_by);
+      if (mask->ax > z_ax) push_back(z_ax, mask_ay, mask->ax - 1, mask_by);
+      if (mask->bx < z_bx) push_back(mask->bx + 1, mask_ay, z_bx, mask_by);
+    }
+
+    // Move the new pieces down to join the zones that were kept
+    int pieces = size() - n;
+    for (int i = 0; i < pieces; i++)
+    {
+      ax[kept + i] = ax[n + i]; ay[kept + i] = ay[n + i];
+      bx[kept + i] = bx[n + i]; by[kept + i] = by[n + i];
+    }
+
+    ax.resize(kept + pieces); ay.resize(kept + pieces);
+    bx.resize(kept + pieces); by.resize(kept + pieces);
+  }
+}
@@ -0,0 +1,64 @@
+#ifndef PZARRAY_H
+#define PZARRAY_H
+
+#include "pzone.h"
+#include <vector>
+
+/* A zone_array holds a set of zones as four parallel arrays of co-ordinates,
+ * rather than as a linked list. This lets the comparison kernels below look at
+ * many zones at once: with SSE2 they test 8 zones per instruction against a
+ * mask, and with AVX2, 16 (half that in a PENGUIN_COORD32 build). The kernels are picked at run-time to suit the
+ * processor, falling back on plain C++ where neither is available.
+ *
+ * The order of the zones in an array is not significant, and 'occlude' will
+ * shuffle them about.
+ */
+class zone_array
+{
+  private:
+
+    std::vector<coord_int> ax; // Top left x, y co-ordinates of each zone
+    std::vector<coord_int> ay;
+    std::vector<coord_int> bx; // Bottom right x, y co-ordinates of each zone
+    std::vector<coord_int> by;
+
+    std::vector<unsigned char> hits; // Scratch space used by 'occlude'
+
+  public:
+
+    int size() const { return ax.size(); }
+    bool empty() const { return ax.empty(); }
+    void clear() { ax.clear(); ay.clear(); bx.clear(); by.clear(); }
+    void reserve(int n) { ax.reserve(n); ay.reserve(n); bx.reserve(n); by.reserve(n); }
+
+    void push_back(coord_int _ax, coord_int _ay, coord_int _bx, coord_int _by)
+    { ax.push_back(_ax); ay.push_back(_ay); bx.push_back(_bx); by.push_back(_by); }
+    void push_back(const zone& z) { push_back(z.ax, z.ay, z.bx, z.by); }
+    void push_list(const zone* list); // Adds every zone in the list
+
+    zone get(int i) const { return zone(ax[i], ay[i], bx[i], by[i]); }
+    zone* make_list() const; // Returns a newly allocated linked list of our zones
+
+    /* The kernels. Each writes one byte per zone to (out), and returns how many
+       of the zones the test held for:
+       'overlapping' - 1 if the zone overlaps (mask), 0 if not
+       'contained'   - 1 if the zone lies entirely within (mask), 0 if not
+       'clip'        - clips each zone to (mask) and writes the number of sides
+                       clipped, or -1 for zones that don't overlap it, which are
+                       left as they are. The same as calling 'zone::clip'. */
+    int overlapping(const zone& mask, unsigned char* out) const;
+    int contained(const zone& mask, unsigned char* out) const;
+    int clip(const zone& mask, signed char* out);
+
+    // The same as the free 'occlude' function: cuts every mask in the list out
+    // of our zones, splitting zones into up to four pieces where necessary.
+    void occlude(const zone* mask);
+
+    zone_array() { }
+    zone_array(const zone* list) { push_list(list); }
+};
+
+// Returns the name of the kernels in use: "AVX2", "SSE2" or "scalar"
+const char* zone_kernel_name();
+
+#endif
@@ -1,18 +1,160 @@
 #include "pzone.h"
+#include "pzarray.h"
 #include "pbasewin.h"
 
-/*
-  "Clips" is set after execution of the "intersect" function, and will be:
-  -1 - if the zones did not overlap,
-   0 - if the passed zone was within the called zone,
-   x - otherwise, the number of sides that had to be clipped,
+#ifdef PENGUIN_THREADS
+#include <pthread.h>
+#endif
+
+/* Zones are made and thrown away in enormous numbers, every occlusion splits
+   them up into as many as four more, so rather than going to the heap each time
+   they are carved out of large blocks and recycled through a free-list. When
+   Penguin is built with PENGUIN_THREADS, every thread gets an arena of its own,
+   so vis-lists can be calculated on several threads without any contention. A
+   zone freed on a different thread from the one that made it simply joins the
+   freeing thread's list. Blocks are never given back to the heap. */
+class zone_arena
+{
+  private:
+
+    union slot
+    {
+      slot* next;
+      char data[sizeof(zone)];
+    };
+
+    enum { block_size = 256 }; // Number of zones carved out of each block
+
+    slot* free_list;
+
+  public:
+
+    void* take()
+    {
+      if (!free_list)
+      {
+        slot* block = new slot[block_size];
+        for (int i = 0; i < block_size - 1; i++) block[i].next = &block[i + 1];
+        block[block_size - 1].next = 0;
+        free_list = block;
+      }
+
+      slot* s = free_list;
+      free_list = s->next;
+      return s;
+    }
+
+    void give(void* p)
+    {
+      slot* s = static_cast<slot*>(p);
+      s->next = free_list;
+      free_list = s;
+    }
+
+    zone_arena() : free_list(0) { }
+};
+
+// Everything that each thread keeps for itself: its arena, its statistics, and
+// an array for 'occlude' to work in
+struct zone_thread_data
+{
+  zone_arena arena;
+  zone_stats stats;
+  zone_array scratch;
+  zone_thread_data* next; // All threads' data are linked, so they can be totalled
+  
+  zone_thread_data() : next(0) { }
+};
+
+#ifdef PENGUIN_THREADS
+
+static pthread_key_t zone_thread_key;
+static pthread_once_t zone_thread_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t zone_thread_lock = PTHREAD_MUTEX_INITIALIZER;
+static zone_thread_data* zone_threads = 0;
+
+static void make_zone_thread_key()
+{
+  pthread_key_create(&zone_thread_key, 0);
+}
+
+// Returns the calling thread's data, creating it the first time it is needed.
+// It is never deleted, as other threads may still hold zones from its arena.
+static zone_thread_data& local_zone_data()
+{
+  pthread_once(&zone_thread_once, make_zone_thread_key);
+
+  zone_thread_data* data = static_cast<zone_thread_data*>(pthread_getspecific(zone_thread_key));
+  if (!data)
+  {
+    data = new zone_thread_data;
+    pthread_setspecific(zone_thread_key, data);
+    
+    pthread_mutex_lock(&zone_thread_lock);
+    data->next = zone_threads;
+    zone_threads = data;
+    pthread_mutex_unlock(&zone_thread_lock);
+  }
+
+  return *data;
+}
+
+zone_stats zone_stats::total()
+{
+  zone_stats sum;
+  
+  pthread_mutex_lock(&zone_thread_lock);
+  for (zone_thread_data* loop = zone_threads; loop; loop = loop->next)
+  {
+    sum.count += loop->stats.count;
+    sum.intersects += loop->stats.intersects;
+    sum.overlaps += loop->stats.overlaps;
+  }
+  pthread_mutex_unlock(&zone_thread_lock);
+  
+  return sum;
+}
+
+#else
+
+static zone_thread_data& local_zone_data()
+{
+  static zone_thread_data data;
+  return data;
+}
+
+zone_stats zone_stats::total()
+{
+  return local_zone_data().stats;
+}
 
-  "Num" is a simple zone count; it is incremented in every initializer, and
-  decremented in every destructor. A memory leak will yield a greater-than-zero
-  zone count.
-*/
-int zone::count = 0;
-int zone::clips = 0;
+#endif
+
+zone_stats& zone_stats::local()
+{
+  return local_zone_data().stats;
+}
+
+void* zone::operator new(std::size_t size)
+{
+  zone_thread_data& data = local_zone_data();
+  data.stats.count++;
+
+  // Anything that isn't exactly a zone goes to the heap as normal
+  if (size != sizeof(zone)) return ::operator new(size);
+  return data.arena.take();
+}
+
+void zone::operator delete(void* p, std::size_t size)
+{
+  if (!p) return;
+
+  zone_thread_data& data = local_zone_data();
+  data.stats.count--;
+
+  if (size != sizeof(zone)) ::operator delete(p);
+  else data.arena.give(p);
+}
 
 // Checks (this) against (other) for overlap. Returns -1 if none, otherwise number of
 // conflicting sides. Assumes (other) != NULL.
@@ -53,7 +195,6 @@ zone::zone(const base_window* win)
   ay = win->get_cy();
   bx = win->get_dx();
   by = win->get_dy();
-  count++;
 }
 
 // Returns zone just before (other) in (this) list, and NULL if not found.
@@ -80,10 +221,32 @@ void zone::offset_list(coord_int x, coord_int y)
 
 /* This function must compare every zone in its list against every zone in the mask list.
  * For any zones it finds that overlap with a mask zone, it will subdivide the old zone
- * into 4 or less new zones that hug the sides of the mask zone. Pretty safe. */
+ * into 4 or less new zones that hug the sides of the mask zone. Pretty safe.
+ *
+ * Against many masks, as when a window's vis-list is cut from under all the windows
+ * above it, the list grows long enough that testing its zones a vector at a time
+ * pays for copying them into a zone_array and back; below about 48 masks, it doesn't.
+ * The zones come back in a different order, which nothing here depends on. */
  
 void occlude(zone*& list, const zone* mask)
 {
+  const int array_masks = 48;
+
+  int masks = 0;
+  for (const zone* loop = mask; loop && masks < array_masks; loop = loop->next) masks++;
+
+  if (list && masks == array_masks)
+  {
+    zone_array& scratch = local_zone_data().scratch;
+    scratch.clear();
+    scratch.push_list(list);
+    scratch.occlude(mask);
+
+    delete_zonelist(list);
+    list = scratch.make_list();
+    return;
+  }
+
   zone* next_vis; // Temporary for incrementing a pointer afer deleting its zone
 
   for (; mask; mask = mask->next) 
@@ -129,22 +292,74 @@ void occlude(zone*& list, const zone* mask)
 
 // This function returns a new zone initialized with the co-ordinates of the intersection
 // between (this) and (other). If there is none, NULL is returned. Assumes (other) != NULL.
-zone* zone::intersect(const zone* other) const
+zone* zone::intersect(const zone* other, int* clips) const
+{
+  zone_intersection result = intersection(*other);
+  if (clips) *clips = result.clips;
+  
+  return result.overlaps() ? new zone(result.area) : 0;
+}
+
+// Returns the intersection between (this) and (other), and the number of clips, by value.
+zone_intersection zone::intersection(const zone& other) const
 {
+  zone_intersection result;
+  zone_stats& stats = zone_stats::local();
+  stats.intersects++;
+  
   // If the other zone doesn't overlap us, leave it.
-  if (other->ax > bx || other->bx < ax || other->ay > by || other->by < ay)
+  if (other.ax > bx || other.bx < ax || other.ay > by || other.by < ay)
   {
-    zone::clips = -1;
-    return 0;
+    result.clips = -1;
+    return result;
   }
 
-  zone::clips = 0;
+  stats.overlaps++;
+  result.clips = 0;
+
+  // Clip the other zone to our dimensions
+  result.area.ax = (other.ax < ax) ? (++result.clips, ax): other.ax;
+  result.area.ay = (other.ay < ay) ? (++result.clips, ay): other.ay;
+  result.area.bx = (other.bx > bx) ? (++result.clips, bx): other.bx;
+  result.area.by = (other.by > by) ? (++result.clips, by): other.by;
+  
+  return result;
+}
 
-  // Clip the other zone to our dimensions and return the result
-  return new zone((other->ax < ax) ? (++zone::clips, ax): other->ax,
-                  (other->ay < ay) ? (++zone::clips, ay): other->ay,
-                  (other->bx > bx) ? (++zone::clips, bx): other->bx,
-                  (other->by > by) ? (++zone::clips, by): other->by);
+/* Batch form of 'intersection'. As the (others) are an array rather than a list,
+ * this loop doesn't have to chase pointers, and the compiler is free to keep our
+ * own co-ordinates in registers throughout. Entries of (out) whose clips are -1
+ * are left untouched.
+ */
+int zone::intersect_array(const zone* others, int n, zone* out, int* clips) const
+{
+  const coord_int ax = this->ax, ay = this->ay, bx = this->bx, by = this->by;
+  int overlaps = 0;
+  
+  for (int i = 0; i < n; i++)
+  {
+    const zone& other = others[i];
+    
+    if (other.ax > bx || other.bx < ax || other.ay > by || other.by < ay)
+    {
+      clips[i] = -1;
+      continue;
+    }
+    
+    int c = 0;
+    out[i].ax = (other.ax < ax) ? (++c, ax): other.ax;
+    out[i].ay = (other.ay < ay) ? (++c, ay): other.ay;
+    out[i].bx = (other.bx > bx) ? (++c, bx): other.bx;
+    out[i].by = (other.by > by) ? (++c, by): other.by;
+    clips[i] = c;
+    overlaps++;
+  }
+  
+  zone_stats& stats = zone_stats::local();
+  stats.intersects += n;
+  stats.overlaps += overlaps;
+  
+  return overlaps;
 }
 
 // Clips (this) to a maximum defined by (other), returns collisions, -1 if no overlap.
@@ -2,8 +2,33 @@
 #define PZONE_H
 
 #include "pdefs.h" 
+#include <cstddef>
 
 class base_window;
+struct zone_intersection;
+
+/* Statistics on the use of zones. Each thread keeps its own, so that zones can
+   be made and compared on any number of threads without them getting in each
+   other's way. 'total' adds up every thread's figures, and so is only exact
+   while the other threads are idle. */
+struct zone_stats
+{
+  /* "Count" is incremented for every zone allocated with new, and decremented
+     for every one deleted. Zones on the stack can't leak, and so are left out,
+     which keeps their constructors free of any bookkeeping. A memory leak will
+     yield a greater-than-zero total count once all zones have been deleted. A
+     zone deleted on a different thread from the one that made it will leave
+     both threads' counts off by one, but the total will still be correct. */
+  int count;
+  
+  int intersects; // Number of intersections asked for, by any of the functions
+  int overlaps;   // Number of those intersections that found an overlap
+
+  zone_stats() : count(0), intersects(0), overlaps(0) { }
+
+  static zone_stats& local(); // Returns the calling thread's statistics
+  static zone_stats total();  // Returns the statistics of all threads, added up
+};
 
 // The zone class is a group of 4 co-ordinates representing a rectangular area. A "next"
 // pointer is also built into the class to allow for easily daisy-chained "zones".
@@ -19,32 +44,26 @@ class zone
     zone* next;   // Next zone in list (if any).
 
     /*
-       "Clips" is set after execution of the "intersect" function, and will be:
+       Several of the functions below return a number of "clips", which will be:
        -1 - if the zones did not overlap,
         0 - if the passed zone was within the called zone,
         x - otherwise, the number of sides that had to be clipped,
-
-       "Num" is a simple zone count; it is incremented in every initializer, and
-       decremented in every destructor. A memory leak will yield a greater-than-zero
-       zone count after all zones have gone out of scope.
     */
-    static int clips;
-    static int count;
 
     zone() 
     : ax(0), ay(0), bx(0), by(0), next(0)
-    { count++; }
+    { }
 
     // Copy constructor
     zone(const zone& other)
     : ax(other.ax), ay(other.ay), bx(other.bx), by(other.by), next(0)  
-    { count++; }
+    { }
 
     // Deep-copy constructor: copies off the entire list pointed to by "other".
     zone(const zone* other)
     : ax(other->ax), ay(other->ay), bx(other->bx), by(other->by),
       next(other->next ? other->next->duplicate() : 0)
-    { count++; }
+    { }
 
     // Window constructor: Initialized with the physical coordinates of the window.
     zone(const base_window* win);
@@ -52,11 +71,12 @@ class zone
     // Normal constructor, takes 4 variables for all its co-ordinates
     zone(coord_int _ax, coord_int _ay, coord_int _bx, coord_int _by)
     : ax(_ax), ay(_ay), bx(_bx), by(_by), next(0)
-    { count++; }
+    { }
 
-    // Zone destructor: Decrements zone count
-    ~zone()
-    { count--; }
+    // Zones are allocated from a per-thread arena rather than the heap, which
+    // also counts them. See pzone.cpp.
+    static void* operator new(std::size_t size);
+    static void operator delete(void* p, std::size_t size);
 
     coord_int w() const { return (bx - ax); } // Calculates, returns the width
     coord_int h() const { return (by - ay); } // Calculates, returns the height
@@ -71,9 +91,19 @@ class zone
     // Clips (this) to (other) like "intersect", but returns number of collisions.
     int clip(const zone* other);         
     
+    // Returns the intersection between (this) and (other) by value, along with
+    // the number of clips. Doesn't allocate, and is safe to use on any thread.
+    zone_intersection intersection(const zone& other) const;
+    
+    // Intersects (this) with each of the (n) zones in the array (others), which
+    // are not treated as a list. The results are written to (out) and the clips
+    // to (clips), in the same order. Returns the number that overlapped.
+    int intersect_array(const zone* others, int n, zone* out, int* clips) const;
+    
     // Returns a new zone with the co-ords of the intersection between (this) 
-    // and (other). Returns NULL if none.
-    zone* intersect(const zone* other) const;  
+    // and (other). Returns NULL if none. If (clips) is given, the number of
+    // clips is stored there. Prefer 'intersection', which doesn't allocate.
+    zone* intersect(const zone* other, int* clips =0) const;  
     
     // Returns TRUE if point x,y lies within this zone.
     bool intersect(coord_int x, coord_int y) const; 
@@ -94,6 +124,16 @@ class zone
     friend std::ostream& operator<<(std::ostream&, const zone&);
 };
 
+// The result of 'zone::intersection'. If the zones didn't overlap, (clips) is -1
+// and (area) is meaningless.
+struct zone_intersection
+{
+  zone area;
+  int clips;
+  
+  bool overlaps() const { return clips != -1; }
+};
+
 // Sub-divides all zones in (this) list given a pointer to a list of masks.
 void occlude(zone*& list, const zone* mask);     
 